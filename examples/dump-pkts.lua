@@ -20,11 +20,13 @@ local eth    = require "proto.ethernet"
 local log    = require "log"
 local pcap   = require "pcap"
 local pf     = require "pf"
+local ffi    = require "ffi"
 
 function configure(parser)
 	parser:argument("dev", "Device to use."):args(1):convert(tonumber)
 	parser:option("-a --arp", "Respond to ARP queries on the given IP."):argname("ip")
-	parser:option("-f --file", "Write result to a pcap file.")
+	parser:option("-f --file", "Write result to a pcap file, all threads write to the same file. Files ending in .pcapng are written as pcapng with one interface per thread.")
+	parser:flag("-d --direct", "Bypass the page cache (O_DIRECT and io_uring) for sustained writing to disks, writes one file per thread.")
 	parser:option("-s --snap-len", "Truncate packets to this size."):convert(tonumber):target("snapLen")
 	parser:option("-t --threads", "Number of threads."):convert(tonumber):default(1)
 	parser:option("-o --output", "File to output statistics to")
@@ -47,43 +49,61 @@ function master(args)
 		arp.waitForStartup() -- race condition with arp.handlePacket() otherwise
 	end
 	stats.startStatsTask{rxDevices = {dev}, file = args.output}
+	local writer
+	if args.file then
+		if not args.file:match("%.pcapng$") and not args.file:match("%.pcap$") then
+			args.file = args.file .. ".pcap"
+		end
+		if not args.direct then
+			writer = pcap:newSharedWriter(args.file, args.file:match("%.pcapng$"))
+		end
+	end
 	for i = 1, args.threads do
-		lm.startTask("dumper", dev:getRxQueue(i - 1), args, i)
+		lm.startTask("dumper", dev:getRxQueue(i - 1), args, i, writer)
 	end
 	lm.waitForTasks()
+	if writer then
+		log:info("Flushing buffers, this can take a while...")
+		writer:close()
+	end
 end
 
-function dumper(queue, args, threadId)
+function dumper(queue, args, threadId, writer)
 	local handleArp = args.arp
 	-- default: show everything
 	local filter = args.filter and pf.compile_filter(args.filter) or function() return true end
 	local snapLen = args.snapLen
-	local writer
 	local captureCtr, filterCtr
-	if args.file then
+	local interface
+	local matched
+	if args.direct and args.file then
+		local file = args.file
 		if args.threads > 1 then
-			if args.file:match("%.pcap$") then
-				args.file = args.file:gsub("%.pcap$", "")
-			end
-			args.file = args.file .. "-thread-" .. threadId .. ".pcap"
-		else
-			if not args.file:match("%.pcap$") then
-				args.file = args.file .. ".pcap"
-			end
+			file = file:gsub("(%.pcap[ng]*)$", "-thread-" .. threadId .. "%1")
+		end
+		writer = pcap:newDirectWriter(file, file:match("%.pcapng$"), nil, nil, nil, queue.dev:getSocket())
+	end
+	if writer then
+		if args.file:match("%.pcapng$") then
+			interface = writer:addInterface("rx queue " .. (threadId - 1))
 		end
-		writer = pcap:newWriter(args.file)
 		captureCtr = stats:newPktRxCounter("Capture, thread #" .. threadId)
 		filterCtr = stats:newPktRxCounter("Filter reject, thread #" .. threadId)
 	end
 	local bufs = memory.bufArray()
+	if writer then
+		matched = ffi.new("struct rte_mbuf*[?]", bufs.size)
+	end
 	while lm.running() do
 		local rx = queue:tryRecv(bufs, 100)
 		local batchTime = lm.getTime()
+		local numMatched = 0
 		for i = 1, rx do
 			local buf = bufs[i]
 			if filter(buf:getBytes(), buf:getSize()) then
 				if writer then
-					writer:writeBuf(batchTime, buf, snapLen)
+					matched[numMatched] = buf
+					numMatched = numMatched + 1
 					captureCtr:countPacket(buf)
 				else
 					buf:dump()
@@ -91,6 +111,14 @@ function dumper(queue, args, threadId)
 			elseif filterCtr then
 				filterCtr:countPacket(buf)
 			end
+		end
+		-- one reservation in the shared file per batch
+		if numMatched > 0 and not writer:writeMbufs(batchTime, matched, numMatched, snapLen, interface) then
+			log:error("pcap file is full, stopping capture")
+			lm.stop()
+		end
+		for i = 1, rx do
+			local buf = bufs[i]
 			if handleArp and buf:getEthernetPacket().eth:getType() == eth.TYPE_ARP then
 				-- inject arp packets to the ARP task
 				-- this is done this way instead of using filters to also dump ARP packets here
@@ -108,8 +136,14 @@ function dumper(queue, args, threadId)
 	if writer then
 		captureCtr:finalize()
 		filterCtr:finalize()
-		log:info("Flushing buffers, this can take a while...")
-		writer:close()
+	end
+	if args.direct and writer then
+		local s = writer:getStats()
+		log:info("Thread #%d: %d writes, reap latency mean %.0f us, max %.0f us, queue depth mean %.1f, max %d, %d stalls, %s%s",
+			threadId, s.writes, s.meanReapLatencyUs, s.maxReapLatencyUs, s.meanQueueDepth, s.maxQueueDepth, s.stalls,
+			s.direct and "O_DIRECT" or "page cache", s.uring and " via io_uring" or "")
+		if not writer:close() then
+			log:error("writing the capture file failed")
+		end
 	end
 end
-
@@ -139,6 +139,12 @@ local function syncDemo()
 	lm.startTask("barrierSlave", b, 2, 100)
 	lm.startTask("barrierSlave", b, 3, 1000)
 	lm.waitForTasks()
+	print("Synchronized barriers release all tasks at the same TSC time, e.g., to start tx tasks at the same instant")
+	local sb = barrier:newSynchronized(3)
+	lm.startTask("syncBarrierSlave", sb, 1, 0)
+	lm.startTask("syncBarrierSlave", sb, 2, 100)
+	lm.startTask("syncBarrierSlave", sb, 3, 1000)
+	lm.waitForTasks()
 end
 
 function lockSlave(l)
@@ -156,6 +162,13 @@ function barrierSlave(b, taskId, sleep)
 	print("Got through barrier at timestamp %f", time())
 end
 
+function syncBarrierSlave(b, taskId, sleep)
+	lm.sleepMillisIdle(sleep)
+	local deadline = b:wait()
+	local skew = lm.getCycles() - deadline
+	print("Slave task %d released %d cycles (%.1f ns) after the common deadline", taskId, tonumber(skew), tonumber(skew) / lm.getCyclesFrequency() * 10^9)
+end
+
 function master(...)
 	log:info("Demonstrating global variables: they are not shared between tasks.")
 	globalVarDemo()
@@ -0,0 +1,51 @@
+--- Measures lock acquisition latency under contention for all lock kinds.
+local lm        = require "libmoon"
+local lock      = require "lock"
+local barrier   = require "barrier"
+local histogram = require "histogram"
+local log       = require "log"
+
+local KINDS = { "mutex", "ticket", "mcs", "rw" }
+
+function configure(parser)
+	parser:description("Lock contention benchmark, reports lock() latency percentiles in cycles per lock kind.")
+	parser:option("-t --threads", "Number of contending tasks, requires one core per task."):args(1):convert(tonumber):default(4)
+	parser:option("-n --iterations", "Lock/unlock iterations per task."):args(1):convert(tonumber):default(1000000)
+	parser:option("-c --critical", "Cycles spent in the critical section."):args(1):convert(tonumber):default(100)
+	return parser:parse()
+end
+
+function master(args)
+	for _, kind in ipairs(KINDS) do
+		local l = lock:new(kind)
+		local b = barrier:newSynchronized(args.threads)
+		local tasks = {}
+		for i = 1, args.threads do
+			tasks[i] = lm.startTask("contend", l, b, args.iterations, args.critical)
+		end
+		local hist = histogram:new()
+		for _, task in ipairs(tasks) do
+			for k, v in pairs(task:wait().histo) do
+				hist.histo[k] = (hist.histo[k] or 0) + v
+			end
+		end
+		hist.dirty = true
+		log:info("%-6s lock() latency in cycles: p50 %d, p90 %d, p99 %d, p99.9 %d, max %d",
+			kind, hist:percentile(50), hist:percentile(90), hist:percentile(99), hist:percentile(99.9), hist:max())
+	end
+end
+
+function contend(l, b, iterations, critical)
+	local hist = histogram:new()
+	b:wait()
+	for i = 1, iterations do
+		local start = lm.getCycles()
+		l:lock()
+		local acquired = lm.getCycles()
+		-- buckets of 16 cycles keep the histogram small
+		hist:update(math.floor(tonumber(acquired - start) / 16) * 16)
+		while lm.getCycles() - acquired < critical do end
+		l:unlock()
+	end
+	return hist
+end
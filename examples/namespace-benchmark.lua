@@ -0,0 +1,62 @@
+--- Measures how namespace reads scale with the number of reading tasks.
+local lm         = require "libmoon"
+local namespaces = require "namespaces"
+local barrier    = require "barrier"
+local log        = require "log"
+
+function configure(parser)
+	parser:description("Namespace read scaling benchmark, reports reads per second for 1 to n concurrent readers.")
+	parser:option("-t --threads", "Maximum number of reading tasks, requires one core per task."):args(1):convert(tonumber):default(16)
+	parser:option("-n --iterations", "Reads per task."):args(1):convert(tonumber):default(1000000)
+	parser:option("-k --keys", "Number of keys in the namespace."):args(1):convert(tonumber):default(64)
+	parser:flag("-w --writer", "Run an additional task that keeps overwriting the keys.")
+	return parser:parse()
+end
+
+function master(args)
+	local ns = namespaces:get("benchmark")
+	for i = 1, args.keys do
+		ns["key" .. i] = { id = i, name = "value" .. i }
+	end
+	local threads = 1
+	while threads <= args.threads do
+		local b = barrier:new(threads)
+		local tasks = {}
+		for i = 1, threads do
+			tasks[i] = lm.startTask("reader", b, args.iterations, args.keys)
+		end
+		local writer = args.writer and lm.startTask("writer", args.keys)
+		local total = 0
+		for _, task in ipairs(tasks) do
+			total = total + args.iterations / task:wait()
+		end
+		ns.stop = true
+		if writer then
+			writer:wait()
+		end
+		ns.stop = nil
+		log:info("%2d readers: %.2f M reads/s total, %.2f M reads/s per reader", threads, total / 10^6, total / threads / 10^6)
+		threads = threads * 2
+	end
+end
+
+function reader(b, iterations, keys)
+	local ns = namespaces:get("benchmark")
+	b:wait()
+	local start = lm.getTime()
+	for i = 1, iterations do
+		local val = ns["key" .. (i % keys + 1)]
+		assert(val.id)
+	end
+	return lm.getTime() - start
+end
+
+function writer(keys)
+	local ns = namespaces:get("benchmark")
+	local i = 0
+	while not ns.stop and lm.running() do
+		i = i + 1
+		local key = i % keys + 1
+		ns["key" .. key] = { id = key, name = "value" .. i }
+	end
+end
@@ -0,0 +1,91 @@
+--- Replays one or more pcap/pcapng files with the original inter-packet gaps.
+--- Multiple files are merged by timestamp, e.g., captures of several rx queues.
+--- Large files can be split into ranges replayed by multiple tasks, the files' sidecar indexes are built on first use.
+local lm     = require "libmoon"
+local device = require "device"
+local memory = require "memory"
+local stats  = require "stats"
+local replay = require "replay"
+local pcap   = require "pcap"
+local ffi    = require "ffi"
+local log    = require "log"
+
+-- tasks start replaying their ranges at the same time, this is enough to start them and to map the files
+local START_DELAY = 0.5
+
+function configure(parser)
+	parser:argument("dev", "Device to use."):args(1):convert(tonumber)
+	parser:argument("files", "pcap or pcapng files to replay."):args("+")
+	parser:option("-s --speed", "Replay speed multiplier, 0 sends as fast as possible."):args(1):convert(tonumber):default(1)
+	parser:option("-r --rate", "Ignore timestamps and send at a fixed rate in Mpp/s."):args(1):convert(tonumber)
+	parser:option("-l --loops", "Number of passes over the files, 0 loops forever."):args(1):convert(tonumber):default(1)
+	parser:option("-p --parallel", "Split the files into n ranges replayed by n tasks on n tx queues."):args(1):convert(tonumber):default(1)
+	parser:option("-f --from", "Skip the packets of the first n seconds."):args(1):convert(tonumber)
+	return parser:parse()
+end
+
+function master(args)
+	local dev = device.config{port = args.dev, txQueues = args.parallel}
+	device.waitForLinks()
+	stats.startStatsTask{txDevices = {dev}}
+	-- ranges[i][j] is the part of file j replayed by task i
+	local ranges, timeBase
+	if args.parallel > 1 or args.from then
+		ranges = {}
+		local readers = {}
+		local first, last, packets = -1ULL, 0ULL, 0
+		for j, file in ipairs(args.files) do
+			readers[j] = pcap:newReader(file)
+			local header = readers[j]:getIndex().header
+			first = header.first_ts < first and header.first_ts or first
+			last = header.last_ts > last and header.last_ts or last
+			packets = packets + tonumber(header.num_records)
+		end
+		if args.from then
+			first = first + ffi.cast("uint64_t", args.from * 10^9)
+		end
+		-- all tasks replay their ranges relative to the same timestamp to keep the original timing,
+		-- loops restart all ranges at the same time, one mean inter-packet gap after the last packet
+		-- the timestamps are passed to the tasks as numbers, the rounding error is the same for all tasks
+		local span = last > first and tonumber(last - first) or 0
+		timeBase = {
+			firstNs = tonumber(first),
+			startTsc = tonumber(lm.getCycles()) + START_DELAY * lm.getCyclesFrequency(),
+			periodNs = span + (packets > 1 and span / (packets - 1) or 0),
+		}
+		for j, reader in ipairs(readers) do
+			if args.from then
+				reader:seekTime(tonumber(first) / 10^9)
+			end
+			for i, range in ipairs(reader:split(args.parallel)) do
+				ranges[i] = ranges[i] or {}
+				ranges[i][j] = range
+			end
+			reader:close()
+		end
+	end
+	for i = 1, args.parallel do
+		lm.startTask("replayTask", dev:getTxQueue(i - 1), args, ranges and ranges[i], timeBase)
+	end
+	lm.waitForTasks()
+end
+
+function replayTask(queue, args, ranges, timeBase)
+	local mempool = memory.createMemPool{n = 8192}
+	local r = replay:new(queue, mempool)
+	for j, file in ipairs(args.files) do
+		r:addFile(file, ranges and ranges[j])
+	end
+	r:speed(args.speed):loops(args.loops)
+	if timeBase then
+		r:timeBase(ffi.cast("uint64_t", timeBase.firstNs), timeBase.startTsc, timeBase.periodNs)
+	end
+	if args.rate then
+		r:fixedRate(args.rate)
+	end
+	r:run()
+	local s = r:getStats()
+	log:info("Replayed %d packets in %d passes, %d packets late by > 1 us, mean lateness %.0f ns",
+		s.packets, s.loops, s.late, s.meanLatenessNs)
+	r:close()
+end
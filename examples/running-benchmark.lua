@@ -0,0 +1,65 @@
+--- Measures the per-iteration overhead of checking libmoon.running() in a loop.
+local lm    = require "libmoon"
+local dpdkc = require "dpdkc"
+local log   = require "log"
+
+function configure(parser)
+	parser:description("Loop overhead benchmark for the run state check, reports cycles per loop iteration.")
+	parser:option("-n --iterations", "Loop iterations per variant."):args(1):convert(tonumber):default(100000000)
+	return parser:parse()
+end
+
+local variants = {
+	{ "empty loop", function(n)
+		local x = 0
+		for i = 1, n do
+			x = x + i
+		end
+		return x
+	end },
+	{ "rdtsc only", function(n)
+		local x = 0
+		for i = 1, n do
+			x = x + (dpdkc.rte_rdtsc() > 0 and 1 or 0)
+		end
+		return x
+	end },
+	{ "running()", function(n)
+		local x = 0
+		for i = 1, n do
+			x = x + (lm.running() and 1 or 0)
+		end
+		return x
+	end },
+	{ "running(100)", function(n)
+		local x = 0
+		for i = 1, n do
+			x = x + (lm.running(100) and 1 or 0)
+		end
+		return x
+	end },
+	{ "is_running(0) C call", function(n)
+		local x = 0
+		for i = 1, n do
+			x = x + dpdkc.is_running(0)
+		end
+		return x
+	end },
+}
+
+function master(args)
+	-- run in a separate task to measure the situation of a typical rx/tx task
+	lm.startTask("benchmark", args.iterations):wait()
+end
+
+function benchmark(n)
+	for _, variant in ipairs(variants) do
+		local name, func = unpack(variant)
+		-- warm up the JIT
+		func(n / 100)
+		local start = lm.getCycles()
+		func(n)
+		local cycles = tonumber(lm.getCycles() - start)
+		log:info("%-22s %.2f cycles/iteration", name, cycles / n)
+	end
+end
@@ -0,0 +1,44 @@
+--- Measures the time to start a task and wait for it, i.e., the cost of creating a Lua state and loading all modules.
+--- The first task fills the bytecode cache, build with -DLIBMOON_BYTECODE_CACHE=0 to compare against uncached startup.
+local lm        = require "libmoon"
+local histogram = require "histogram"
+local log       = require "log"
+
+function configure(parser)
+	parser:description("Task startup benchmark, reports the latency of startTask() followed by wait() in microseconds.")
+	parser:option("-n --iterations", "Number of tasks to start."):args(1):convert(tonumber):default(200)
+	parser:flag("-s --shared", "Start shared tasks, use together with -w to measure persistent workers.")
+	parser:flag("-w --workers", "Enable persistent worker states for shared tasks.")
+	return parser:parse()
+end
+
+function master(args)
+	if args.workers then
+		lm.enableSharedTaskWorkers()
+	end
+	local start = args.shared and lm.startSharedTask or lm.startTask
+	local hist = histogram:new()
+	local first
+	for i = 1, args.iterations do
+		local t = lm.getTime()
+		start("emptyTask", i):wait()
+		local us = (lm.getTime() - t) * 10^6
+		if i == 1 then
+			first = us
+		else
+			hist:update(math.floor(us))
+		end
+	end
+	if args.workers then
+		lm.stopSharedTaskWorkers()
+	end
+	log:info("first task: %.0f us (cold bytecode cache)", first)
+	if args.iterations > 1 then
+		log:info("other tasks: mean %.0f us, p50 %d us, p99 %d us, max %d us",
+			hist:average(), hist:percentile(50), hist:percentile(99), hist:max())
+	end
+end
+
+function emptyTask(i)
+	return i
+end
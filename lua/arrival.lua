@@ -0,0 +1,188 @@
+--- Packet generator driven by stochastic arrival processes.
+--- The generator runs in C and sends packets from a mempool at the departure times given by an
+--- arrival process, the packet contents must be initialized by the mempool's init function.
+local mod = {}
+
+local libmoon = require "libmoon"
+local ffi     = require "ffi"
+local log     = require "log"
+local C       = ffi.C
+
+ffi.cdef[[
+	struct arrival_stats {
+		uint64_t packets;
+		uint64_t bytes;
+		uint64_t alloc_failures;
+		uint64_t late;
+		uint64_t late_cycles;
+		uint64_t first_tsc;
+		uint64_t last_tsc;
+	};
+	struct arrival_gen;
+	struct arrival_gen* arrival_create(uint16_t port, uint16_t queue, struct mempool* pool, int32_t socket);
+	void arrival_free(struct arrival_gen* gen);
+	void arrival_seed(struct arrival_gen* gen, uint64_t seed);
+	int arrival_set_deterministic(struct arrival_gen* gen, double pps);
+	int arrival_set_poisson(struct arrival_gen* gen, double pps);
+	int arrival_set_pareto_onoff(struct arrival_gen* gen, double peak_pps, double on_shape, double on_mean_us, double off_shape, double off_mean_us);
+	int arrival_set_mmpp(struct arrival_gen* gen, uint32_t num_states, const double* pps, const double* dwell_us, const double* transitions);
+	int arrival_set_trace(struct arrival_gen* gen, const double* gaps_ns, uint32_t len, uint8_t loop);
+	int arrival_set_size_uniform(struct arrival_gen* gen, uint16_t min, uint16_t max);
+	int arrival_set_size_weighted(struct arrival_gen* gen, uint32_t num, const uint16_t* sizes, const double* weights);
+	uint64_t arrival_run(struct arrival_gen* gen, uint64_t max_pkts, double max_seconds);
+	struct arrival_stats* arrival_get_stats(struct arrival_gen* gen);
+]]
+
+local generator = {}
+generator.__index = generator
+
+--- Create a new generator.
+--- The generator sends 60 byte packets at 1 Mpp/s by default.
+--- @param queue the tx queue to send on
+--- @param mempool the mempool to allocate packets from, packet contents are not modified except for the length
+function mod:newGenerator(queue, mempool)
+	local gen = C.arrival_create(queue.id, queue.qid, mempool, queue.dev:getSocket())
+	if gen == nil then
+		log:fatal("could not allocate arrival generator")
+	end
+	queue.used = true
+	return setmetatable({
+		gen = ffi.gc(gen, C.arrival_free),
+	}, generator)
+end
+
+--- Seed the random number generator, seeded from the TSC by default.
+function generator:seed(seed)
+	C.arrival_seed(self.gen, seed)
+	return self
+end
+
+--- Send packets with a constant inter-arrival time.
+--- @param mpps rate in Mpp/s
+function generator:deterministic(mpps)
+	if C.arrival_set_deterministic(self.gen, mpps * 10^6) ~= 0 then
+		log:fatal("rate must be > 0")
+	end
+	return self
+end
+
+--- Send packets as a Poisson process, i.e., with exponentially distributed inter-arrival times.
+--- @param mpps average rate in Mpp/s
+function generator:poisson(mpps)
+	if C.arrival_set_poisson(self.gen, mpps * 10^6) ~= 0 then
+		log:fatal("rate must be > 0")
+	end
+	return self
+end
+
+--- Alternate between on and off periods with Pareto distributed durations,
+--- packets are sent at the peak rate during on periods. This models self-similar traffic.
+--- @param args table with the fields
+---   peak: rate during on periods in Mpp/s
+---   onMean, offMean: mean duration of on/off periods in microseconds
+---   onShape, offShape: shape parameters (must be > 1), default: 1.5
+function generator:paretoOnOff(args)
+	if C.arrival_set_pareto_onoff(self.gen, args.peak * 10^6, args.onShape or 1.5, args.onMean, args.offShape or 1.5, args.offMean) ~= 0 then
+		log:fatal("invalid on/off process, rate and on period must be > 0 and shapes > 1")
+	end
+	return self
+end
+
+--- Markov-modulated Poisson process.
+--- @param states array of states, each state is a table with the fields
+---   mpps: rate of the Poisson process in this state
+---   dwell: mean time spent in this state in microseconds
+---   next: optional array with the (relative) probabilities to switch to each state,
+---         default: uniformly to all other states
+function generator:mmpp(states)
+	local n = #states
+	local pps = ffi.new("double[?]", n)
+	local dwell = ffi.new("double[?]", n)
+	local transitions = ffi.new("double[?]", n * n)
+	for i, state in ipairs(states) do
+		pps[i - 1] = state.mpps * 10^6
+		dwell[i - 1] = state.dwell
+		for j = 1, n do
+			local p = state.next and state.next[j] or (i ~= j or n == 1) and 1 or 0
+			transitions[(i - 1) * n + j - 1] = p
+		end
+	end
+	if C.arrival_set_mmpp(self.gen, n, pps, dwell, transitions) ~= 0 then
+		log:fatal("invalid MMPP, up to 8 states with rates >= 0 (at least one > 0) and dwell times > 0 are supported")
+	end
+	return self
+end
+
+--- Replay a trace of inter-arrival times.
+--- @param gaps array of inter-arrival times in nanoseconds
+--- @param loop optional, restart the trace at the end instead of stopping, default: false
+function generator:trace(gaps, loop)
+	local buf = ffi.new("double[?]", #gaps)
+	for i, v in ipairs(gaps) do
+		buf[i - 1] = v
+	end
+	if C.arrival_set_trace(self.gen, buf, #gaps, loop and 1 or 0) ~= 0 then
+		log:fatal("could not load trace")
+	end
+	return self
+end
+
+--- Draw packet sizes uniformly from [min, max], use min == max for a fixed size.
+--- Sizes exclude the CRC and must fit into a single buffer of the mempool.
+function generator:sizeUniform(min, max)
+	if C.arrival_set_size_uniform(self.gen, min, max or min) ~= 0 then
+		log:fatal("packet size %d does not fit into the mempool's buffers", max or min)
+	end
+	return self
+end
+
+--- Draw packet sizes from a weighted list.
+--- @param sizes array of {size, weight} pairs, up to 16 entries
+function generator:sizeWeighted(sizes)
+	local n = #sizes
+	local s = ffi.new("uint16_t[?]", n)
+	local w = ffi.new("double[?]", n)
+	for i, v in ipairs(sizes) do
+		s[i - 1] = v[1]
+		w[i - 1] = v[2]
+	end
+	if C.arrival_set_size_weighted(self.gen, n, s, w) ~= 0 then
+		log:fatal("invalid size distribution, only up to 16 sizes that fit into the mempool's buffers are supported")
+	end
+	return self
+end
+
+--- Simple IMIX size distribution (7:4:1 of 60, 590, 1514 bytes), same as imixSize() in utils.
+function generator:imix()
+	return self:sizeWeighted({ { 60, 7 }, { 590, 4 }, { 1514, 1 } })
+end
+
+--- Run the generator.
+--- Returns once maxPackets were sent, time seconds passed, the trace ended, or libmoon is stopped.
+--- Can be called repeatedly, e.g., to print statistics in between.
+--- @param maxPackets optional, default: unlimited
+--- @param time optional, time in seconds, default: unlimited
+--- @return the number of packets sent
+function generator:run(maxPackets, time)
+	return tonumber(C.arrival_run(self.gen, maxPackets or -1ULL, time or 0))
+end
+
+--- Get statistics about the generated traffic.
+--- @return table with the fields packets, bytes, mpps, allocFailures, late (packets sent more than 1 us after
+---   their departure time), and meanLatenessNs
+function generator:getStats()
+	local stats = C.arrival_get_stats(self.gen)
+	local hz = libmoon.getCyclesFrequency()
+	local packets = tonumber(stats.packets)
+	local time = tonumber(stats.last_tsc - stats.first_tsc) / hz
+	return {
+		packets = packets,
+		bytes = tonumber(stats.bytes),
+		mpps = time > 0 and packets / time / 10^6 or 0,
+		allocFailures = tonumber(stats.alloc_failures),
+		late = tonumber(stats.late),
+		meanLatenessNs = packets > 0 and tonumber(stats.late_cycles) / packets / hz * 10^9 or 0,
+	}
+end
+
+return mod
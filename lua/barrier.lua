@@ -7,7 +7,8 @@ local ffi = require "ffi"
 ffi.cdef [[
     struct barrier { };
     struct barrier* make_barrier(size_t n);
-    void barrier_wait(struct barrier* barrier);
+    struct barrier* make_sync_barrier(size_t n, uint32_t delay_us);
+    uint64_t barrier_wait(struct barrier* barrier);
 	void barrier_reinit(struct barrier* barrier, size_t n);
 ]]
 
@@ -21,8 +22,21 @@ function mod:new(n)
     return C.make_barrier(n)
 end
 
+--- Create a barrier that releases all tasks at the same TSC time.
+--- The last task to arrive publishes a deadline syncDelay microseconds in the future,
+--- all tasks busy-wait until this deadline. Use this to start multiple tx tasks at the same time.
+--- @param n number of tasks
+--- @param syncDelay optional (default = 5) delay in microseconds, must be large enough
+---   for all waiting tasks to observe the deadline before it expires
+function mod:newSynchronized(n, syncDelay)
+    return C.make_sync_barrier(n, syncDelay or 5)
+end
+
+--- Wait until all tasks reached the barrier.
+--- @return the TSC value at which all tasks were released for synchronized barriers,
+---   subtract it from libmoon.getCycles() to measure the start skew
 function barrier:wait()
-    C.barrier_wait(self)
+    return C.barrier_wait(self)
 end
 
 --- Can only be called if no tasks are waiting, i.e., after wait() returned
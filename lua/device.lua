@@ -741,7 +741,7 @@ function txQueue:setRate(rate)
 		local dev = self.dev
 		dev.totalRate = dev.totalRate or 0
 		dev.totalRate = dev.totalRate + rate
-		log:warn("Per-queue rate limit is not supported on this device, setting per-device rate limit to %d Mbit/s instead (note: this may fail as well if the NIC doesn't support any rate limiting).", dev.totalRate)
+		log:warn("Per-queue rate limit is not supported on this device, setting per-device rate limit to %d Mbit/s instead (note: this may fail as well if the NIC doesn't support any rate limiting, use txQueue:setSoftwareRate() in this case).", dev.totalRate)
 		dev:setRate(dev.totalRate)
 	elseif rc ~= 0 then
 		log:warn("Failed to set rate limiter on queue %s: %s", self, strError(rc))
@@ -753,9 +753,102 @@ function txQueue:setRateMpps(rate, pktSize)
 	self:setRate(rate * (pktSize + 4) * 8)
 end
 
+ffi.cdef[[
+struct tx_pacer_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t first_tsc;
+	uint64_t last_tsc;
+	uint64_t error_sum;
+	uint64_t error_max;
+	uint64_t resets;
+};
+
+struct tx_pacer {
+	uint16_t port;
+	uint16_t queue;
+	uint32_t max_batch;
+	double cycles_per_pkt;
+	double cycles_per_byte;
+	uint32_t overhead;
+	uint64_t max_lag;
+	double next_tsc;
+	struct tx_pacer_stats stats;
+};
+
+struct tx_pacer* tx_pacer_create(uint16_t port, uint16_t queue, int32_t socket);
+void tx_pacer_free(struct tx_pacer* pacer);
+void tx_pacer_set_rate_bps(struct tx_pacer* pacer, double bps, uint32_t overhead);
+void tx_pacer_set_rate_pps(struct tx_pacer* pacer, double pps);
+void tx_pacer_set_max_batch(struct tx_pacer* pacer, uint32_t max_batch);
+uint32_t tx_pacer_send(struct tx_pacer* pacer, struct rte_mbuf** pkts, uint32_t num_pkts);
+double tx_pacer_get_rate_pps(struct tx_pacer* pacer);
+double tx_pacer_get_rate_bps(struct tx_pacer* pacer);
+double tx_pacer_get_mean_error_ns(struct tx_pacer* pacer);
+double tx_pacer_get_max_error_ns(struct tx_pacer* pacer);
+]]
+
+-- queues with a pacer created by this task, freed by reclaimTxBuffers() like the staging buffers below
+local txPacerQueues = {}
+
+--- Limit the rate of this queue in software, works on all NICs and virtual devices.
+--- Every packet is assigned a departure time based on the sizes of the previous packets,
+--- send() and sendN() block until the packets are due.
+--- Unlike setRate(), this only affects the task calling it and must be called from the tx task.
+--- @param args table with the following fields
+---   mbit: rate in Mbit/s on the wire, i.e., including preamble, SFD, IFG, and CRC
+---   pps: rate in packets per second, alternative to mbit
+---   overhead: bytes added to each packet for the mbit rate, default: 24 (preamble, SFD, IFG, CRC)
+---   batchSize: maximum number of packets passed to the NIC at once if the pacer is behind schedule, default: 32
+---   pass nil to disable the software rate limiter
+function txQueue:setSoftwareRate(args)
+	if not args then
+		if self.pacer then
+			ffi.C.tx_pacer_free(self.pacer)
+			self.pacer = nil
+			txPacerQueues[self] = nil
+		end
+		return
+	end
+	if not self.pacer then
+		self.pacer = ffi.C.tx_pacer_create(self.id, self.qid, self.dev:getSocket())
+		if self.pacer == nil then
+			log:fatal("could not allocate tx pacer for %s", self)
+		end
+		txPacerQueues[self] = true
+	end
+	if args.pps then
+		ffi.C.tx_pacer_set_rate_pps(self.pacer, args.pps)
+	elseif args.mbit then
+		ffi.C.tx_pacer_set_rate_bps(self.pacer, args.mbit * 10^6, args.overhead or 24)
+	else
+		log:fatal("software rate requires either mbit or pps")
+	end
+	ffi.C.tx_pacer_set_max_batch(self.pacer, args.batchSize or 32)
+end
+
+--- Get the rate achieved by the software rate limiter and its pacing error.
+--- @return table with the fields mpps, mbit (on the wire), meanErrorNs, maxErrorNs, and resets
+---   (number of times the pacer fell more than 1 ms behind and restarted its schedule)
+function txQueue:getSoftwareRateStats()
+	if not self.pacer then
+		return nil
+	end
+	return {
+		mpps = ffi.C.tx_pacer_get_rate_pps(self.pacer) / 10^6,
+		mbit = ffi.C.tx_pacer_get_rate_bps(self.pacer) / 10^6,
+		meanErrorNs = ffi.C.tx_pacer_get_mean_error_ns(self.pacer),
+		maxErrorNs = ffi.C.tx_pacer_get_max_error_ns(self.pacer),
+		resets = tonumber(self.pacer.stats.resets),
+	}
+end
+
 
 function txQueue:send(bufs)
 	self.used = true
+	if self.pacer then
+		return ffi.C.tx_pacer_send(self.pacer, bufs.array, bufs.size)
+	end
 	dpdkc.dpdk_send_all_packets(self.id, self.qid, bufs.array, bufs.size)
 	return bufs.size
 end
@@ -775,6 +868,9 @@ end
 
 function txQueue:sendN(bufs, n)
 	self.used = true
+	if self.pacer then
+		return ffi.C.tx_pacer_send(self.pacer, bufs.array, n)
+	end
 	dpdkc.dpdk_send_all_packets(self.id, self.qid, bufs.array, n)
 	return n
 end
@@ -789,6 +885,117 @@ function txQueue:trySend(bufs, startIndex, numPkts)
 	return dpdkc.rte_eth_tx_burst_export(self.id, self.qid, bufs.array + startIndex, numPkts)
 end
 
+ffi.cdef[[
+struct tx_buffer_stats {
+	uint64_t sent;
+	uint64_t retries;
+	uint64_t dropped;
+	uint64_t flushes;
+	uint64_t timeouts;
+};
+
+struct tx_buffer {
+	uint16_t port;
+	uint16_t queue;
+	uint32_t policy;
+	uint32_t capacity;
+	uint32_t flush_threshold;
+	uint32_t max_retries;
+	uint32_t count;
+	uint64_t timeout_cycles;
+	uint64_t oldest_tsc;
+	struct tx_buffer_stats stats;
+	struct rte_mbuf* pkts[];
+};
+
+struct tx_buffer* tx_buffer_create(uint16_t port, uint16_t queue, uint32_t capacity, uint32_t flush_threshold, uint32_t timeout_us, uint32_t policy, uint32_t max_retries, int32_t socket);
+void tx_buffer_free(struct tx_buffer* buf);
+uint32_t tx_buffer_enqueue(struct tx_buffer* buf, struct rte_mbuf** pkts, uint32_t num_pkts);
+uint32_t tx_buffer_flush(struct tx_buffer* buf);
+uint32_t tx_buffer_poll(struct tx_buffer* buf);
+void tx_buffer_drain(struct tx_buffer* buf);
+]]
+
+-- queues with a staging buffer created by this task, queue objects are task-local copies
+-- so the buffers can not be found through the devices namespace when the task terminates
+local txBufferQueues = {}
+
+local txBufferPolicies = {
+	dropNewest = 0,
+	dropOldest = 1,
+	block = 2,
+}
+
+--- Configure the staging buffer used by sendBuffered().
+--- @param args table with the following optional fields
+---   size: number of packets that can be staged, default: 512
+---   flushSize: staged packets are sent once this many packets are buffered, default: 64
+---   timeout: staged packets are sent once the oldest is older than this (in microseconds), default: 100
+---     note that the timeout is only checked when calling sendBuffered() or flush()
+---   policy: what to do if the buffer is full because the NIC does not accept packets fast enough
+---     "dropNewest" (default), "dropOldest", or "block" (like send())
+---   maxRetries: number of tx bursts tried per flush, default: 4
+function txQueue:enableBuffering(args)
+	args = args or {}
+	local policy = txBufferPolicies[args.policy or "dropNewest"]
+	if not policy then
+		log:fatal("unknown tx buffer policy %s", args.policy)
+	end
+	if self.txBuffer then
+		self:flush(true)
+		ffi.C.tx_buffer_free(self.txBuffer)
+	end
+	self.txBuffer = ffi.C.tx_buffer_create(self.id, self.qid, args.size or 512, args.flushSize or 64, args.timeout or 100, policy, args.maxRetries or 4, self.dev:getSocket())
+	if self.txBuffer == nil then
+		log:fatal("could not allocate tx buffer for %s", self)
+	end
+	txBufferQueues[self] = true
+end
+
+--- Send packets through the staging buffer of this queue.
+--- Unlike send(), this never spins on a full queue unless the policy is "block".
+--- Packets that cannot be sent are dropped (and freed) according to the configured policy.
+--- @param bufs the bufArray to send
+--- @param n optional number of packets to send, default: bufs.size
+--- @return the number of packets accepted, i.e., not dropped
+function txQueue:sendBuffered(bufs, n)
+	self.used = true
+	if not self.txBuffer then
+		self:enableBuffering()
+	end
+	return ffi.C.tx_buffer_enqueue(self.txBuffer, bufs.array, n or bufs.size)
+end
+
+--- Send out staged packets, call this periodically if no packets are sent via sendBuffered().
+--- @param drain if true, block until all staged packets were sent; otherwise only send if the timeout expired
+function txQueue:flush(drain)
+	if not self.txBuffer then
+		return
+	end
+	if drain then
+		ffi.C.tx_buffer_drain(self.txBuffer)
+	else
+		ffi.C.tx_buffer_poll(self.txBuffer)
+	end
+end
+
+--- Get the counters of the staging buffer.
+--- @return table with the fields sent, retries, dropped, flushes, timeouts, and staged
+function txQueue:getBufferStats()
+	if not self.txBuffer then
+		return { sent = 0, retries = 0, dropped = 0, flushes = 0, timeouts = 0, staged = 0 }
+	end
+	local stats = self.txBuffer.stats
+	return {
+		sent = tonumber(stats.sent),
+		retries = tonumber(stats.retries),
+		dropped = tonumber(stats.dropped),
+		flushes = tonumber(stats.flushes),
+		timeouts = tonumber(stats.timeouts),
+		staged = self.txBuffer.count,
+	}
+end
+
 function txQueue:start()
 	assert(dpdkc.rte_eth_dev_tx_queue_start(self.id, self.qid) == 0)
 end
@@ -802,6 +1009,18 @@ end
 function mod.reclaimTxBuffers()
 	local old = LIBMOON_IGNORE_BAD_NUMA_MAPPING
 	LIBMOON_IGNORE_BAD_NUMA_MAPPING = true
+	for queue in pairs(txBufferQueues) do
+		-- the task should have called flush(true), try to send what is left without blocking
+		ffi.C.tx_buffer_flush(queue.txBuffer)
+		ffi.C.tx_buffer_free(queue.txBuffer)
+		queue.txBuffer = nil
+	end
+	txBufferQueues = {}
+	for queue in pairs(txPacerQueues) do
+		ffi.C.tx_pacer_free(queue.pacer)
+		queue.pacer = nil
+	end
+	txPacerQueues = {}
 	devices:forEach(function(_, dev)
 		for _, queue in pairs(dev.txQueues) do
 			if queue.used then
@@ -240,8 +240,21 @@ ffi.cdef[[
 
 	// memory
 	struct mempool* init_mem(uint32_t nb_mbuf, uint32_t sock, uint32_t mbuf_size);
+	void mempool_cache_enable(uint32_t enabled);
+	uint32_t mempool_cache_is_enabled();
+	struct mempool* mempool_cache_get(uint32_t n, int32_t socket, uint32_t mbuf_size);
+	void mempool_cache_retain(struct mempool* pool);
+	void mempool_cache_release(struct mempool* pool);
 	struct rte_mbuf* rte_pktmbuf_alloc_export(struct mempool* mp);
-	void alloc_mbufs(struct mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len);
+	uint32_t alloc_mbufs(struct mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len);
+	uint32_t alloc_mbufs_wait(struct mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len, uint32_t timeout_us, int32_t port, uint16_t queue);
+	uint32_t alloc_mbufs_partial(struct mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len, uint32_t min_burst, uint32_t timeout_us);
+	struct mempool_alloc_stats {
+		uint64_t failures;
+		uint64_t partial;
+		uint64_t timeouts;
+	};
+	struct mempool_alloc_stats* mempool_get_alloc_stats(struct mempool* mp);
 	void rte_pktmbuf_free_export(struct rte_mbuf* m);
 	uint16_t rte_mbuf_refcnt_read_export(struct rte_mbuf* m);
 	uint16_t rte_mbuf_refcnt_update_export(struct rte_mbuf* m, int16_t value);
@@ -298,6 +311,21 @@ ffi.cdef[[
 	void calc_ipv6_pseudo_header_checksum(void* data, int offset);
 	void calc_ipv6_pseudo_header_checksums(struct rte_mbuf** pkts, uint16_t num_pkts, int offset);
 
+	// software checksums
+	uint32_t checksum_partial(const void* data, uint32_t len, uint32_t sum);
+	uint16_t checksum_fold(uint32_t sum);
+	int checksum_packet_ipv4(uint8_t* data, uint32_t l2_len, uint32_t data_len);
+	int checksum_packet_l4(uint8_t* data, uint32_t l2_len, uint32_t data_len);
+	void checksum_burst(struct rte_mbuf** bufs, uint32_t n, uint32_t l2_len, uint32_t flags);
+	uint16_t checksum_update16(uint16_t csum, uint16_t old_val, uint16_t new_val);
+	uint16_t checksum_update32(uint16_t csum, uint32_t old_val, uint32_t new_val);
+	uint16_t checksum_update(uint16_t csum, const void* old_data, const void* new_data, uint32_t len);
+
+	// software packet type parsing
+	uint32_t ptype_parse(struct rte_mbuf* buf);
+	uint32_t ptype_parse_burst(struct rte_mbuf** bufs, uint32_t n);
+	void ptype_prepare_tx_offload(struct rte_mbuf** bufs, uint32_t n);
+
 	// timers
 	void rte_delay_ms_export(uint32_t ms);
 	void rte_delay_us_export(uint32_t us);
@@ -305,6 +333,11 @@ ffi.cdef[[
 	uint64_t rte_get_tsc_hz();
 
 	// lifecycle
+	struct libmoon_run_state {
+		uint64_t deadline;
+		uint64_t tsc_per_ms;
+	};
+	struct libmoon_run_state* get_run_state();
 	uint8_t is_running(uint32_t extra_time);
 	void set_runtime(uint32_t ms);
 
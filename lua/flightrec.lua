@@ -0,0 +1,168 @@
+--- Flight recorder: keeps the most recent traffic in a ring on huge pages and writes it to a pcap/pcapng
+--- file only when an event fires (packet loss, latency spike, API call, ...).
+--- The ring is written by a single capture task, dumps run concurrently in another task.
+--- Packets overwritten while dumping are skipped, size the ring for the dump window.
+local mod = {}
+
+local libmoon = require "libmoon"
+local pcap    = require "pcap"
+local ffi     = require "ffi"
+local log     = require "log"
+local S       = require "syscall"
+local C       = ffi.C
+
+ffi.cdef[[
+	struct flightrec_stats {
+		uint64_t packets;
+		uint64_t bytes;
+		uint64_t evicted;
+		uint64_t expired;
+		uint64_t dumps;
+		uint64_t dumped_packets;
+		uint64_t dump_overruns;
+	};
+	struct flightrec { };
+	struct flightrec* flightrec_create(uint64_t size, uint64_t start_ns, int32_t socket);
+	void flightrec_free(struct flightrec* rec);
+	void flightrec_set_max_age(struct flightrec* rec, uint64_t max_age_ns);
+	void flightrec_write(struct flightrec* rec, const void* data, uint32_t len, uint32_t orig_len, uint64_t ts_ns);
+	void flightrec_write_burst(struct flightrec* rec, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t snap_len, uint64_t ts_ns);
+	void flightrec_trigger(struct flightrec* rec, uint64_t ts_ns, uint64_t before_ns, uint64_t after_ns);
+	uint8_t flightrec_poll_trigger(struct flightrec* rec, uint64_t now_ns, uint64_t* start_ns, uint64_t* end_ns);
+	int64_t flightrec_dump(struct flightrec* rec, const char* filename, uint32_t format, uint64_t start_ns, uint64_t end_ns);
+	struct flightrec_stats* flightrec_get_stats(struct flightrec* rec);
+]]
+
+local recorder = {}
+recorder.__index = recorder
+
+local function toNs(time)
+	return ffi.cast("uint64_t", time * 10^9)
+end
+
+--- Create a new flight recorder, pass it to the capture task and the task calling trigger() as an argument.
+--- Not garbage-collected, call :free() once all tasks are done.
+--- @param size size of the ring in bytes, i.e., how much traffic is retained
+--- @param startTime posix timestamp, all timestamps of inserted packets will be relative to this timestamp
+---        default: relative to libmoon.getTime() == 0
+--- @param socket optional, NUMA socket of the ring, should be the socket of the capturing NIC, default: any
+function mod:new(size, startTime, socket)
+	local rec = C.flightrec_create(size, pcap.startTimeNs(startTime), socket or -1)
+	if rec == nil then
+		log:fatal("could not allocate flight recorder ring of %d bytes", size)
+	end
+	return rec
+end
+
+--- Drop packets older than maxAge seconds (relative to the newest packet) even if the ring is not full.
+--- Useful for low rates where a full ring would retain traffic that is no longer relevant.
+--- Call before passing the recorder to the capture task.
+--- @param maxAge optional, maximum age in seconds, nil or 0 to only overwrite packets if the ring is full
+function recorder:setMaxAge(maxAge)
+	C.flightrec_set_max_age(self, toNs(maxAge or 0))
+end
+
+--- Record a packet.
+--- @param timestamp relative to the timestamp specified when creating the recorder
+function recorder:write(timestamp, data, len, origLen)
+	C.flightrec_write(self, data, len, origLen or len, toNs(timestamp))
+end
+
+--- Record a mbuf.
+--- @param timestamp relative to the timestamp specified when creating the recorder
+--- @param snapLen optional, truncate the packet to this size
+function recorder:writeBuf(timestamp, buf, snapLen)
+	local size = buf:getSize()
+	self:write(timestamp, buf:getData(), math.min(size, snapLen or size), size)
+end
+
+--- Record the first n mbufs of a bufArray.
+--- @param timestamp relative to the timestamp specified when creating the recorder
+--- @param n optional, default: bufs.size
+--- @param snapLen optional, truncate packets to this size
+function recorder:writeBufs(timestamp, bufs, n, snapLen)
+	C.flightrec_write_burst(self, bufs.array, n or bufs.size, snapLen or 0xFFFFFFFF, toNs(timestamp))
+end
+
+--- Request a dump of the traffic around the current time, can be called from any task.
+--- The dump is written by the dump task once the window is complete, triggers firing before the previous
+--- window was written extend it.
+--- @param before seconds before the current time to include
+--- @param after optional, seconds after the current time to include, default: 0
+function recorder:trigger(before, after)
+	C.flightrec_trigger(self, toNs(libmoon.getTime()), toNs(before), toNs(after or 0))
+end
+
+--- Write retained packets to a file, runs concurrently with capturing.
+--- Files ending in .pcapng are written as pcapng with nanosecond timestamps.
+--- @param from optional, relative timestamp of the first packet to include, default: oldest packet
+--- @param to optional, relative timestamp of the last packet to include, default: newest packet
+--- @return the number of packets written
+function recorder:dump(filename, from, to)
+	local n = C.flightrec_dump(self, filename, filename:match("%.pcapng$") and 1 or 0, toNs(from or 0), to and toNs(to) or -1ULL)
+	if n < 0 then
+		log:error("could not write flight recorder dump %s: %s", filename, strError(S.errno()))
+		return 0
+	end
+	return tonumber(n)
+end
+
+--- Get statistics.
+--- @return table with the fields packets, bytes, evicted (overwritten packets), expired (packets older than
+---   the maximum age), dumps, dumpedPackets,
+---   and dumpOverruns (packets overwritten while dumping)
+function recorder:getStats()
+	local stats = C.flightrec_get_stats(self)
+	return {
+		packets = tonumber(stats.packets),
+		bytes = tonumber(stats.bytes),
+		evicted = tonumber(stats.evicted),
+		expired = tonumber(stats.expired),
+		dumps = tonumber(stats.dumps),
+		dumpedPackets = tonumber(stats.dumped_packets),
+		dumpOverruns = tonumber(stats.dump_overruns),
+	}
+end
+
+function recorder:free()
+	C.flightrec_free(self)
+end
+
+ffi.metatype("struct flightrec", recorder)
+
+-- file name of the nth dump, %d in the pattern is replaced, otherwise the number is appended before the extension
+local function dumpFilename(pattern, n)
+	if pattern:match("%%d") then
+		return pattern:format(n)
+	end
+	local name, ext = pattern:match("^(.*)(%.pcap[ng]*)$")
+	return (name or pattern) .. "-" .. n .. (ext or ".pcap")
+end
+
+function __LIBMOON_FLIGHTREC_TASK(rec, pattern)
+	local start = ffi.new("uint64_t[1]")
+	local stop = ffi.new("uint64_t[1]")
+	local n = 0
+	while libmoon.running() do
+		if C.flightrec_poll_trigger(rec, toNs(libmoon.getTime()), start, stop) == 1 then
+			n = n + 1
+			local filename = dumpFilename(pattern, n)
+			local pkts = C.flightrec_dump(rec, filename, filename:match("%.pcapng$") and 1 or 0, start[0], stop[0])
+			if pkts < 0 then
+				log:error("could not write flight recorder dump %s: %s", filename, strError(S.errno()))
+			else
+				log:info("Flight recorder: wrote %d packets to %s", tonumber(pkts), filename)
+			end
+		end
+		libmoon.sleepMillisIdle(1)
+	end
+end
+
+--- Start a shared task that writes triggered windows to files.
+--- @param pattern file name, %d is replaced with the number of the dump, e.g., "incident-%d.pcapng"
+---        without %d, the number is appended before the extension
+function recorder:startDumpTask(pattern)
+	return libmoon.startSharedTask("__LIBMOON_FLIGHTREC_TASK", self, pattern)
+end
+
+return mod
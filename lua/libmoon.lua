@@ -67,6 +67,20 @@ ffi.cdef[[
 	uint64_t task_generate_id();
 	void task_store_result(uint64_t task_id, char* result);
 	char* task_get_result(uint64_t task_id);
+	struct task_result {
+		uint32_t done;
+		uint32_t len;
+		size_t capacity;
+		char* buf;
+	};
+	struct task_result* task_wait_result(uint64_t task_id, uint32_t timeout_ms);
+	void task_release_result(uint64_t task_id);
+	void task_abandon_result(uint64_t task_id);
+	void launch_lua_worker(int core);
+	uint8_t worker_submit(int core, const char* arg);
+	void worker_stop(int core);
+	uint8_t worker_is_busy(int core);
+	void worker_wait_idle(int core);
 ]]
 
 
@@ -75,12 +89,19 @@ task.__index = task
 
 local tasks = {}
 
+local function releaseResult(ref)
+	ffi.C.task_release_result(ref[0])
+end
+
 function task:new(core)
 	checkCore()
+	local id = ffi.C.task_generate_id()
 	local obj = setmetatable({
 		-- double instead of uint64_t is easier here and okay (unless you want to start more than 2^53 tasks)
-		id = tonumber(ffi.C.task_generate_id()),
-		core = core
+		id = tonumber(id),
+		core = core,
+		-- releases the result slot if the task object is collected without waiting for the task
+		resultRef = ffi.gc(ffi.new("uint64_t[1]", id), releaseResult),
 	}, task)
 	tasks[core] = obj
 	return obj
@@ -90,18 +111,31 @@ end
 function task:wait()
 	checkCore()
 	while true do
-		if dpdkc.rte_eal_get_lcore_state(self.core) ~= dpdkc.RUNNING then
-			-- task is finished
-			local result = ffi.C.task_get_result(self.id)
+		-- blocks until the task stores its result, the timeout is only relevant if the task crashed
+		local result = ffi.C.task_wait_result(self.id, 10)
+		if result == nil and dpdkc.rte_eal_get_lcore_state(self.core) ~= dpdkc.RUNNING then
+			-- task is finished, but it might have stored its result after we stopped waiting
+			result = ffi.C.task_wait_result(self.id, 0)
 			if result == nil then
 				-- thread crashed :(
+				ffi.gc(self.resultRef, nil)
+				ffi.C.task_abandon_result(self.id)
+				ffi.C.task_release_result(self.id)
 				return
 			end
-			local resultString = ffi.string(result)
-			ffi.C.free(result)
+		end
+		if result ~= nil then
+			local resultString = ffi.string(result.buf, result.len)
+			ffi.gc(self.resultRef, nil)
+			ffi.C.task_release_result(self.id)
+			-- the task might still be cleaning up, make sure the core can be reused once we return
+			if self.worker then
+				ffi.C.worker_wait_idle(self.core)
+			else
+				dpdkc.rte_eal_wait_lcore(self.core)
+			end
 			return unpackAll(loadstring(resultString)())
 		end
-		mod.sleepMillisIdle(1)
 	end
 end
 
@@ -112,6 +146,9 @@ function task:isRunning()
 		return false
 	end
 	-- this task is still on this core, but is it still running?
+	if self.worker then
+		return ffi.C.worker_is_busy(self.core) == 1
+	end
 	return dpdkc.rte_eal_get_lcore_state(self.core) == dpdkc.RUNNING
 end
 
@@ -177,13 +214,69 @@ function mod.startTask(...)
 	return mod.startTaskOnCore(core, ...)
 end
 
+-- shared cores running a persistent worker
+local workers = {}
+local useWorkers = false
+
+--- Run shared tasks in persistent workers.
+--- Each shared core keeps its Lua state with the userscript and all modules loaded between tasks,
+--- this makes starting short-lived tasks a lot faster.
+--- Global variables are reset between tasks, but state stored in modules (upvalues, module tables) is not.
+function mod.enableSharedTaskWorkers()
+	checkCore()
+	useWorkers = true
+end
+
+--- Stop all persistent workers once they finished their current task.
+--- Shared tasks started afterwards use a new Lua state again.
+function mod.stopSharedTaskWorkers()
+	checkCore()
+	useWorkers = false
+	for core in pairs(workers) do
+		ffi.C.worker_stop(core)
+	end
+	workers = {}
+end
+
+local function startTaskOnWorker(core, ...)
+	local task = task:new(core)
+	task.worker = true
+	-- released by the task once it finishes, see memory.enableCache()
+	require("memory").retainPools(...)
+	if ffi.C.worker_submit(core, serpent.dump({ task.id, ... })) ~= 1 then
+		log:fatal("requested worker is busy")
+	end
+	return task
+end
+
 function mod.startSharedTask(...)
 	checkCore()
+	-- see scheduler.collectControlTasks()
+	if mod.controlTaskQueue then
+		table.insert(mod.controlTaskQueue, { n = select("#", ...), ... })
+		return
+	end
 	local maxCore = mod.config.cores[#mod.config.cores]
 	for core = maxCore + 1, maxCore + mod.config.numSharedCores do
 		local status = dpdkc.rte_eal_get_lcore_state(core)
-		if status == dpdkc.FINISHED or status == dpdkc.WAIT then
-			return mod.startTaskOnCore(core, ...)
+		if workers[core] and status ~= dpdkc.RUNNING then
+			-- worker crashed
+			workers[core] = nil
+		end
+		if workers[core] then
+			if ffi.C.worker_is_busy(core) == 0 then
+				return startTaskOnWorker(core, ...)
+			end
+		elseif status == dpdkc.FINISHED or status == dpdkc.WAIT then
+			if not useWorkers then
+				return mod.startTaskOnCore(core, ...)
+			end
+			if status == dpdkc.FINISHED then
+				dpdkc.rte_eal_wait_lcore(core)
+			end
+			ffi.C.launch_lua_worker(core)
+			workers[core] = true
+			return startTaskOnWorker(core, ...)
 		end
 	end
 	log:fatal("Not enough shared task IDs available to start this task, this limit can be increased in dpdk-conf.lua")
@@ -202,6 +295,8 @@ function mod.startTaskOnCore(core, ...)
 		log:fatal("requested core is already in use")
 	end
 	local task = task:new(core)
+	-- released by the task once it finishes, see memory.enableCache()
+	require("memory").retainPools(...)
 	local args = serpent.dump({ task.id, ... })
 	local buf = ffi.new("char[?]", #args + 1)
 	ffi.copy(buf, args)
@@ -226,7 +321,9 @@ function mod.waitForTasks()
 		end
 		local maxCore = mod.config.cores[#mod.config.cores]
 		for core = maxCore + 1, maxCore + mod.config.numSharedCores do
-			if dpdkc.rte_eal_get_lcore_state(core) == dpdkc.RUNNING then
+			-- idle workers keep running
+			if dpdkc.rte_eal_get_lcore_state(core) == dpdkc.RUNNING
+			and (not workers[core] or ffi.C.worker_is_busy(core) == 1) then
 				allCoresFinished = false
 				break
 			end
@@ -263,10 +360,25 @@ function mod.setRuntime(time)
 	dpdkc.set_runtime(time * 1000)
 end
 
+local runState
+
 --- Returns false once the app receives SIGTERM or SIGINT, the time set via setRuntime expires, or when a thread calls libmoon.stop().
 -- @param extraTime additional time in milliseconds before false will be returned (e.g. to keep an rx task running longer than a tx task in a loopback test)
 function mod.running(extraTime)
-	return dpdkc.is_running(extraTime or 0) == 1 -- luajit-2.0.3 does not like bool return types (TRACE NYI: unsupported C function type)
+	if not runState then
+		local state = dpdkc.get_run_state()
+		-- the TSC frequency is unknown before DPDK was initialized
+		if state.tsc_per_ms == 0 then
+			return dpdkc.is_running(extraTime or 0) == 1 -- luajit-2.0.3 does not like bool return types (TRACE NYI: unsupported C function type)
+		end
+		runState = state
+	end
+	-- plain loads of the aligned deadline are atomic on x86, the C call to rdtsc keeps the JIT from hoisting the load out of loops
+	local deadline = runState.deadline
+	if extraTime then
+		deadline = deadline + extraTime * runState.tsc_per_ms
+	end
+	return dpdkc.rte_rdtsc() < deadline
 end
 
 --- request all tasks to exit
@@ -288,12 +400,22 @@ function mod.sleepMicros(t)
 end
 
 --- Sleep by t milliseconds by calling usleep().
+--- Yields to the scheduler instead when called from a task running in a scheduler.
 function mod.sleepMillisIdle(t)
+	local sched = mod.activeScheduler
+	if sched and sched:owns() then
+		return sched:sleep(t / 1000)
+	end
 	ffi.C.usleep(t * 1000)
 end
 
 --- Sleep by t microseconds by calling usleep().
+--- Yields to the scheduler instead when called from a task running in a scheduler.
 function mod.sleepMicrosIdle(t)
+	local sched = mod.activeScheduler
+	if sched and sched:owns() then
+		return sched:sleep(t / 1000000)
+	end
 	ffi.C.usleep(t)
 end
 
@@ -9,10 +9,13 @@ ffi.cdef [[
 	struct lock { };
 
 	struct lock* make_lock();
+	struct lock* make_lock_kind(uint32_t kind);
 	void lock_lock(struct lock* lock);
 	void lock_unlock(struct lock* lock);
 	uint32_t lock_try_lock(struct lock* lock);
 	uint32_t lock_try_lock_for(struct lock* lock, uint32_t us);
+	void lock_lock_shared(struct lock* lock);
+	void lock_unlock_shared(struct lock* lock);
 ]]
 
 local C = ffi.C
@@ -20,8 +23,34 @@ local C = ffi.C
 local lock = {}
 lock.__index = lock
 
-function mod:new()
-	return C.make_lock()
+-- keep in sync with lock.hpp
+local kinds = {
+	mutex = 0,
+	ticket = 1,
+	mcs = 2,
+	rw = 3,
+}
+
+--- Create a new lock.
+--- @param kind optional (default = "mutex") one of
+---   "mutex": recursive mutex, waiting tasks sleep in the kernel
+---   "ticket": fair spin lock, cheapest fast path
+---   "mcs": fair queue spin lock, scales better than "ticket" under high contention
+---   "rw": reader-writer spin lock, see lock:readLock()
+---   All spin locks burn CPU time while waiting and are not recursive.
+function mod:new(kind)
+	if not kind or kind == "mutex" then
+		return C.make_lock()
+	end
+	local id = kinds[kind]
+	if not id then
+		log:fatal("unknown lock kind %s", tostring(kind))
+	end
+	local lock = C.make_lock_kind(id)
+	if lock == nil then
+		log:fatal("failed to allocate lock")
+	end
+	return lock
 end
 
 --- Acquire the lock
@@ -34,6 +63,17 @@ function lock:unlock()
 	C.lock_unlock(self)
 end
 
+--- Acquire the lock in shared mode, multiple readers can hold a "rw" lock at the same time.
+--- Equivalent to lock() for all other lock kinds.
+function lock:readLock()
+	C.lock_lock_shared(self)
+end
+
+--- Release a lock acquired with readLock()
+function lock:readUnlock()
+	C.lock_unlock_shared(self)
+end
+
 --- Try to acquire the lock, blocking for max <timeout> microseconds.
 --- This function does not block if timeout is <= 0.
 --- This function may fail spuriously, i.e. return early or fail to acquire the lock.
@@ -103,18 +103,7 @@ local function master(_, file, ...)
 	-- it is up to the user program to wait for slaves to finish, e.g. by calling dpdk.waitForSlaves()
 end
 
-local function slave(args)
-	libmoon.setupPaths()
-	-- must be done before parsing the args as they might rely on deserializers loaded by the script
-	local ok = run(libmoon.config.userscript)
-	if not ok then
-		return
-	end
-	-- core > max core means this is a shared task
-	if libmoon.getCore() > libmoon.config.cores[#libmoon.config.cores] then
-		-- disabling this warning must be done before deserializing the arguments
-		libmoon.disableBadSocketWarning()
-	end
+local function runTask(args)
 	args = loadstring(args)()
 	local taskId = args[1]
 	local func = args[2]
@@ -133,19 +122,78 @@ local function slave(args)
 	if libmoon.running() then
 		local ok, err = pcall(device.reclaimTxBuffers)
 		if ok then
+			memory.releasePools(select(3, unpackAll(args)))
 			memory.freeMemPools()
 		else
 			log:warn("Could not reclaim tx memory: %s", err)
 		end
+		memory.flushNumaCache()
 	end
 	--require("jit.p").stop()
 end
 
+local function slave(args)
+	libmoon.setupPaths()
+	-- must be done before parsing the args as they might rely on deserializers loaded by the script
+	local ok = run(libmoon.config.userscript)
+	if not ok then
+		return
+	end
+	-- core > max core means this is a shared task
+	if libmoon.getCore() > libmoon.config.cores[#libmoon.config.cores] then
+		-- disabling this warning must be done before deserializing the arguments
+		libmoon.disableBadSocketWarning()
+	end
+	runTask(args)
+end
+
+ffi.cdef[[
+	const char* worker_next_job(int core);
+	void worker_job_done(int core);
+]]
+
+-- persistent worker on a shared core: the userscript and all modules are only loaded once
+-- globals are reset to the state after loading the userscript between two tasks
+local function worker()
+	libmoon.setupPaths()
+	local ok = run(libmoon.config.userscript)
+	if not ok then
+		return
+	end
+	libmoon.disableBadSocketWarning()
+	local core = libmoon.getCore()
+	local globals = {}
+	for k, v in pairs(_G) do
+		globals[k] = v
+	end
+	while true do
+		local job = ffi.C.worker_next_job(core)
+		if job == nil then
+			break
+		end
+		runTask(ffi.string(job))
+		for k in pairs(_G) do
+			if globals[k] == nil then
+				_G[k] = nil
+			end
+		end
+		for k, v in pairs(globals) do
+			_G[k] = v
+		end
+		-- tasks might have stopped the GC
+		collectgarbage("restart")
+		collectgarbage("collect")
+		ffi.C.worker_job_done(core)
+	end
+end
+
 function main(task, ...)
 	if task == "master" then
 		master(...)
 	elseif task == "slave" then
 		slave(...)
+	elseif task == "worker" then
+		worker(...)
 	else
 		log:fatal("invalid task type %s", task)
 	end
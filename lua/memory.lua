@@ -5,7 +5,6 @@ local libmoon  = require "libmoon"
 local ffi     = require "ffi"
 local dpdkc   = require "dpdkc"
 local dpdk    = require "dpdk"
-local ns      = require "namespaces"
 local serpent = require "Serpent"
 local log     = require "log"
 local libmoon  = require "libmoon"
@@ -96,6 +95,78 @@ function mod.freeHuge(ptr, size)
 	end
 end
 
+ffi.cdef[[
+	struct arena_stats {
+		uint64_t huge_bytes;
+		uint64_t fallback_bytes;
+		uint64_t slabs;
+		uint64_t large_allocs;
+	};
+	void* arena_alloc(size_t size, int32_t socket);
+	void arena_free(void* ptr);
+	size_t arena_usable_size(void* ptr);
+	int32_t arena_get_socket(void* ptr);
+	void arena_flush_thread_cache();
+	struct arena_stats* arena_get_stats(int32_t socket);
+]]
+
+-- keep in sync with arena.h
+local ARENA_MAX_SOCKETS = 8
+
+--- Off-heap allocation on the huge pages of a NUMA node, not garbage-collected.
+--- Small objects (up to 8 KiB) are served from per-thread caches, so this is cheap enough for per-flow state.
+--- Falls back to the system allocator if the DPDK hugepages of the socket are exhausted.
+--- Use this for tables and rings that are built by one task but mostly used by a task on another core.
+--- @param ctype a ffi type, must be a pointer or array type
+--- @param size the amount of memory to allocate
+--- @param socket optional, NUMA node of the core that will use the memory, default: socket of the calling task
+function mod.allocNuma(ctype, size, socket)
+	if socket and socket >= ARENA_MAX_SOCKETS then
+		log:fatal("invalid socket %d, the NUMA allocator supports up to %d sockets", socket, ARENA_MAX_SOCKETS)
+	end
+	local mem = C.arena_alloc(size, socket or -1)
+	if mem == nil then
+		log:fatal("failed to allocate %d bytes on socket %d", size, socket or -1)
+	end
+	return cast(ctype, mem)
+end
+
+--- Free memory allocated with memory.allocNuma, can be called from any task.
+function mod.freeNuma(ptr)
+	C.arena_free(ptr)
+end
+
+--- Allocate a zero-initialized object of the given struct type on a NUMA node, garbage-collected.
+--- The object is freed by the garbage collector of the calling task, use allocNuma for objects shared with other tasks.
+--- @param ctype name of a struct type, e.g. "struct flow_table"
+--- @param socket optional, see memory.allocNuma
+function mod.newNuma(ctype, socket)
+	local size = ffi.sizeof(ctype)
+	local obj = mod.allocNuma(ctype .. "*", size, socket)
+	ffi.fill(obj, size)
+	return ffi.gc(obj, C.arena_free)
+end
+
+--- Get statistics of the NUMA allocator for a socket.
+--- @return table with the fields hugeBytes, fallbackBytes (memory not on hugepages), slabs, and largeAllocs
+function mod.getNumaStats(socket)
+	local stats = C.arena_get_stats(socket or -1)
+	if stats == nil then
+		log:fatal("invalid socket %d, the NUMA allocator supports up to %d sockets", socket, ARENA_MAX_SOCKETS)
+	end
+	return {
+		hugeBytes = tonumber(stats.huge_bytes),
+		fallbackBytes = tonumber(stats.fallback_bytes),
+		slabs = tonumber(stats.slabs),
+		largeAllocs = tonumber(stats.large_allocs),
+	}
+end
+
+--- Return objects cached by this thread to the NUMA allocator, called automatically when a task ends.
+function mod.flushNumaCache()
+	C.arena_flush_thread_cache()
+end
+
 ffi.cdef[[
 	void fence();
 ]]
@@ -104,60 +175,24 @@ function mod.fence()
 	ffi.C.fence()
 end
 
+-- pools owned by this task, released once the task terminates
 local mempools = {}
-local mempoolCache = ns:get()
-
-local cacheEnabled = false
 
 --- Enable mempool recycling.
 --- Calling this function enables the mempool cache. This prevents memory leaks
 --- as DPDK cannot delete mempools.
---- Mempools with the same parameters created on the same core will be recycled.
---- This is not yet enabled by default because I'm not 100% confident that it works
---- properly in all cases.
---- For example, mempools passed to other tasks will probably break stuff.
+--- Mempools with the same size, buffer size, and socket are recycled once all tasks using them
+--- terminated and all their buffers were returned, the buffers are cleared before reuse.
+--- The setting applies to all tasks.
+--- Pools passed to other tasks as task arguments are tracked automatically, call :retain() and :release()
+--- for pools passed in other ways, e.g., through a pipe or a namespace.
 function mod.enableCache()
-	log:warn("mempool cache is currently broken, this will probably crash")
-	cacheEnabled = true
-end
-
-local function getPoolFromCache(socket, n, bufSize)
-	if not cacheEnabled then
-		return
-	end
-	local pool
-	mempoolCache.lock(function()
-		-- TODO: pass an iterator context to the callback
-		-- the context could then run functions like abort() or removeCurrent()
-		local result
-		mempoolCache:forEach(function(key, pool)
-			if result then
-				return
-			end
-			if pool.socket == socket
-			and	pool.n == n
-			and pool.bufSize == bufSize
-			and pool.core == libmoon.getCore() then
-				result = key
-			end
-		end)
-		if result then
-			pool = mempoolCache[result].pool
-			mempoolCache[result] = nil
-		end
-	end)
-	if pool then
-		local bufs = {}
-		for i = 1, n do
-			local buf = pool:alloc(bufSize)
-			ffi.fill(buf.buf_addr, buf.buf_len, 0)
-			bufs[#bufs + 1] = buf
-		end
-		for _, v in ipairs(bufs) do
-			dpdkc.rte_pktmbuf_free_export(v)
-		end
-	end
-	return pool
+	dpdkc.mempool_cache_enable(1)
+end
+
+--- Disable mempool recycling, pools already in the cache stay there.
+function mod.disableCache()
+	dpdkc.mempool_cache_enable(0)
 end
 
 --- Create a new memory pool.
@@ -192,9 +227,13 @@ function mod.createMemPool(...)
 	args.n = args.n or 2047
 	args.socket = args.socket or select(2, libmoon.getCore())
 	args.bufSize = args.bufSize or 2048
-	-- TODO: get cached mempool from the mempool pool if possible and use that instead
-	-- FIXME: the todo seems to be already implemented here.
-	local mem = getPoolFromCache(args.socket, args.n, args.bufSize) or dpdkc.init_mem(args.n, args.socket, args.bufSize)
+	local mem
+	if dpdkc.mempool_cache_is_enabled() ~= 0 then
+		mem = dpdkc.mempool_cache_get(args.n, args.socket, args.bufSize)
+	end
+	if mem == nil then
+		mem = dpdkc.init_mem(args.n, args.socket, args.bufSize)
+	end
 	if args.func then
 		local bufs = {}
 		for i = 1, args.n do
@@ -207,40 +246,73 @@ function mod.createMemPool(...)
 			dpdkc.rte_pktmbuf_free_export(v)
 		end
 	end
-	mempools[#mempools + 1] = {
-		pool = mem,
-		socket = args.socket,
-		n = args.n,
-		bufSize = args.bufSize,
-		core = libmoon.getCore()
-	}
+	mempools[#mempools + 1] = mem
 	return mem
 end
 
 --- Free all memory pools owned by this task.
 --- All queues using these pools must be stopped before calling this.
 function mod.freeMemPools()
-	if not cacheEnabled then
-		return
-	end
 	for _, mem in ipairs(mempools) do
-		mempoolCache[tostring(mem.pool)] = mem
+		dpdkc.mempool_cache_release(mem)
 	end
 	mempools = {}
 end
 
+local function forEachPool(f, ...)
+	for i = 1, select("#", ...) do
+		local arg = select(i, ...)
+		if ffi.istype("struct mempool*", arg) then
+			f(arg)
+		elseif type(arg) == "table" and getmetatable(arg) == nil then
+			-- plain tables, e.g., a list of pools
+			for _, v in pairs(arg) do
+				if ffi.istype("struct mempool*", v) then
+					f(v)
+				end
+			end
+		end
+	end
+end
+
+--- Add an owner to all mempools in the arguments, called when starting a task.
+function mod.retainPools(...)
+	forEachPool(dpdkc.mempool_cache_retain, ...)
+end
+
+--- Remove an owner from all mempools in the arguments, called when a task terminates.
+function mod.releasePools(...)
+	forEachPool(dpdkc.mempool_cache_release, ...)
+end
+
 local mempool = {}
 mempool.__index = mempool
 
 --- Retain a memory pool.
---- This will prevent the pool from being returned to a pool of pools once the task ends.
+--- This will prevent the pool from being recycled until :release() is called, e.g., by the task using it.
 function mempool:retain()
-	for i, v in ipairs(mempools) do
-		if v.pool == self then
-			table.remove(mempools, i)
-			return
-		end
+	dpdkc.mempool_cache_retain(self)
+end
+
+--- Release a memory pool retained with :retain().
+--- The pool is recycled once all owners released it, it must not be used afterwards.
+function mempool:release()
+	dpdkc.mempool_cache_release(self)
+end
+
+--- Get the allocation failure counters of this pool.
+--- @return table with the fields failures (bulk allocations that could not be served at the first try),
+---   partial (allocations that returned fewer buffers), and timeouts (allocations that returned no buffers)
+function mempool:getAllocStats()
+	local stats = dpdkc.mempool_get_alloc_stats(self)
+	if stats == nil then
+		return { failures = 0, partial = 0, timeouts = 0 }
 	end
+	return {
+		failures = tonumber(stats.failures),
+		partial = tonumber(stats.partial),
+		timeouts = tonumber(stats.timeouts),
+	}
 end
 
 function mempool:alloc(l)
@@ -297,6 +369,7 @@ function bufArray:resize(size)
 		-- TODO: consider reallocing the struct here
 		log:fatal("enlarging a bufArray is currently not supported")
 	end
+	self.emptySize = nil
 	self.size = size
 end
 
@@ -377,6 +450,40 @@ function bufArray:offloadTcpChecksums(ipv4, l2Len, l3Len, n)
 	end
 end
 
+--- Parse the headers of all packets in software and set packet_type, l2_len, l3_len, and l4_len.
+--- Understands Ethernet, VLAN, QinQ, IPv4 with options, IPv6 with extension headers, UDP, TCP, and VXLAN.
+--- @param n optional (default = bufArray.size) number of packets
+--- @return the number of packets with an IPv4 or IPv6 header
+function bufArray:parsePacketTypes(n)
+	return dpdkc.ptype_parse_burst(self.array, n or self.size)
+end
+
+--- Enable IP, TCP, and UDP checksum offloading based on the actual headers of each packet.
+--- Unlike offloadUdpChecksums() and offloadTcpChecksums() this handles VLAN tags, IP options,
+--- IPv6 extension headers, mixed protocols, and VXLAN (inner checksums and outer IPv4 checksum).
+--- @param n optional (default = bufArray.size) number of packets
+function bufArray:offloadChecksums(n)
+	n = n or self.size
+	dpdkc.ptype_parse_burst(self.array, n)
+	dpdkc.ptype_prepare_tx_offload(self.array, n)
+end
+
+--- Calculate IPv4 header checksums in software, e.g., for NICs or virtual devices without checksum offloading.
+--- Packets that are not IPv4 are skipped.
+--- @param l2Len optional (default = 14), 0 to use the l2_len field of each buffer, see parsePacketTypes()
+--- @param n optional (default = bufArray.size) number of packets
+function bufArray:calculateIPChecksums(l2Len, n)
+	dpdkc.checksum_burst(self.array, n or self.size, l2Len or 14, 1)
+end
+
+--- Calculate UDP, TCP, and ICMP checksums (and IPv4 header checksums) in software.
+--- The IP version and L4 protocol are taken from the packets, packets with IPv6 extension headers are skipped.
+--- @param l2Len optional (default = 14), 0 to use the l2_len field of each buffer
+--- @param n optional (default = bufArray.size) number of packets
+function bufArray:calculateChecksums(l2Len, n)
+	dpdkc.checksum_burst(self.array, n or self.size, l2Len or 14, 3)
+end
+
 --- Offloads VLAN tags on all packets.
 -- Equivalent to calling pkt:setVlan(vlan, pcp, cfi) on all packets.
 function bufArray:setVlans(vlan, pcp, cfi)
@@ -389,18 +496,110 @@ end
 
 --- Allocates buffers from the memory pool and fills the array
 --- Allocates as many buffers as this array is large
+--- Does not wait by default if the pool is exhausted, the array is empty then (send() only polls the queue)
+--- and the next call tries to fill it completely again.
 --- @param size	Size of every buffer
-function bufArray:alloc(size)
-	dpdkc.alloc_mbufs(self.mem, self.array, self.size, size)
+--- @param timeout optional, time in microseconds to wait for buffers if the pool is exhausted
+--- @param txQueue optional, a tx queue owned by the calling task, sent buffers are reclaimed from it while waiting
+--- @return true if the array was filled, false if the pool is exhausted
+function bufArray:alloc(size, timeout, txQueue)
+	if self.emptySize then
+		self.size = self.emptySize
+		self.emptySize = nil
+	end
+	local n
+	if timeout then
+		n = dpdkc.alloc_mbufs_wait(self.mem, self.array, self.size, size, timeout, txQueue and txQueue.id or -1, txQueue and txQueue.qid or 0)
+	else
+		n = dpdkc.alloc_mbufs(self.mem, self.array, self.size, size)
+	end
+	if n ~= self.size then
+		-- do not leave stale pointers behind, send() on an empty array only polls the queue
+		self.emptySize = self.size
+		self.size = 0
+		return false
+	end
+	return true
 end
 
 --- Allocates buffers from the memory pool and fills the array.
 --- Allocates only a maximum of num buffers by resizing the size of the bufArray.
 --- @param size	Size of every buffer
 --- @param num	Number of buffers to allocate.
+--- @return true if the array was filled, false if the pool is exhausted
 function bufArray:allocN(size, num)
 	self:resize(num)
-	dpdkc.alloc_mbufs(self.mem, self.array, self.size, size)
+	return self:alloc(size)
+end
+
+--- Allocates as many buffers as possible up to the maximum size of the array without waiting for a full burst.
+--- Falls back to smaller bursts if the pool runs low and resizes the array to the number of buffers obtained.
+--- @param size	Size of every buffer
+--- @param minBurst optional (default = 1), smallest burst to try
+--- @param timeout optional (default = 0), time in microseconds to wait if no buffers are available
+--- @return the number of buffers allocated
+function bufArray:allocPartial(size, minBurst, timeout)
+	local n = dpdkc.alloc_mbufs_partial(self.mem, self.array, self.maxSize, size, minBurst or 1, timeout or 0)
+	self.size = n
+	return n
+end
+
+ffi.cdef[[
+	struct pkt_templates { };
+	struct pkt_templates* pkt_templates_create(int32_t socket);
+	void pkt_templates_free(struct pkt_templates* tpls);
+	int pkt_templates_add(struct pkt_templates* tpls, const void* data, uint16_t len, uint32_t weight);
+	void pkt_templates_set_mode(struct pkt_templates* tpls, uint32_t mode);
+	uint32_t pkt_templates_alloc(struct pkt_templates* tpls, struct mempool* mp, struct rte_mbuf** bufs, uint32_t n, uint8_t* indices);
+]]
+
+local templates = {}
+templates.__index = templates
+
+--- Create a set of packet templates.
+--- Buffers allocated via bufArray:allocFromTemplates() are filled with a copy of one of the templates,
+--- this decouples the packet contents from the mempool initialization.
+--- @param mode optional, "roundRobin" (default) or "weighted", how a template is selected for each packet
+function mod.createTemplates(mode)
+	local tpls = C.pkt_templates_create(select(2, libmoon.getCore()))
+	if tpls == nil then
+		log:fatal("could not allocate packet templates")
+	end
+	C.pkt_templates_set_mode(tpls, mode == "weighted" and 1 or 0)
+	return setmetatable({
+		tpls = ffi.gc(tpls, C.pkt_templates_free),
+		-- scratch packet passed to the init functions
+		scratch = ffi.new("struct rte_mbuf"),
+	}, templates)
+end
+
+--- Add a template, up to 64 templates are supported.
+--- @param size packet size
+--- @param func called with a packet of the given size to initialize the template,
+---   works like the init function of createMemPool()
+--- @param weight optional (default = 1), relative probability of this template in weighted mode
+--- @return the index of the template (0-based)
+function templates:add(size, func, weight)
+	local data = ffi.new("uint8_t[?]", size)
+	local buf = self.scratch
+	buf.buf_addr = data
+	buf.data_off = 0
+	buf.pkt_len = size
+	buf.data_len = size
+	func(buf)
+	local idx = C.pkt_templates_add(self.tpls, data, buf.data_len, weight or 1)
+	if idx < 0 then
+		log:fatal("could not add packet template")
+	end
+	return idx
+end
+
+--- Allocates buffers from the memory pool and fills them with copies of the templates.
+--- @param tpls the templates created by memory.createTemplates()
+--- @param indices optional uint8_t array that receives the template index of each packet
+--- @return true if the buffers were allocated, false if the mempool is (temporarily) exhausted
+function bufArray:allocFromTemplates(tpls, indices)
+	return C.pkt_templates_alloc(tpls.tpls, self.mem, self.array, self.size, indices) == self.size
 end
 
 --- Free all buffers in the array. Stops when it encounters the first one that is null.
@@ -0,0 +1,86 @@
+--- Field modifiers applied to a whole burst of packets in C.
+--- Use this instead of modifying fields per packet in Lua when generating many flows.
+local mod = {}
+
+local ffi = require "ffi"
+local log = require "log"
+local libmoon = require "libmoon"
+local C   = ffi.C
+
+ffi.cdef[[
+	struct mod_program { };
+	struct mod_program* mod_program_create(uint64_t seed, int32_t socket);
+	void mod_program_free(struct mod_program* prog);
+	int mod_program_add(struct mod_program* prog, uint32_t offset, uint32_t bits, uint32_t op, uint64_t min, uint64_t max, uint64_t step, const uint64_t* list, uint32_t list_len);
+	int mod_program_add_checksum(struct mod_program* prog, uint32_t field, uint32_t offset, uint32_t start, uint8_t udp);
+	void mod_program_apply(struct mod_program* prog, struct rte_mbuf** bufs, uint32_t n);
+]]
+
+local ops = {
+	inc = 0,
+	dec = 1,
+	random = 2,
+	list = 3,
+}
+
+local program = {}
+program.__index = program
+
+--- Create a new (empty) list of modifiers.
+--- @param seed optional seed for random modifiers, default: seeded from the TSC
+function mod:new(seed)
+	local prog = C.mod_program_create(seed or libmoon.getCycles(), select(2, libmoon.getCore()))
+	if prog == nil then
+		log:fatal("could not allocate modifier program")
+	end
+	return setmetatable({ prog = ffi.gc(prog, C.mod_program_free) }, program)
+end
+
+--- Add a field modifier, up to 16 modifiers are supported.
+--- Modifiers are applied in the order they were added.
+--- @param args table with the fields
+---   offset: offset of the field in bytes from the start of the packet
+---   bits: width of the field: 8, 16, 32, 48 (MAC addresses), 64, or 128 (IPv6 addresses, only the lower 64 bits are modified)
+---   op: "inc", "dec", "random" (uniform in [min, max]), or "list" (cycles through values)
+---   min, max: range of the values (inclusive), default: the full range of the field
+---   step: for inc/dec, default: 1
+---   values: array of values for op "list"
+---   checksums: optional array of checksums that are updated incrementally, each entry is a table with
+---     offset: offset of the checksum field
+---     start: offset at which the checksummed data starts, e.g., the start of the IP header
+---     udp: true if this is a UDP checksum (0 means "no checksum")
+---   for example, modifying the IPv4 source of a UDP packet requires {offset = 24, start = 14} and {offset = 40, start = 34, udp = true}
+--- @return self
+function program:add(args)
+	local op = ops[args.op]
+	if not op then
+		log:fatal("unknown modifier op %s", args.op)
+	end
+	local list, listLen = nil, 0
+	if op == ops.list then
+		listLen = #args.values
+		list = ffi.new("uint64_t[?]", listLen)
+		for i, v in ipairs(args.values) do
+			list[i - 1] = v
+		end
+	end
+	local idx = C.mod_program_add(self.prog, args.offset, args.bits, op, args.min or 0, args.max or -1ULL, args.step or 1, list, listLen)
+	if idx < 0 then
+		log:fatal("invalid modifier at offset %d with %d bits", args.offset, args.bits)
+	end
+	for _, csum in ipairs(args.checksums or {}) do
+		if C.mod_program_add_checksum(self.prog, idx, csum.offset, csum.start, csum.udp and 1 or 0) ~= 0 then
+			log:fatal("only two checksums per modifier are supported")
+		end
+	end
+	return self
+end
+
+--- Apply all modifiers to the first n packets of the bufArray.
+--- @param bufs the bufArray
+--- @param n optional, default: bufs.size
+function program:apply(bufs, n)
+	C.mod_program_apply(self.prog, bufs.array, n or bufs.size)
+end
+
+return mod
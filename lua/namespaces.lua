@@ -11,6 +11,7 @@ local serpent	= require "Serpent"
 local stp		= require "StackTracePlus"
 local lock		= require "lock"
 local log		= require "log"
+local dpdkc		= require "dpdkc"
 
 ffi.cdef [[
 	struct namespace { };
@@ -18,8 +19,24 @@ ffi.cdef [[
 	void namespace_store(struct namespace* ns, const char* key, const char* value);
 	void namespace_delete(struct namespace* ns, const char* key);
 	const char* namespace_retrieve(struct namespace* ns, const char* key);
+	int64_t namespace_retrieve_copy(struct namespace* ns, const char* key, char* buf, size_t buf_len);
 	void namespace_iterate(struct namespace* ns, void (*func)(const char* key, const char* val));
 	struct lock* namespace_get_lock(struct namespace* ns);
+
+	struct ns_slot {
+		uint32_t type;
+		uint32_t size;
+		uint32_t shards;
+		uint32_t stride;
+		uint8_t* data;
+	};
+	struct ns_slot* namespace_get_slot(struct namespace* ns, const char* key, uint32_t type, uint32_t size, uint8_t sharded);
+	int64_t ns_slot_add_int64(struct ns_slot* slot, uint32_t idx, int64_t val);
+	void ns_slot_set_int64(struct ns_slot* slot, uint32_t idx, int64_t val);
+	int64_t ns_slot_read_int64(struct ns_slot* slot, uint32_t idx);
+	double ns_slot_add_double(struct ns_slot* slot, uint32_t idx, double val);
+	void ns_slot_set_double(struct ns_slot* slot, uint32_t idx, double val);
+	double ns_slot_read_double(struct ns_slot* slot, uint32_t idx);
 ]]
 local cbType = ffi.typeof("void (*)(const char* key, const char* val)")
 
@@ -28,6 +45,18 @@ local C = ffi.C
 local namespace = {}
 namespace.__index = namespace
 
+-- values are copied into this buffer while holding only a shared lock on the entry
+-- each task has its own Lua state and therefore its own buffer
+local retrieveBufSize = 0
+local retrieveBuf
+
+local function growRetrieveBuf(size)
+	retrieveBufSize = math.max(size, retrieveBufSize * 2, 4096)
+	retrieveBuf = ffi.new("char[?]", retrieveBufSize)
+end
+
+growRetrieveBuf(4096)
+
 local function getNameFromTrace()
 	return debug.traceback():match("\n.-\n.-\n(.-)\n")
 end
@@ -46,35 +75,20 @@ function namespace:__index(key)
 		log:fatal("Table index must be a string")
 	end
 	if key == "forEach" then
-		return namespace.forEach
+		return namespace[key]
 	elseif key == "lock" then
 		return C.namespace_get_lock(self)
 	end
-	local val = C.namespace_retrieve(self, key)
-	if (val == nil) then
-		return nil
+	local len = tonumber(C.namespace_retrieve_copy(self, key, retrieveBuf, retrieveBufSize))
+	while len >= retrieveBufSize do
+		-- value is larger than our buffer or was replaced by a larger value between the two calls
+		growRetrieveBuf(len + 1)
+		len = tonumber(C.namespace_retrieve_copy(self, key, retrieveBuf, retrieveBufSize))
 	end
-	local ffisval = ffi.string(val)
-	if (ffisval == nil) then
-		--print("** got ffi.string = nil!",key,val)
+	if len < 0 then
 		return nil
 	end
-	local lsffisval = loadstring(ffisval)
-	if (lsffisval == nil) then
-		--print("** ** got loadstring(ffi.string) = nil!",key,val,ffisval)
-		val = C.namespace_retrieve(self, key)
-		ffisval = ffi.string(val)
-		lsffisval = loadstring(ffisval)
-		while (lsffisval == nil) do
-			--print("** ** got loadstring(ffi.string) = nil!",key,val,ffisval)
-			val = C.namespace_retrieve(self, key)
-			ffisval = ffi.string(val)
-			lsffisval = loadstring(ffisval)
-		end
-		--print("** ** got out OK!!!                    ",key,val,ffisval)
-	end
-	local lsffisvalcall = lsffisval()
-	return val ~= nil and lsffisvalcall or nil
+	return loadstring(ffi.string(retrieveBuf, len))()
 end
 
 --- Store a value in the namespace.
@@ -123,7 +137,125 @@ function namespace:forEach(func)
 	end
 end
 
+local SLOT_INT64 = 0
+local SLOT_DOUBLE = 1
+
+local function getSlot(ns, key, slotType, size, sharded)
+	if type(key) ~= "string" then
+		log:fatal("Slot name must be a string")
+	end
+	size = size or 1
+	local slot = C.namespace_get_slot(ns, key, slotType, size, sharded and 1 or 0)
+	if slot == nil then
+		log:fatal("Slot %s already exists with a different type, size, or sharding", key)
+	end
+	return slot
+end
+
+--- Get a shared int64 counter (or an array of counters) in a namespace, creating it if necessary.
+--- Counters are not stored in the string map and do not use the namespace lock, the key does not
+--- collide with values stored in the namespace.
+--- All tasks requesting the same key get the same counter, the type, size, and sharding must match.
+--- @param ns the namespace
+--- @param key the name of the counter
+--- @param size optional (default = 1) number of elements
+--- @param sharded optional (default = false) keep a separate copy per core which is summed up on read
+---   this makes updates as cheap as a normal memory access, use it for counters updated from the fast path
+function mod:getCounter(ns, key, size, sharded)
+	return getSlot(ns, key, SLOT_INT64, size, sharded)
+end
+
+--- Get a shared double gauge (or an array of gauges) in a namespace, creating it if necessary.
+--- See getCounter() for the parameters.
+function mod:getGauge(ns, key, size, sharded)
+	return getSlot(ns, key, SLOT_DOUBLE, size, sharded)
+end
+
+local slot = {}
+slot.__index = slot
+
+-- the core id is only valid after DPDK is initialized, so it is cached once it looks sane
+local currentCore
+local function getShard(shards)
+	if not currentCore then
+		local core = dpdkc.get_current_core()
+		if core >= shards then
+			return nil
+		end
+		currentCore = core
+	end
+	return currentCore
+end
+
+--- Get a pointer to the elements owned by the current core.
+--- Only the current task may write through this pointer if the slot is sharded.
+--- Writes through the pointer of a non-sharded slot are not atomic.
+--- @param shard optional (default = current core) shard to access
+--- @return int64_t* or double* depending on the slot type, indexed from 0
+function slot:ptr(shard)
+	shard = shard or (self.shards > 1 and getShard(self.shards)) or 0
+	if shard >= self.shards then
+		log:fatal("Shard %d out of range, slot has %d shards", shard, self.shards)
+	end
+	local ptr = self.data + shard * self.stride * 8
+	return ffi.cast(self.type == SLOT_INT64 and "int64_t*" or "double*", ptr)
+end
+
+local function checkIndex(slot, idx)
+	if idx < 0 or idx >= slot.size then
+		log:fatal("Index %d out of range, slot has %d elements", idx, slot.size)
+	end
+end
+
+--- Add a value to an element.
+--- @param val the value to add
+--- @param idx optional (default = 0) 0-based element index
+function slot:add(val, idx)
+	idx = idx or 0
+	checkIndex(self, idx)
+	if self.shards > 1 then
+		local shard = getShard(self.shards)
+		if shard then
+			local ptr = self:ptr(shard)
+			ptr[idx] = ptr[idx] + val
+			return
+		end
+	end
+	if self.type == SLOT_INT64 then
+		C.ns_slot_add_int64(self, idx, val)
+	else
+		C.ns_slot_add_double(self, idx, val)
+	end
+end
+
+--- Set an element, resets all shards.
+--- @param val the new value
+--- @param idx optional (default = 0) 0-based element index
+function slot:set(val, idx)
+	idx = idx or 0
+	checkIndex(self, idx)
+	if self.type == SLOT_INT64 then
+		C.ns_slot_set_int64(self, idx, val)
+	else
+		C.ns_slot_set_double(self, idx, val)
+	end
+end
+
+--- Read an element, sums up all shards.
+--- @param idx optional (default = 0) 0-based element index
+--- @return the value as a Lua number
+function slot:get(idx)
+	idx = idx or 0
+	checkIndex(self, idx)
+	if self.type == SLOT_INT64 then
+		return tonumber(C.ns_slot_read_int64(self, idx))
+	else
+		return C.ns_slot_read_double(self, idx)
+	end
+end
+
 ffi.metatype("struct namespace", namespace)
+ffi.metatype("struct ns_slot", slot)
 
 return mod
 
@@ -675,7 +675,6 @@ end
 --- There also exist functions to calculate the checksum of only one header.
 --- Naming convention: pkt:calculate<member>Checksum() (for all existing packets member = {Ip, Tcp, Udp, Icmp})
 --- @note Calculating checksums manually is extremely slow compared to offloading this task to the NIC (~65% performance loss at the moment)
---- @todo Manual calculation of udp and tcp checksums NYI
 function packetCalculateChecksums(args)
 	local str = ""
 	for _, v in ipairs(args) do
@@ -684,11 +683,11 @@ function packetCalculateChecksums(args)
 		member = data['name']
 		
 		-- if the header has a checksum, call the function
-		if header == "ip4" or header == "icmp" then -- FIXME NYI or header == "udp"
+		if header == "ip4" or header == "icmp" then
 			str = str .. [[
 				self.]] .. member .. [[:calculateChecksum()
 				]]
-		elseif header == "tcp" then
+		elseif header == "tcp" or header == "udp" then
 			str = str .. [[
 				self.]] .. member .. [[:calculateChecksum(data, len, ipv4)
 				]]
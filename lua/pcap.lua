@@ -36,6 +36,7 @@ typedef struct {
 
 local headerType = ffi.typeof("pcap_hdr_t")
 local headerPointer = ffi.typeof("pcap_hdr_t*")
+local recHeaderPointer = ffi.typeof("pcaprec_hdr_t*")
 local packetType = ffi.typeof("pcaprec_hdr_t")
 local packetPointer = ffi.typeof("pcaprec_hdr_t*")
 local voidPointer = ffi.typeof("void*")
@@ -48,11 +49,79 @@ function mod:setInitialFilesize(newSizeInBytes)
 	INITIAL_FILE_SIZE = newSizeInBytes
 end
 
+ffi.cdef[[
+	struct pcapng_reader_state {
+		uint32_t num_interfaces;
+		uint64_t ts_mul[256];
+		uint64_t ts_div[256];
+	};
+	struct pcap_index_header {
+		uint64_t magic;
+		uint32_t version;
+		uint32_t format;
+		uint32_t stride;
+		uint32_t multi_section;
+		uint64_t file_size;
+		uint64_t file_mtime_ns;
+		uint64_t data_start;
+		uint64_t data_end;
+		uint64_t num_records;
+		uint64_t num_entries;
+		uint64_t first_ts;
+		uint64_t last_ts;
+	};
+	struct pcap_index {
+		struct pcap_index_header header;
+	};
+	struct pcap_index* pcap_index_create(uint32_t format, uint32_t stride, uint64_t data_start);
+	void pcap_index_free(struct pcap_index* index);
+	int pcap_index_add(struct pcap_index* index, uint64_t ts_ns, uint64_t offset, uint64_t end);
+	void pcap_index_add_interface(struct pcap_index* index, const uint8_t* block, uint32_t total_len, uint64_t offset);
+	struct pcap_index* pcap_index_build(const uint8_t* data, uint64_t size, uint32_t format, uint32_t stride);
+	int pcap_index_save(struct pcap_index* index, const char* filename, const char* capture);
+	struct pcap_index* pcap_index_load(const char* filename, const char* capture);
+	uint64_t pcap_index_seek_time(struct pcap_index* index, const uint8_t* data, uint64_t ts_ns);
+	uint64_t pcap_index_seek_record(struct pcap_index* index, const uint8_t* data, uint64_t record);
+	void pcap_index_get_state(struct pcap_index* index, uint64_t offset, struct pcapng_reader_state* state);
+	void pcap_index_split(struct pcap_index* index, uint64_t start, uint64_t end, uint32_t num_ranges, uint64_t* bounds);
+]]
+
+-- keep in sync with pcap_index.h
+local INDEX_PCAP_US = 0
+local INDEX_PCAP_NS = 1
+local INDEX_PCAPNG = 2
+
+-- index every 4096th record, seeking reads at most that many records
+local INDEX_STRIDE = 4096
+
+--- Load the sidecar index <filename>.idx of a mapped pcap or pcapng file.
+--- The index is built and saved if it does not exist or the size or modification time of the file changed.
+--- @param format 0 for pcap with microsecond timestamps, 1 for nanosecond timestamps, 2 for pcapng
+--- @return struct pcap_index*, freed by the garbage collector
+function mod.loadIndex(filename, ptr, size, format)
+	local indexFile = filename .. ".idx"
+	local index = C.pcap_index_load(indexFile, filename)
+	if index == nil then
+		index = C.pcap_index_build(ptr, size, format, INDEX_STRIDE)
+		if index == nil then
+			log:fatal("could not allocate index for %s", filename)
+		end
+		if C.pcap_index_save(index, indexFile, filename) ~= 0 then
+			log:warn("could not save index %s: %s", indexFile, strError(S.errno()))
+		end
+	end
+	index = ffi.gc(index, C.pcap_index_free)
+	if index.header.multi_section ~= 0 then
+		log:fatal("pcapng files with multiple sections can not be indexed: %s", filename)
+	end
+	return index
+end
+
 local writer = {}
 writer.__index = writer
 
 local function writeHeader(ptr)
-	local hdr = headerPointer(ptr)
+	local hdr = cast(headerPointer, ptr)
 	hdr.magic_number = 0xa1b2c3d4
 	hdr.version_major = 2
 	hdr.version_minor = 4
@@ -63,12 +132,8 @@ local function writeHeader(ptr)
 	return ffi.sizeof(headerType)
 end
 
---- Create a new fast pcap writer with the given file name.
---- Call :close() on the writer when you are done.
---- @param startTime posix timestamp, all timestamps of inserted packets will be relative to this timestamp
----        default: relative to libmoon.getTime() == 0
-function mod:newWriter(filename, startTime)
-	startTime = startTime or wallTime() - libmoon.getTime()
+-- creates the file and maps the first INITIAL_FILE_SIZE bytes of it
+local function createMappedFile(filename)
 	local fd = S.open(filename, "creat, rdwr, trunc", "0666")
 	if not fd then
 		log:fatal("could not create pcap file: %s", strError(S.errno()))
@@ -82,9 +147,43 @@ function mod:newWriter(filename, startTime)
 	if not ptr then
 		log:fatal("mmap failed: %s", strError(S.errno()))
 	end
+	return fd, cast("uint8_t*", ptr), size
+end
+
+-- posix timestamps in nanoseconds are not exact as doubles, round to microseconds first
+local function posixToNs(time)
+	return ffi.cast("uint64_t", time * 10^6) * 1000
+end
+
+--- Convert the startTime argument of the writers to nanoseconds.
+--- @param startTime optional posix timestamp, default: the time at which libmoon.getTime() was 0
+--- @return uint64_t nanoseconds
+function mod.startTimeNs(startTime)
+	return posixToNs(startTime or wallTime() - libmoon.getTime())
+end
+
+--- Create a new fast pcap writer with the given file name.
+--- Call :close() on the writer when you are done.
+--- @param startTime posix timestamp, all timestamps of inserted packets will be relative to this timestamp
+---        default: relative to libmoon.getTime() == 0
+function mod:newWriter(filename, startTime)
+	startTime = startTime or wallTime() - libmoon.getTime()
+	local fd, ptr, size = createMappedFile(filename)
 	local offset = writeHeader(ptr)
-	ptr = cast("uint8_t*", ptr)
-	return setmetatable({fd = fd, ptr = ptr, size = size, offset = offset, startTime = startTime}, writer)
+	return setmetatable({fd = fd, filename = filename, ptr = ptr, size = size, offset = offset, startTime = startTime}, writer)
+end
+
+--- Build the sidecar index <filename>.idx while writing, avoids a pass over the file when it is read with
+--- seekTime(), seekRecord(), or split() later. The index is saved by close().
+--- Must be called before writing packets or adding interfaces.
+function writer:enableIndex()
+	local format = getmetatable(self) == writer and INDEX_PCAP_US or INDEX_PCAPNG
+	local index = C.pcap_index_create(format, INDEX_STRIDE, self.offset)
+	if index == nil then
+		log:fatal("could not allocate index")
+	end
+	self.index = ffi.gc(index, C.pcap_index_free)
+	return self
 end
 
 function writer:resize(size)
@@ -112,6 +211,12 @@ function writer:close()
 	S.close(self.fd)
 	self.fd = nil
 	self.ptr = nil
+	if self.index then
+		if C.pcap_index_save(self.index, self.filename .. ".idx", self.filename) ~= 0 then
+			log:warn("could not save index %s.idx: %s", self.filename, strError(S.errno()))
+		end
+		self.index = nil
+	end
 end
 
 ffi.cdef[[
@@ -128,6 +233,9 @@ function writer:write(timestamp, data, len, origLen)
 	local timeSec = math.floor(time)
 	local timeMicros = (time - timeSec) * 1000000
 	C.libmoon_write_pcap(self.ptr + self.offset, data, len, origLen or len, time, timeMicros)
+	if self.index then
+		C.pcap_index_add(self.index, timeSec * 1000000000ULL + math.floor(timeMicros) * 1000, self.offset, self.offset + len + 16)
+	end
 	self.offset = self.offset + len + 16
 end
 
@@ -140,14 +248,341 @@ function writer:writeBuf(timestamp, buf, snapLen)
 	self:write(timestamp, buf:getData(), min(size, snapLen), size)
 end
 
+ffi.cdef[[
+	uint32_t libmoon_write_pcapng(void* dst, const void* packet, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns);
+	uint32_t libmoon_write_pcapng_shb(void* dst);
+	uint32_t libmoon_pcapng_idb_size(uint32_t name_len);
+	uint32_t libmoon_write_pcapng_idb(void* dst, const char* name, uint32_t name_len, uint16_t link_type, uint32_t snap_len);
+	uint32_t libmoon_read_pcapng_batch(struct mempool* mp, struct rte_mbuf** bufs, uint32_t num_bufs, const void* pcap, uint64_t remaining, uint32_t mempool_buf_size, struct pcapng_reader_state* state, uint64_t* consumed);
+]]
+
+local PCAPNG_SHB = 0x0A0D0D0A
+local PCAPNG_BYTE_ORDER_MAGIC = 0x1A2B3C4D
+-- EPB header and trailer, the data is padded to 4 bytes
+local PCAPNG_EPB_OVERHEAD = 32 + 3
+
+local ngWriter = setmetatable({}, { __index = writer })
+ngWriter.__index = ngWriter
+
+--- Create a new fast pcapng writer with the given file name.
+--- Timestamps are stored with nanosecond resolution, packets can be tagged with different interfaces.
+--- Call :close() on the writer when you are done.
+--- @param startTime posix timestamp, all timestamps of inserted packets will be relative to this timestamp
+---        default: relative to libmoon.getTime() == 0
+function mod:newPcapngWriter(filename, startTime)
+	local fd, ptr, size = createMappedFile(filename)
+	local offset = C.libmoon_write_pcapng_shb(ptr)
+	return setmetatable({
+		fd = fd, filename = filename, ptr = ptr, size = size, offset = offset,
+		startNs = mod.startTimeNs(startTime),
+		numInterfaces = 0
+	}, ngWriter)
+end
+
+--- Add an interface description, e.g., one per capture thread or rx queue.
+--- @param name optional, name of the interface
+--- @param linkType optional, default: 1 (Ethernet)
+--- @param snapLen optional, default: 0 (no limit)
+--- @return the interface id to pass to the write functions
+function ngWriter:addInterface(name, linkType, snapLen)
+	name = name or ""
+	local totalLen = C.libmoon_pcapng_idb_size(#name)
+	if self.offset + totalLen >= self.size then
+		self:resize(self.size * 2)
+	end
+	local len = C.libmoon_write_pcapng_idb(self.ptr + self.offset, name, #name, linkType or 1, snapLen or 0)
+	if self.index then
+		C.pcap_index_add_interface(self.index, self.ptr + self.offset, len, self.offset)
+	end
+	self.offset = self.offset + len
+	self.numInterfaces = self.numInterfaces + 1
+	return self.numInterfaces - 1
+end
+
+-- doubles only resolve 256 ns steps at current posix timestamps in nanoseconds
+local MAX_EXACT_NS = 2^53
+
+--- Write a packet with an absolute timestamp, e.g., a hardware timestamp.
+--- @param timestamp posix timestamp in nanoseconds as uint64_t cdata, e.g., from ffi.cast("uint64_t", ts),
+---   Lua numbers are only accepted up to 2^53 as they are not exact beyond that
+--- @param interface optional interface id returned by addInterface(), default: 0
+function ngWriter:writeNs(timestamp, data, len, origLen, interface)
+	if type(timestamp) == "number" and timestamp > MAX_EXACT_NS then
+		log:fatal("timestamp %.0f is not exact as a Lua number, pass it as uint64_t", timestamp)
+	end
+	if self.numInterfaces == 0 then
+		self:addInterface()
+	end
+	if self.offset + len + PCAPNG_EPB_OVERHEAD >= self.size then
+		self:resize(self.size * 2)
+	end
+	local blockLen = C.libmoon_write_pcapng(self.ptr + self.offset, data, len, origLen or len, interface or 0, timestamp)
+	if self.index then
+		C.pcap_index_add(self.index, timestamp, self.offset, self.offset + blockLen)
+	end
+	self.offset = self.offset + blockLen
+end
+
+--- Write a packet to the pcapng file
+--- @param timestamp relative to the timestamp specified when creating the file
+--- @param interface optional interface id returned by addInterface(), default: 0
+function ngWriter:write(timestamp, data, len, origLen, interface)
+	self:writeNs(self.startNs + ffi.cast("uint64_t", timestamp * 10^9), data, len, origLen, interface)
+end
+
+--- Write a mbuf to the pcapng file
+--- @param timestamp relative to the timestamp specified when creating the file
+--- @param snapLen truncate the packet to this size
+--- @param interface optional interface id returned by addInterface(), default: 0
+function ngWriter:writeBuf(timestamp, buf, snapLen, interface)
+	local size = buf:getSize()
+	snapLen = snapLen or size
+	self:write(timestamp, buf:getData(), min(size, snapLen), size, interface)
+end
+
+--- Write a mbuf with an absolute timestamp, e.g., a hardware timestamp.
+--- @param timestamp posix timestamp in nanoseconds as uint64_t cdata, see writeNs()
+--- @param snapLen truncate the packet to this size
+--- @param interface optional interface id returned by addInterface(), default: 0
+function ngWriter:writeBufNs(timestamp, buf, snapLen, interface)
+	local size = buf:getSize()
+	snapLen = snapLen or size
+	self:writeNs(timestamp, buf:getData(), min(size, snapLen), size, interface)
+end
+
+ffi.cdef[[
+	struct pcap_shared_writer { };
+	struct pcap_shared_writer* pcap_shared_create(const char* filename, uint32_t format, uint64_t chunk_size, uint64_t max_size, uint64_t start_ns);
+	int32_t pcap_shared_add_interface(struct pcap_shared_writer* writer, const char* name, uint32_t name_len, uint16_t link_type, uint32_t snap_len);
+	uint8_t pcap_shared_write(struct pcap_shared_writer* writer, const void* data, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns);
+	uint32_t pcap_shared_write_burst(struct pcap_shared_writer* writer, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t snap_len, uint32_t interface_id, uint64_t ts_ns);
+	uint64_t pcap_shared_close(struct pcap_shared_writer* writer);
+]]
+
+-- only virtual address space is reserved, the file grows in steps of the initial file size
+local SHARED_MAX_FILE_SIZE = 2^40
+
+local sharedWriter = {}
+sharedWriter.__index = sharedWriter
+
+--- Create a pcap or pcapng writer that can be shared by multiple tasks writing to the same file.
+--- Pass the writer to the tasks as an argument, packets are ordered by timestamp only within each task.
+--- Growing the file does not move memory that other tasks are writing to.
+--- Close the writer once all tasks are done writing.
+--- @param pcapng optional, write a pcapng file with nanosecond timestamps, default: false
+--- @param startTime posix timestamp, all timestamps of inserted packets will be relative to this timestamp
+---        default: relative to libmoon.getTime() == 0
+--- @param maxSize optional, maximum file size in bytes, default: 1 TiB
+function mod:newSharedWriter(filename, pcapng, startTime, maxSize)
+	local startNs = mod.startTimeNs(startTime)
+	local writer = C.pcap_shared_create(filename, pcapng and 1 or 0, INITIAL_FILE_SIZE, maxSize or SHARED_MAX_FILE_SIZE, startNs)
+	if writer == nil then
+		log:fatal("could not create pcap file: %s", strError(S.errno()))
+	end
+	return writer
+end
+
+--- Add a pcapng interface description, e.g., one per capturing task.
+--- Must be called before writing packets with the returned id, can be called from any task.
+--- @param name optional, name of the interface
+--- @param linkType optional, default: 1 (Ethernet)
+--- @param snapLen optional, default: 0 (no limit)
+--- @return the interface id to pass to the write functions
+function sharedWriter:addInterface(name, linkType, snapLen)
+	name = name or ""
+	local id = C.pcap_shared_add_interface(self, name, #name, linkType or 1, snapLen or 0)
+	if id < 0 then
+		log:fatal("could not add interface, not a pcapng file or the file is full")
+	end
+	return id
+end
+
+--- Write a packet to the file.
+--- @param timestamp relative to the timestamp specified when creating the file
+--- @param interface optional pcapng interface id returned by addInterface(), default: 0
+--- @return false if the file is full
+function sharedWriter:write(timestamp, data, len, origLen, interface)
+	return C.pcap_shared_write(self, data, len, origLen or len, interface or 0, ffi.cast("uint64_t", timestamp * 10^9)) == 1
+end
+
+--- Write a mbuf to the file.
+--- @param timestamp relative to the timestamp specified when creating the file
+--- @param snapLen truncate the packet to this size
+--- @param interface optional pcapng interface id returned by addInterface(), default: 0
+--- @return false if the file is full
+function sharedWriter:writeBuf(timestamp, buf, snapLen, interface)
+	local size = buf:getSize()
+	snapLen = snapLen or size
+	return self:write(timestamp, buf:getData(), min(size, snapLen), size, interface)
+end
+
+--- Write the first n mbufs of a bufArray with a single reservation, use this for high packet rates.
+--- @param timestamp relative to the timestamp specified when creating the file
+--- @param n optional, default: bufs.size
+--- @param snapLen optional, truncate packets to this size
+--- @param interface optional pcapng interface id returned by addInterface(), default: 0
+--- @return false if the file is full
+function sharedWriter:writeBufs(timestamp, bufs, n, snapLen, interface)
+	return self:writeMbufs(timestamp, bufs.array, n or bufs.size, snapLen, interface)
+end
+
+--- Write n mbufs from a C array of mbuf pointers with a single reservation.
+--- @param timestamp relative to the timestamp specified when creating the file
+--- @param mbufs struct rte_mbuf*[] or struct rte_mbuf**
+--- @param snapLen optional, truncate packets to this size
+--- @param interface optional pcapng interface id returned by addInterface(), default: 0
+--- @return false if the file is full
+function sharedWriter:writeMbufs(timestamp, mbufs, n, snapLen, interface)
+	return C.pcap_shared_write_burst(self, mbufs, n, snapLen or 0xFFFFFFFF, interface or 0, ffi.cast("uint64_t", timestamp * 10^9)) == n
+end
+
+--- Truncate and close the file, all tasks must be done writing.
+--- @return the file size
+function sharedWriter:close()
+	return tonumber(C.pcap_shared_close(self))
+end
+
+ffi.metatype("struct pcap_shared_writer", sharedWriter)
+
+ffi.cdef[[
+	struct pcap_direct_stats {
+		uint64_t writes;
+		uint64_t bytes;
+		uint64_t reap_latency_cycles;
+		uint64_t max_reap_latency_cycles;
+		uint64_t queue_depth_sum;
+		uint32_t queue_depth;
+		uint32_t max_queue_depth;
+		uint64_t stalls;
+		uint64_t errors;
+		uint8_t direct;
+		uint8_t uring;
+	};
+	struct pcap_direct_writer;
+	struct pcap_direct_writer* pcap_direct_create(const char* filename, uint32_t format, uint32_t buf_size, uint32_t num_bufs, uint64_t start_ns, int32_t socket);
+	uint8_t pcap_direct_write(struct pcap_direct_writer* writer, const void* data, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns);
+	uint32_t pcap_direct_write_burst(struct pcap_direct_writer* writer, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t snap_len, uint32_t interface_id, uint64_t ts_ns);
+	uint32_t pcap_direct_add_interface(struct pcap_direct_writer* writer, const char* name, uint32_t name_len, uint16_t link_type, uint32_t snap_len);
+	struct pcap_direct_stats* pcap_direct_get_stats(struct pcap_direct_writer* writer);
+	int64_t pcap_direct_close(struct pcap_direct_writer* writer);
+]]
+
+local directWriter = {}
+directWriter.__index = directWriter
+
+--- Create a pcap or pcapng writer that bypasses the page cache for sustained capturing to disks.
+--- Packets are collected in buffers on huge pages, full buffers are written with O_DIRECT via io_uring while
+--- the next buffer is filled. Falls back to buffered IO if the file system does not support O_DIRECT and
+--- to synchronous writes if io_uring is not available, see getStats().
+--- Not thread-safe, call :close() on the writer when you are done.
+--- @param pcapng optional, write a pcapng file with nanosecond timestamps, default: false
+--- @param startTime posix timestamp, all timestamps of inserted packets will be relative to this timestamp
+---        default: relative to libmoon.getTime() == 0
+--- @param bufSize optional, size of a single write, default: 4 MiB
+--- @param numBufs optional, number of buffers, i.e., maximum number of writes in flight, default: 8
+--- @param socket optional, NUMA socket for the buffers, default: any
+function mod:newDirectWriter(filename, pcapng, startTime, bufSize, numBufs, socket)
+	local startNs = mod.startTimeNs(startTime)
+	local writer = C.pcap_direct_create(filename, pcapng and 1 or 0, bufSize or 4 * 1024 * 1024, numBufs or 8, startNs, socket or -1)
+	if writer == nil then
+		log:fatal("could not create pcap file: %s", strError(S.errno()))
+	end
+	return setmetatable({writer = writer, pcapng = pcapng, numInterfaces = 0}, directWriter)
+end
+
+--- Add a pcapng interface description, see ngWriter:addInterface().
+--- @return the interface id to pass to the write functions
+function directWriter:addInterface(name, linkType, snapLen)
+	if not self.pcapng then
+		log:fatal("interfaces are only supported for pcapng files")
+	end
+	name = name or ""
+	C.pcap_direct_add_interface(self.writer, name, #name, linkType or 1, snapLen or 0)
+	self.numInterfaces = self.numInterfaces + 1
+	return self.numInterfaces - 1
+end
+
+--- Write a packet to the file.
+--- @param timestamp relative to the timestamp specified when creating the file
+--- @param interface optional pcapng interface id returned by addInterface(), default: 0
+--- @return false if writing to the disk failed
+function directWriter:write(timestamp, data, len, origLen, interface)
+	return C.pcap_direct_write(self.writer, data, len, origLen or len, interface or 0, ffi.cast("uint64_t", timestamp * 10^9)) == 1
+end
+
+--- Write a mbuf to the file.
+--- @param timestamp relative to the timestamp specified when creating the file
+--- @param snapLen truncate the packet to this size
+--- @param interface optional pcapng interface id returned by addInterface(), default: 0
+--- @return false if writing to the disk failed
+function directWriter:writeBuf(timestamp, buf, snapLen, interface)
+	local size = buf:getSize()
+	snapLen = snapLen or size
+	return self:write(timestamp, buf:getData(), min(size, snapLen), size, interface)
+end
+
+--- Write the first n mbufs of a bufArray.
+--- @param timestamp relative to the timestamp specified when creating the file
+--- @param n optional, default: bufs.size
+--- @param snapLen optional, truncate packets to this size
+--- @param interface optional pcapng interface id returned by addInterface(), default: 0
+--- @return false if writing to the disk failed
+function directWriter:writeBufs(timestamp, bufs, n, snapLen, interface)
+	return self:writeMbufs(timestamp, bufs.array, n or bufs.size, snapLen, interface)
+end
+
+--- Write n mbufs from a C array of mbuf pointers.
+--- @return false if writing to the disk failed
+function directWriter:writeMbufs(timestamp, mbufs, n, snapLen, interface)
+	return C.pcap_direct_write_burst(self.writer, mbufs, n, snapLen or 0xFFFFFFFF, interface or 0, ffi.cast("uint64_t", timestamp * 10^9)) == n
+end
+
+--- Get statistics about the disk writes.
+--- @return table with the fields writes, bytes, meanReapLatencyUs, maxReapLatencyUs (submission of a write until its
+---   completion was polled, an upper bound of the disk latency as completions are only polled while writing),
+---   queueDepth (current writes in flight), meanQueueDepth, maxQueueDepth, stalls (waited for the disk),
+---   errors, direct (O_DIRECT is used), and uring (io_uring is used)
+function directWriter:getStats()
+	local stats = C.pcap_direct_get_stats(self.writer)
+	local hz = libmoon.getCyclesFrequency()
+	local writes = tonumber(stats.writes)
+	return {
+		writes = writes,
+		bytes = tonumber(stats.bytes),
+		meanReapLatencyUs = writes > 0 and tonumber(stats.reap_latency_cycles) / writes / hz * 10^6 or 0,
+		maxReapLatencyUs = tonumber(stats.max_reap_latency_cycles) / hz * 10^6,
+		queueDepth = stats.queue_depth,
+		meanQueueDepth = writes > 0 and tonumber(stats.queue_depth_sum) / writes or 0,
+		maxQueueDepth = stats.max_queue_depth,
+		stalls = tonumber(stats.stalls),
+		errors = tonumber(stats.errors),
+		direct = stats.direct == 1,
+		uring = stats.uring == 1,
+	}
+end
+
+--- Flush all buffers and close the file.
+--- @return the file size, nil if a write failed
+function directWriter:close()
+	local size = C.pcap_direct_close(self.writer)
+	self.writer = nil
+	return size >= 0 and tonumber(size) or nil
+end
+
 local reader = {}
 reader.__index = reader
 
+-- returns the size of the header and the index format of the file
 local function readHeader(ptr)
-	local hdr = headerPointer(ptr)
-	if hdr.magic_number == 0xd4c3b2a1 then
+	local hdr = cast(headerPointer, ptr)
+	local format
+	if hdr.magic_number == 0xa1b2c3d4 then
+		format = INDEX_PCAP_US
+	elseif hdr.magic_number == 0xa1b23c4d then
+		format = INDEX_PCAP_NS
+	elseif hdr.magic_number == 0xd4c3b2a1 or hdr.magic_number == 0x4d3cb2a1 then
 		log:fatal("big endian pcaps are not supported")
-	elseif hdr.magic_number ~= 0xa1b2c3d4 then
+	else
 		log:fatal("not a pcap file")
 	end
 	if hdr.version_major ~= 2 or hdr.version_minor ~= 4 then
@@ -159,10 +594,17 @@ local function readHeader(ptr)
 	if hdr.network ~= 1 then
 		log:fatal("unsupported link layer type")
 	end
-	return ffi.sizeof(headerType)
+	return ffi.sizeof(headerType), format
 end
 
---- Create a new fast pcap reader for the given file name.
+local ngReader = {}
+ngReader.__index = ngReader
+
+--- Create a new fast pcap reader for the given file name, pcapng files are detected automatically.
+--- Packets keep the timestamp resolution of the file in their udata64 field: microseconds for classic pcap files,
+--- nanoseconds for pcap files with nanosecond resolution and pcapng files.
+--- reader.tsPerSecond is the number of udata64 units per second, use reader:getTimestampNs(buf) to get nanoseconds
+--- regardless of the file format.
 --- Call :close() on the reader when you are done to avoid fd leakage.
 function mod:newReader(filename)
 	local fd = S.open(filename, "rdonly")
@@ -175,9 +617,25 @@ function mod:newReader(filename)
 	if not ptr then
 		log:fatal("mmap failed: %s", strError(S.errno()))
 	end
-	local offset = readHeader(ptr)
+	if size >= 12 and cast("uint32_t*", ptr)[0] == PCAPNG_SHB then
+		if cast("uint32_t*", ptr)[2] ~= PCAPNG_BYTE_ORDER_MAGIC then
+			log:fatal("big endian pcapng files are not supported")
+		end
+		return setmetatable({
+			fd = fd, filename = filename, ptr = cast("uint8_t*", ptr), size = size,
+			offset = 0, start = 0, limit = size, format = INDEX_PCAPNG, tsPerSecond = 10^9,
+			state = ffi.new("struct pcapng_reader_state"),
+			consumed = ffi.new("uint64_t[1]"),
+			single = ffi.new("struct rte_mbuf*[1]"),
+		}, ngReader)
+	end
+	local offset, format = readHeader(ptr)
 	ptr = cast("uint8_t*", ptr)
-	return setmetatable({fd = fd, ptr = ptr, size = size, offset = offset}, reader)
+	return setmetatable({
+		fd = fd, filename = filename, ptr = ptr, size = size,
+		offset = offset, start = offset, limit = size, format = format,
+		tsPerSecond = format == INDEX_PCAP_NS and 10^9 or 10^6
+	}, reader)
 end
 
 ffi.cdef[[
@@ -185,16 +643,34 @@ ffi.cdef[[
 	uint32_t libmoon_read_pcap_batch(struct mempool* mp, struct rte_mbuf** bufs, uint32_t num_bufs, const void* pcap, uint64_t remaining, uint32_t mempool_buf_size);
 ]]
 
---- Read the next packet into a buf, the timestamp is stored in the udata64 field as microseconds.
+-- the C reader assumes microseconds, nanosecond pcap records store nanoseconds in ts_usec
+local function fixTimestamp(buf, ptr)
+	local hdr = cast(recHeaderPointer, ptr)
+	buf.udata64 = hdr.ts_sec * 1000000000ULL + hdr.ts_usec
+end
+
+--- Get the timestamp of a packet read by this reader.
+--- @return posix timestamp in nanoseconds as uint64_t
+function reader:getTimestampNs(buf)
+	if self.tsPerSecond == 10^9 then
+		return buf.udata64
+	end
+	return buf.udata64 * 1000
+end
+
+--- Read the next packet into a buf, the timestamp is stored in the udata64 field in units of reader.tsPerSecond.
 --- The buffer's packet size corresponds to the original packet size, cut off bytes are zero-filled.
 function reader:readSingle(mempool, mempoolBufSize)
 	mempoolBufSize = mempoolBufSize or 2048
-	local fileRemaining = self.size - self.offset
+	local fileRemaining = self.limit - self.offset
 	if fileRemaining < 32 then -- header size
 		return nil
 	end
 	local buf = C.libmoon_read_pcap(mempool, self.ptr + self.offset, fileRemaining, mempoolBufSize)
 	if buf then
+		if self.format == INDEX_PCAP_NS then
+			fixTimestamp(buf, self.ptr + self.offset)
+		end
 		self.offset = self.offset + buf.pkt_len + 16
 		-- chained mbufs not supported for now
 		buf.pkt_len = buf.data_len
@@ -202,17 +678,20 @@ function reader:readSingle(mempool, mempoolBufSize)
 	return buf
 end
 
---- Read a batch of packets into a bufArray, the timestamp is stored in the udata64 field as microseconds.
+--- Read a batch of packets into a bufArray, the timestamp is stored in the udata64 field in units of reader.tsPerSecond.
 --- The buffer's packet size corresponds to the original packet size, cut off bytes are zero-filled.
 --- @return the number of packets read
 function reader:read(bufs, mempoolBufSize)
 	mempoolBufSize = mempoolBufSize or 2048
-	local fileRemaining = self.size - self.offset
+	local fileRemaining = self.limit - self.offset
 	if fileRemaining < 32 then -- header size
 		return 0
 	end
 	local numRead = C.libmoon_read_pcap_batch(bufs.mem, bufs.array, bufs.size, self.ptr + self.offset, fileRemaining, mempoolBufSize)
 	for i = 0, numRead - 1 do
+		if self.format == INDEX_PCAP_NS then
+			fixTimestamp(bufs.array[i], self.ptr + self.offset)
+		end
 		self.offset = self.offset + bufs.array[i].pkt_len + 16
 		-- chained mbufs not supported for now
 		bufs.array[i].pkt_len = bufs.array[i].data_len
@@ -227,10 +706,111 @@ function reader:close()
 	self.ptr = nil
 end
 
+--- Restart reading at the beginning of the file or the range set by setRange().
 function reader:reset()
-	self.offset = ffi.sizeof(headerType)
+	self:setOffset(self.start)
+end
+
+-- continue reading at the record starting at offset
+function reader:setOffset(offset)
+	self.offset = tonumber(offset)
+end
+
+--- Get the sidecar index of the file, loads <filename>.idx or builds it on first use.
+--- Building reads the whole file once, the index is saved for later readers.
+function reader:getIndex()
+	if not self.index then
+		self.index = mod.loadIndex(self.filename, self.ptr, self.size, self.format)
+	end
+	return self.index
+end
+
+--- Get the number of packets and the time span of the file, builds the index if necessary.
+--- @return number of packets, posix timestamps of the first and last packet
+function reader:getInfo()
+	local header = self:getIndex().header
+	return tonumber(header.num_records), tonumber(header.first_ts) / 10^9, tonumber(header.last_ts) / 10^9
+end
+
+--- Continue reading at the first packet with a timestamp >= time, packets must be sorted by time.
+--- @param time posix timestamp
+--- @return false if there is no such packet
+function reader:seekTime(time)
+	local index = self:getIndex()
+	local offset = C.pcap_index_seek_time(index, self.ptr, posixToNs(time))
+	self:setOffset(offset)
+	return offset < index.header.data_end
 end
 
+--- Continue reading at the nth packet, starting at 0.
+--- @return false if the file has fewer packets
+function reader:seekRecord(n)
+	local index = self:getIndex()
+	local offset = C.pcap_index_seek_record(index, self.ptr, n)
+	self:setOffset(offset)
+	return offset < index.header.data_end
+end
+
+--- Split the file from the current read position to the end of the range into n byte ranges of similar size
+--- that start at packet boundaries, e.g., to read or replay a large file with n tasks in parallel.
+--- Pass a range to setRange() of a reader in each task or to replay:addFile().
+--- @return array of n ranges { start, stop }, ranges may be empty if the file is small
+function reader:split(n)
+	local bounds = ffi.new("uint64_t[?]", n + 1)
+	C.pcap_index_split(self:getIndex(), self.offset, self.limit, n, bounds)
+	local ranges = {}
+	for i = 0, n - 1 do
+		ranges[#ranges + 1] = { tonumber(bounds[i]), tonumber(bounds[i + 1]) }
+	end
+	return ranges
+end
+
+--- Only read packets in a range returned by split(), reset() restarts at the beginning of the range.
+--- @param range { start, stop }
+function reader:setRange(range)
+	self.start = range[1]
+	self.limit = range[2]
+	self:setOffset(self.start)
+end
+
+
+--- Read a batch of packets into a bufArray, the timestamp is stored in the udata64 field as nanoseconds.
+--- The buffer's packet size corresponds to the original packet size, cut off bytes are zero-filled.
+--- @return the number of packets read
+function ngReader:read(bufs, mempoolBufSize)
+	local numRead = C.libmoon_read_pcapng_batch(bufs.mem, bufs.array, bufs.size, self.ptr + self.offset,
+		self.limit - self.offset, mempoolBufSize or 2048, self.state, self.consumed)
+	self.offset = self.offset + tonumber(self.consumed[0])
+	return numRead
+end
+
+--- Read the next packet into a buf, the timestamp is stored in the udata64 field as nanoseconds.
+function ngReader:readSingle(mempool, mempoolBufSize)
+	local numRead = C.libmoon_read_pcapng_batch(mempool, self.single, 1, self.ptr + self.offset,
+		self.limit - self.offset, mempoolBufSize or 2048, self.state, self.consumed)
+	self.offset = self.offset + tonumber(self.consumed[0])
+	return numRead == 1 and self.single[0] or nil
+end
+
+ngReader.close = reader.close
+ngReader.reset = reader.reset
+ngReader.getIndex = reader.getIndex
+ngReader.getInfo = reader.getInfo
+ngReader.seekTime = reader.seekTime
+ngReader.seekRecord = reader.seekRecord
+ngReader.split = reader.split
+ngReader.setRange = reader.setRange
+ngReader.getTimestampNs = reader.getTimestampNs
+
+-- continue reading at the block starting at offset, restores the interfaces defined before it
+function ngReader:setOffset(offset)
+	self.offset = tonumber(offset)
+	if self.offset == 0 then
+		self.state.num_interfaces = 0
+	else
+		C.pcap_index_get_state(self:getIndex(), self.offset, self.state)
+	end
+end
 
 return mod
 
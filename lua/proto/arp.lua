@@ -397,6 +397,9 @@ end
 --- ARP table timeout in seconds
 local ARP_AGING_TIME = 30
 
+--- Time in microseconds to wait for a tx buffer, the packet is skipped if the pool stays exhausted
+local ALLOC_TIMEOUT = 1000
+
 --- Arp handler task, responds to ARP queries for given IPs and performs arp lookups
 --- @todo TODO implement garbage collection/refreshing entries \n
 --- the current implementation does not handle large tables efficiently \n
@@ -428,8 +431,7 @@ local function handleArpPacket(rxBufs, txBufs, nic, ipToMac)
 		if rxPkt.arp:getOperation() == arp.OP_REQUEST then
 			local ip = rxPkt.arp:getProtoDst()
 			local mac = ipToMac[ip]
-			if mac then
-				txBufs:alloc(60)
+			if mac and txBufs:alloc(60, ALLOC_TIMEOUT, nic.txQueue) then
 				-- TODO: a single-packet API would be nice for things like this
 				local pkt = txBufs[1]:getArpPacket()
 				pkt.eth:setSrcString(mac)
@@ -502,17 +504,18 @@ local function arpTask(qs)
 		if gratArpTimer:expired() then
 			gratArpTimer:reset(qs.gratArpInterval or math.huge)
 			for _, nic in ipairs(qs) do
-				txBufs:alloc(60)
-				local pkt = txBufs[1]:getArpPacket()
-				pkt.eth:setDstString(eth.BROADCAST)
-				local mac = nic.txQueue.dev:getMacString()
-				pkt.eth:setSrcString(mac)
-				pkt.arp:setOperation(arp.OP_REQUEST)
-				pkt.arp:setHardwareDstString(eth.BROADCAST)
-				pkt.arp:setProtoDst(parseIPAddress(nic.ips[1]))
-				pkt.arp:setProtoSrc(parseIPAddress(nic.ips[1]))
-				pkt.arp:setHardwareSrcString(mac)
-				nic.txQueue:send(txBufs)
+				if txBufs:alloc(60, ALLOC_TIMEOUT, nic.txQueue) then
+					local pkt = txBufs[1]:getArpPacket()
+					pkt.eth:setDstString(eth.BROADCAST)
+					local mac = nic.txQueue.dev:getMacString()
+					pkt.eth:setSrcString(mac)
+					pkt.arp:setOperation(arp.OP_REQUEST)
+					pkt.arp:setHardwareDstString(eth.BROADCAST)
+					pkt.arp:setProtoDst(parseIPAddress(nic.ips[1]))
+					pkt.arp:setProtoSrc(parseIPAddress(nic.ips[1]))
+					pkt.arp:setHardwareSrcString(mac)
+					nic.txQueue:send(txBufs)
+				end
 			end
 		end
 		for i, nic in ipairs(qs) do
@@ -568,17 +571,18 @@ local function arpTask(qs)
 			ip = tonumber(ip)
 			for _, nic in ipairs(qs) do
 				-- TODO: do not send requests on all devices, but only the relevant
-				txBufs:alloc(60)
-				local pkt = txBufs[1]:getArpPacket()
-				pkt.eth:setDstString(eth.BROADCAST)
-				pkt.arp:setOperation(arp.OP_REQUEST)
-				pkt.arp:setHardwareDstString(eth.BROADCAST)
-				pkt.arp:setProtoDst(ip)
-				local mac = nic.txQueue.dev:getMacString()
-				pkt.eth:setSrcString(mac)
-				pkt.arp:setProtoSrc(parseIPAddress(nic.ips[1]))
-				pkt.arp:setHardwareSrcString(mac)
-				nic.txQueue:send(txBufs)
+				if txBufs:alloc(60, ALLOC_TIMEOUT, nic.txQueue) then
+					local pkt = txBufs[1]:getArpPacket()
+					pkt.eth:setDstString(eth.BROADCAST)
+					pkt.arp:setOperation(arp.OP_REQUEST)
+					pkt.arp:setHardwareDstString(eth.BROADCAST)
+					pkt.arp:setProtoDst(ip)
+					local mac = nic.txQueue.dev:getMacString()
+					pkt.eth:setSrcString(mac)
+					pkt.arp:setProtoSrc(parseIPAddress(nic.ips[1]))
+					pkt.arp:setHardwareSrcString(mac)
+					nic.txQueue:send(txBufs)
+				end
 			end
 		end)
 		for _, ip in ipairs(timedOutEntries) do
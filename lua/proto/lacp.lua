@@ -299,6 +299,8 @@ function lacp.startLacpTask(name, queues)
 end
 
 local LACP_TIMEOUT = 30
+-- time in microseconds to wait for a tx buffer, the LACPDU is skipped if the pool stays exhausted
+local ALLOC_TIMEOUT = 1000
 
 local status = ns:get()
 
@@ -414,15 +416,16 @@ local function lacpTask(name, queues)
 					else
 						port.stateFlags = bit.band(port.stateFlags, bit.bnot(lacp.STATE_EXP))
 					end
-					txBufs:alloc(lacp.PKT_SIZE)
-					local pkt = txBufs[1]:getLacpPacket()
-					pkt.eth.src:setString(port.txQueue.dev:getMacString())
-					pkt.lacp.actor:setKey(key)
-					pkt.lacp.actor:setPortId(port.txQueue.id + 1000)
-					pkt.lacp.actor:setState(port.stateFlags)
-					ffi.copy(port.actorInfo, pkt.lacp.actor, ffi.sizeof("struct lacp_info"))
-					ffi.copy(pkt.lacp.partner, port.partnerInfo, ffi.sizeof("struct lacp_info"))
-					port.txQueue:send(txBufs)
+					if txBufs:alloc(lacp.PKT_SIZE, ALLOC_TIMEOUT, port.txQueue) then
+						local pkt = txBufs[1]:getLacpPacket()
+						pkt.eth.src:setString(port.txQueue.dev:getMacString())
+						pkt.lacp.actor:setKey(key)
+						pkt.lacp.actor:setPortId(port.txQueue.id + 1000)
+						pkt.lacp.actor:setState(port.stateFlags)
+						ffi.copy(port.actorInfo, pkt.lacp.actor, ffi.sizeof("struct lacp_info"))
+						ffi.copy(pkt.lacp.partner, port.partnerInfo, ffi.sizeof("struct lacp_info"))
+						port.txQueue:send(txBufs)
+					end
 				end
 				lastUpdate = getMonotonicTime()
 			end
@@ -446,20 +446,11 @@ end
 --- If possible use checksum offloading instead.
 --- @param data cdata object of the complete packet.
 --- @param len	Length of the complete packet.
---- @param ipv4	True if its an IP4 packet. Default: true
+--- @param ipv4	Unused, the IP version is taken from the packet.
 --- @see pkt:offloadTcpChecksum
 function tcpHeader:calculateChecksum(data, len, ipv4)
-	-- first calculate checksum for the pseudo header
-	-- and write it into the checksum field
-	-- then, calculate remaining checksum of tcp segment
-	-- deduct Ethernet and IP header length from total size
-	if ipv4 then
-		dpdkc.calc_ipv4_pseudo_header_checksum(data, 25) -- offset in 16bit integers (byte #50 for IP4)
-		self:setChecksum(hton16(checksum(self, len - (14 + 20))))
-	else
-		dpdkc.calc_ipv6_pseudo_header_checksum(data, 30)
-		self:setChecksum(hton16(checksum(self, len - (14 + 40))))
-	end
+	-- pseudo header and segment are summed in C, the IP version is taken from the packet
+	dpdkc.checksum_packet_l4(data, 14, len)
 end
 
 --- Retrieve the checksum.
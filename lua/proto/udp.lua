@@ -10,6 +10,7 @@
 
 local ffi = require "ffi"
 
+local dpdkc = require "dpdkc"
 require "utils"
 require "proto.template"
 local initHeader = initHeader
@@ -121,9 +122,14 @@ function udpHeader:setChecksum(int)
 	self.cs = hton16(int)
 end
 
---- Calculate the checksum.
---- @todo FIXME NYI
-function udpHeader:calculateChecksum(len)
+--- Calculate and set the checksum.
+--- If possible use checksum offloading instead.
+--- @param data cdata object of the complete packet.
+--- @param len	Length of the complete packet.
+--- @param ipv4	Unused, the IP version is taken from the packet.
+--- @see pkt:offloadUdpChecksum
+function udpHeader:calculateChecksum(data, len, ipv4)
+	dpdkc.checksum_packet_l4(data, 14, len)
 end
 
 --- Retrieve the checksum.
@@ -0,0 +1,206 @@
+--- Timing-accurate replay of pcap and pcapng files.
+--- The replay runs in C and sends packets at their original relative timestamps (optionally scaled),
+--- multiple files are merged by timestamp. Packets are sent with TSC deadlines, all packets that are due
+--- are passed to the NIC in a single tx burst.
+local mod = {}
+
+local libmoon = require "libmoon"
+local ffi     = require "ffi"
+local log     = require "log"
+local S       = require "syscall"
+local pcap    = require "pcap"
+local C       = ffi.C
+
+ffi.cdef[[
+	struct replay_stats {
+		uint64_t packets;
+		uint64_t bytes;
+		uint64_t alloc_failures;
+		uint64_t late;
+		uint64_t late_cycles;
+		uint64_t loops;
+		uint64_t first_tsc;
+		uint64_t last_tsc;
+	};
+	struct replay;
+	struct replay* replay_create(uint16_t port, uint16_t queue, struct mempool* pool, uint32_t mbuf_size, int32_t socket);
+	void replay_free(struct replay* replay);
+	int replay_add_source(struct replay* replay, const uint8_t* data, uint64_t size, uint64_t start, uint32_t format, const struct pcapng_reader_state* state);
+	void replay_set_speed(struct replay* replay, double speed);
+	void replay_set_rate(struct replay* replay, double pps);
+	void replay_set_loops(struct replay* replay, uint64_t loops);
+	void replay_set_time_base(struct replay* replay, uint64_t first_ts, uint64_t start_tsc, uint64_t period);
+	uint64_t replay_run(struct replay* replay, uint64_t max_pkts);
+	struct replay_stats* replay_get_stats(struct replay* replay);
+]]
+
+-- keep in sync with replay.h
+local REPLAY_PCAP_US = 0
+local REPLAY_PCAP_NS = 1
+local REPLAY_PCAPNG = 2
+
+local PCAP_MAGIC_US = 0xa1b2c3d4
+local PCAP_MAGIC_NS = 0xa1b23c4d
+local PCAPNG_SHB = 0x0A0D0D0A
+local PCAPNG_BYTE_ORDER_MAGIC = 0x1A2B3C4D
+-- see replay.h
+local MAX_SOURCES = 16
+
+local replay = {}
+replay.__index = replay
+
+--- Create a new replay, add files with addFile() and start it with run().
+--- Plays all files once at their original speed by default.
+--- @param queue the tx queue to send on
+--- @param mempool the mempool to read packets into
+--- @param bufSize optional, buffer size of the mempool, default: 2048
+function mod:new(queue, mempool, bufSize)
+	local r = C.replay_create(queue.id, queue.qid, mempool, bufSize or 2048, queue.dev:getSocket())
+	if r == nil then
+		log:fatal("could not allocate replay")
+	end
+	queue.used = true
+	return setmetatable({
+		replay = ffi.gc(r, C.replay_free),
+		files = {},
+	}, replay)
+end
+
+-- returns the format and the offset of the first packet
+local function detectFormat(ptr, size, filename)
+	local magic = size >= 4 and ffi.cast("uint32_t*", ptr)[0] or 0
+	if magic == PCAPNG_SHB then
+		if size < 12 or ffi.cast("uint32_t*", ptr)[2] ~= PCAPNG_BYTE_ORDER_MAGIC then
+			log:fatal("big endian pcapng files are not supported: %s", filename)
+		end
+		return REPLAY_PCAPNG, 0
+	elseif magic == PCAP_MAGIC_US or magic == PCAP_MAGIC_NS then
+		if size < 24 then
+			log:fatal("truncated pcap file: %s", filename)
+		end
+		if ffi.cast("uint32_t*", ptr)[5] ~= 1 then
+			log:fatal("unsupported link layer type: %s", filename)
+		end
+		return magic == PCAP_MAGIC_US and REPLAY_PCAP_US or REPLAY_PCAP_NS, 24
+	end
+	log:fatal("not a little endian pcap or pcapng file: %s", filename)
+end
+
+--- Add a pcap or pcapng file, packets of all files are merged by their timestamps.
+--- Up to 16 files are supported, the files are mapped into memory until the replay is closed.
+--- @param range optional, only replay the packets in a range returned by pcap reader:split(),
+---   e.g., to replay a large file with multiple tasks, default: the whole file
+function replay:addFile(filename, range)
+	if #self.files >= MAX_SOURCES then
+		log:fatal("only up to %d files are supported", MAX_SOURCES)
+	end
+	local fd = S.open(filename, "rdonly")
+	if not fd then
+		log:fatal("could not open pcap file: %s", strError(S.errno()))
+	end
+	fd:nogc()
+	local size = fd:stat().size
+	local ptr = S.mmap(nil, size, "read", "private", fd, 0)
+	if not ptr then
+		log:fatal("mmap failed: %s", strError(S.errno()))
+	end
+	ptr = ffi.cast("uint8_t*", ptr)
+	local format, start = detectFormat(ptr, size, filename)
+	table.insert(self.files, {fd = fd, ptr = ptr, size = size})
+	local stop = size
+	local state
+	if range then
+		start, stop = range[1], range[2]
+		if format == REPLAY_PCAPNG and start > 0 then
+			-- interfaces defined before the range
+			state = ffi.new("struct pcapng_reader_state")
+			C.pcap_index_get_state(pcap.loadIndex(filename, ptr, size, format), start, state)
+		end
+	end
+	-- read ahead aggressively, the replay reads each file exactly once per loop
+	-- madvise() requires a page-aligned address
+	local pageStart = start - start % 4096
+	S.madvise(ptr + pageStart, stop - pageStart, "sequential")
+	S.madvise(ptr + pageStart, stop - pageStart, "willneed")
+	local rc = C.replay_add_source(self.replay, ptr, stop, start, format, state)
+	if rc == -2 then
+		log:fatal("could not add pcap file %s: mempool too small for %d files and the tx ring", filename, #self.files)
+	elseif rc ~= 0 then
+		log:fatal("could not add pcap file %s", filename)
+	end
+	return self
+end
+
+--- Scale the time between packets, e.g., 2 replays twice as fast as recorded.
+--- @param speed speed multiplier, 0 sends as fast as possible
+function replay:speed(speed)
+	C.replay_set_speed(self.replay, speed)
+	return self
+end
+
+--- Ignore the timestamps and send packets at a constant rate.
+--- @param mpps rate in Mpp/s
+function replay:fixedRate(mpps)
+	C.replay_set_rate(self.replay, mpps * 10^6)
+	return self
+end
+
+--- Replay all files multiple times, each pass starts one inter-packet gap after the end of the previous one.
+--- @param n number of passes, 0 loops forever, default: 1
+function replay:loops(n)
+	C.replay_set_loops(self.replay, n)
+	return self
+end
+
+--- Replay on a timeline shared with other replays, e.g., ranges of a file replayed by multiple tasks.
+--- By default, the first packet of this replay is sent when run() is called.
+--- @param firstNs timestamp in nanoseconds (uint64_t) that corresponds to startTsc, e.g., header.first_ts of the
+---   file's index, packets of this replay are sent at their offset to it
+--- @param startTsc optional, TSC value at which the timeline starts, default: when run() is called
+--- @param periodNs optional, length of a pass over all ranges in nanoseconds for loops,
+---   default: one inter-packet gap after the last packet of this replay
+function replay:timeBase(firstNs, startTsc, periodNs)
+	C.replay_set_time_base(self.replay, firstNs, startTsc or 0, periodNs or 0)
+	return self
+end
+
+--- Run the replay.
+--- Returns once maxPackets were sent, all files were replayed, or libmoon is stopped.
+--- Can be called repeatedly, e.g., to print statistics in between, time spent outside of run() is not caught up.
+--- @param maxPackets optional, default: unlimited
+--- @return the number of packets sent
+function replay:run(maxPackets)
+	return tonumber(C.replay_run(self.replay, maxPackets or -1ULL))
+end
+
+--- Get statistics about the replay.
+--- @return table with the fields packets, bytes, mpps, allocFailures, loops (completed passes), late (packets sent
+---   more than 1 us after their deadline), and meanLatenessNs
+function replay:getStats()
+	local stats = C.replay_get_stats(self.replay)
+	local hz = libmoon.getCyclesFrequency()
+	local packets = tonumber(stats.packets)
+	local time = tonumber(stats.last_tsc - stats.first_tsc) / hz
+	return {
+		packets = packets,
+		bytes = tonumber(stats.bytes),
+		mpps = time > 0 and packets / time / 10^6 or 0,
+		allocFailures = tonumber(stats.alloc_failures),
+		loops = tonumber(stats.loops),
+		late = tonumber(stats.late),
+		meanLatenessNs = packets > 0 and tonumber(stats.late_cycles) / packets / hz * 10^9 or 0,
+	}
+end
+
+--- Free the replay and unmap all files.
+function replay:close()
+	C.replay_free(ffi.gc(self.replay, nil))
+	self.replay = nil
+	for _, file in ipairs(self.files) do
+		S.munmap(file.ptr, file.size)
+		S.close(file.fd)
+	end
+	self.files = {}
+end
+
+return mod
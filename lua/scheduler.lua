@@ -0,0 +1,249 @@
+--- Cooperative scheduler that multiplexes many control tasks (stats, ARP, ...) on a single core.
+--- Each task is a coroutine. libmoon.sleepMillisIdle() and libmoon.sleepMicrosIdle() yield to
+--- the scheduler instead of blocking the thread when called from a scheduled coroutine.
+--- Do not use this for dataplane tasks, a task that never sleeps starves all others.
+local mod = {}
+
+local libmoon = require "libmoon"
+local log     = require "log"
+local S       = require "syscall"
+local ffi     = require "ffi"
+
+local scheduler = {}
+scheduler.__index = scheduler
+
+function mod:new()
+	return setmetatable({
+		-- binary min heap of sleeping coroutines ordered by wake up time
+		timers = {},
+		-- coroutine -> pipe, resumed once the pipe is non-empty
+		pipeWaiters = {},
+		-- coroutine -> { fd, events }, resumed once the fd is ready
+		fdWaiters = {},
+		-- coroutines that can run in this iteration
+		ready = {},
+		-- coroutine -> task name, contains all coroutines that did not finish yet
+		tasks = {},
+		numTasks = 0,
+		-- timers with the same wake up time are resumed in insertion order
+		timerSeq = 0,
+	}, scheduler)
+end
+
+local function timerLess(a, b)
+	return a.time < b.time or a.time == b.time and a.seq < b.seq
+end
+
+function scheduler:pushTimer(co, time)
+	local heap = self.timers
+	self.timerSeq = self.timerSeq + 1
+	local entry = { time = time, seq = self.timerSeq, co = co }
+	local i = #heap + 1
+	heap[i] = entry
+	while i > 1 do
+		local parent = math.floor(i / 2)
+		if not timerLess(heap[i], heap[parent]) then
+			break
+		end
+		heap[i], heap[parent] = heap[parent], heap[i]
+		i = parent
+	end
+end
+
+function scheduler:popTimer()
+	local heap = self.timers
+	local top = heap[1]
+	local last = table.remove(heap)
+	if #heap == 0 then
+		return top
+	end
+	heap[1] = last
+	local i = 1
+	local n = #heap
+	while true do
+		local l, r = i * 2, i * 2 + 1
+		local smallest = i
+		if l <= n and timerLess(heap[l], heap[smallest]) then
+			smallest = l
+		end
+		if r <= n and timerLess(heap[r], heap[smallest]) then
+			smallest = r
+		end
+		if smallest == i then
+			break
+		end
+		heap[i], heap[smallest] = heap[smallest], heap[i]
+		i = smallest
+	end
+	return top
+end
+
+--- Add a task to the scheduler.
+--- @param func the task function or the name of a global function
+--- @param ... arguments passed to the function
+function scheduler:spawn(func, ...)
+	local name = func
+	if type(func) == "string" then
+		func = _G[func]
+		if not func then
+			log:fatal("task function %s not found", name)
+		end
+	else
+		name = tostring(func)
+	end
+	local args = { n = select("#", ...), ... }
+	local co = coroutine.create(function() return func(unpack(args, 1, args.n)) end)
+	self.tasks[co] = name
+	self.numTasks = self.numTasks + 1
+	self.ready[#self.ready + 1] = co
+end
+
+--- Returns true if the caller is a coroutine managed by this scheduler.
+function scheduler:owns()
+	local co = coroutine.running()
+	return co ~= nil and self.tasks[co] ~= nil
+end
+
+--- Suspend the current task for t seconds, other tasks run in the meantime.
+function scheduler:sleep(t)
+	self:pushTimer(coroutine.running(), libmoon.getTime() + t)
+	coroutine.yield()
+end
+
+--- Suspend the current task until the (slow or fast) pipe contains at least one element.
+function scheduler:waitPipe(pipe)
+	if pipe:count() > 0 then
+		return
+	end
+	self.pipeWaiters[coroutine.running()] = pipe
+	coroutine.yield()
+end
+
+local function getFd(fd)
+	return type(fd) == "number" and fd or fd:getfd()
+end
+
+--- Suspend the current task until a file descriptor or socket is readable.
+--- @param fd file descriptor or ljsyscall fd object
+function scheduler:waitReadable(fd)
+	self.fdWaiters[coroutine.running()] = { fd = getFd(fd), events = "in" }
+	coroutine.yield()
+end
+
+--- Suspend the current task until a file descriptor or socket is writable.
+--- @param fd file descriptor or ljsyscall fd object
+function scheduler:waitWritable(fd)
+	self.fdWaiters[coroutine.running()] = { fd = getFd(fd), events = "out" }
+	coroutine.yield()
+end
+
+function scheduler:resume(co)
+	local prev = libmoon.activeScheduler
+	libmoon.activeScheduler = self
+	local ok, err = coroutine.resume(co)
+	libmoon.activeScheduler = prev
+	if not ok then
+		log:error("scheduled task %s failed: %s", self.tasks[co], debug.traceback(co, err))
+	end
+	if coroutine.status(co) == "dead" then
+		self.tasks[co] = nil
+		self.numTasks = self.numTasks - 1
+	end
+end
+
+-- waits until the next timer expires or a file descriptor becomes ready
+-- pipes have no file descriptor, so we have to wake up periodically if someone waits on a pipe
+function scheduler:idle(hasPipeWaiters)
+	local timeout = -1
+	if #self.timers > 0 then
+		timeout = math.max(0, self.timers[1].time - libmoon.getTime())
+	end
+	if hasPipeWaiters then
+		timeout = timeout < 0 and 0.00001 or math.min(timeout, 0.00001)
+	end
+	local cos, fds = {}, {}
+	for co, waiter in pairs(self.fdWaiters) do
+		cos[#cos + 1] = co
+		fds[#fds + 1] = waiter
+	end
+	if #fds == 0 then
+		if timeout < 0 then
+			-- nothing to wait for, all remaining tasks are blocked forever
+			return false
+		end
+		if timeout > 0 then
+			ffi.C.usleep(timeout * 1000000)
+		end
+		return true
+	end
+	local pollfds = S.t.pollfds(fds)
+	-- poll() takes milliseconds, round up to not wake up too early
+	local ok = S.poll(pollfds, timeout < 0 and -1 or math.ceil(timeout * 1000))
+	if ok then
+		for i, co in ipairs(cos) do
+			if pollfds[i].revents ~= 0 then
+				self.fdWaiters[co] = nil
+				self.ready[#self.ready + 1] = co
+			end
+		end
+	end
+	return true
+end
+
+--- Run all tasks until they finished.
+function scheduler:run()
+	while self.numTasks > 0 do
+		local now = libmoon.getTime()
+		while #self.timers > 0 and self.timers[1].time <= now do
+			self.ready[#self.ready + 1] = self:popTimer().co
+		end
+		local hasPipeWaiters = false
+		for co, pipe in pairs(self.pipeWaiters) do
+			if pipe:count() > 0 then
+				self.pipeWaiters[co] = nil
+				self.ready[#self.ready + 1] = co
+			else
+				hasPipeWaiters = true
+			end
+		end
+		if #self.ready > 0 then
+			local ready = self.ready
+			self.ready = {}
+			for _, co in ipairs(ready) do
+				self:resume(co)
+			end
+		elseif not self:idle(hasPipeWaiters) then
+			log:error("%d scheduled tasks are blocked forever", self.numTasks)
+			return
+		end
+	end
+end
+
+-- task started via startControlTasks(), runs all queued control tasks cooperatively
+function __LIBMOON_SCHEDULER_TASK(tasks)
+	local sched = mod:new()
+	for _, task in ipairs(tasks) do
+		sched:spawn(unpack(task, 1, task.n))
+	end
+	sched:run()
+end
+
+--- Collect shared tasks started via libmoon.startSharedTask() instead of starting them,
+--- this includes the control tasks started by stats.startStatsTask() and arp.startArpTask().
+--- Call startControlTasks() afterwards to run all of them on a single shared core.
+--- Tasks started while collecting do not return a task object.
+function mod.collectControlTasks()
+	libmoon.controlTaskQueue = {}
+end
+
+--- Start all collected control tasks in a single shared task.
+function mod.startControlTasks()
+	local tasks = libmoon.controlTaskQueue
+	libmoon.controlTaskQueue = nil
+	if not tasks or #tasks == 0 then
+		return
+	end
+	return libmoon.startSharedTask("__LIBMOON_SCHEDULER_TASK", tasks)
+end
+
+return mod
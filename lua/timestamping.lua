@@ -68,7 +68,9 @@ function timestamper:measureLatency(pktSize, packetModifier, maxWait)
 	end
 	pktSize = pktSize or self.udp and 76 or 60
 	maxWait = (maxWait or 15) / 1000
-	self.txBufs:alloc(pktSize)
+	if not self.txBufs:alloc(pktSize, maxWait * 10^6, self.txQueue) then
+		return nil, 0
+	end
 	local buf = self.txBufs[1]
 	buf:enableTimestamps()
 	local expectedSeq = self.seq
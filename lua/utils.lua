@@ -150,31 +150,17 @@ function timevalSpan(x, y)
 end
 
 
+ffi.cdef[[
+	uint16_t checksum_compute(const void* data, uint32_t len);
+]]
+
 --- Calculate a 16 bit checksum 
 --- @param data cdata to calculate the checksum for.
 --- @param len Number of bytes to calculate the checksum for.
 --- @return 16 bit integer
 function checksum(data, len)
-	data = ffi.cast("uint16_t*", data)
-	local cs = 0
-	for i = 0, len / 2 - 1 do
-		cs = cs + data[i]
-		if cs >= 2^16 then
-			cs = band(cs, 0xFFFF) + 1
-		end
-	end
-	-- missing the very last uint_8 for odd sized packets
-	-- note that this access is always valid in libmoon
-	--  * buffers are a fixed even size >= pkt len
-	--  * pkt length is just metadata and not the actual length of the buffer
-	if (len % 2) == 1 then
-		-- simply null the byte outside of our packet
-		cs = cs + band(data[len / 2], 0xFF)
-		if cs >= 2^16 then
-			cs = band(cs, 0xFFFF) + 1
-		end
-	end
-	return band(bnot(cs), 0xFFFF)
+	-- the C implementation sums in host byte order just like the old Lua loop did
+	return ffi.C.checksum_compute(data, len)
 end
 
 --- Parse a string to a MAC address
@@ -0,0 +1,296 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <rte_config.h>
+#include <rte_malloc.h>
+#include <rte_debug.h>
+#include <rte_branch_prediction.h>
+#include <rte_lcore.h>
+#include <rte_spinlock.h>
+
+#include "arena.h"
+
+// NUMA-aware slab allocator for off-heap objects created from Lua (flow tables, rings, ...)
+// memory comes from the DPDK hugepage heap of the requested socket,
+// the system allocator is used if hugepages are exhausted
+// small objects are served from size classes with a per-thread cache in front of a per-socket free list
+
+// slabs and large allocations are aligned to SLAB_SIZE and start with a header,
+// so the header of any object is found by masking its address
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_HEADER_SIZE 64
+// slabs are carved from chunks to keep the number of hugepage heap allocations low
+#define SLABS_PER_CHUNK 32
+#define ARENA_MAGIC 0x4152454E
+
+// size classes: 16 bytes to 8 KiB in powers of two
+#define MIN_CLASS_SHIFT 4
+#define NUM_CLASSES 10
+#define MAX_CLASS_SIZE (1 << (MIN_CLASS_SHIFT + NUM_CLASSES - 1))
+#define LARGE_CLASS 0xFF
+
+// objects per size class kept in a thread-local cache before returning half of them to the socket
+#define THREAD_CACHE_SIZE 64
+
+enum arena_source { SOURCE_HUGE, SOURCE_SYSTEM };
+
+struct slab_header {
+	uint32_t magic;
+	uint8_t class;
+	uint8_t source;
+	int16_t socket;
+	size_t size; // object size or size of a large allocation
+} __attribute__((aligned(SLAB_HEADER_SIZE)));
+
+struct free_obj {
+	struct free_obj* next;
+};
+
+struct central_list {
+	rte_spinlock_t lock;
+	struct free_obj* head;
+} __attribute__((aligned(64)));
+
+struct socket_arena {
+	struct central_list classes[NUM_CLASSES];
+	rte_spinlock_t chunk_lock;
+	uint8_t* chunk;
+	uint32_t chunk_slabs_left;
+	uint8_t chunk_source;
+	struct arena_stats stats;
+} __attribute__((aligned(64)));
+
+struct thread_cache {
+	struct free_obj* head;
+	uint32_t count;
+};
+
+static struct socket_arena arenas[ARENA_MAX_SOCKETS];
+static __thread struct thread_cache thread_caches[ARENA_MAX_SOCKETS][NUM_CLASSES];
+
+static inline struct slab_header* get_header(void* ptr) {
+	return (struct slab_header*) ((uintptr_t) ptr & ~((uintptr_t) SLAB_SIZE - 1));
+}
+
+// like get_header() but catches pointers that were not allocated by the arena, e.g., double frees via the wrong allocator
+static inline struct slab_header* get_checked_header(void* ptr) {
+	struct slab_header* header = get_header(ptr);
+	if (unlikely(header->magic != ARENA_MAGIC)) {
+		rte_panic("arena: %p was not allocated by arena_alloc()\n", ptr);
+	}
+	return header;
+}
+
+static inline int size_to_class(size_t size) {
+	if (size <= (1 << MIN_CLASS_SHIFT)) {
+		return 0;
+	}
+	return 64 - __builtin_clzll(size - 1) - MIN_CLASS_SHIFT;
+}
+
+// negative values select the socket of the calling thread, returns -1 for sockets the arena does not manage
+static inline int32_t resolve_socket(int32_t socket) {
+	if (socket >= ARENA_MAX_SOCKETS) {
+		return -1;
+	}
+	if (socket < 0) {
+		socket = rte_socket_id();
+		// non-EAL threads return SOCKET_ID_ANY
+		if (socket < 0 || socket >= ARENA_MAX_SOCKETS) {
+			socket = 0;
+		}
+	}
+	return socket;
+}
+
+// allocates SLAB_SIZE aligned memory from the hugepages of the socket or from the system
+static void* alloc_aligned(struct socket_arena* arena, int32_t socket, size_t size, uint8_t* source) {
+	void* mem = rte_malloc_socket("arena", size, SLAB_SIZE, socket);
+	if (mem) {
+		*source = SOURCE_HUGE;
+		__atomic_add_fetch(&arena->stats.huge_bytes, size, __ATOMIC_RELAXED);
+		return mem;
+	}
+	if (posix_memalign(&mem, SLAB_SIZE, size)) {
+		return NULL;
+	}
+	// transparent huge pages are better than nothing
+	madvise(mem, size, MADV_HUGEPAGE);
+	*source = SOURCE_SYSTEM;
+	__atomic_add_fetch(&arena->stats.fallback_bytes, size, __ATOMIC_RELAXED);
+	return mem;
+}
+
+static void free_aligned(struct socket_arena* arena, void* mem, size_t size, uint8_t source) {
+	if (source == SOURCE_HUGE) {
+		rte_free(mem);
+		__atomic_sub_fetch(&arena->stats.huge_bytes, size, __ATOMIC_RELAXED);
+	} else {
+		free(mem);
+		__atomic_sub_fetch(&arena->stats.fallback_bytes, size, __ATOMIC_RELAXED);
+	}
+}
+
+// creates a new slab and returns its objects as a list, called with the class lock held
+static struct free_obj* new_slab(struct socket_arena* arena, int32_t socket, int class, uint32_t* num) {
+	rte_spinlock_lock(&arena->chunk_lock);
+	if (!arena->chunk_slabs_left) {
+		arena->chunk = alloc_aligned(arena, socket, (size_t) SLAB_SIZE * SLABS_PER_CHUNK, &arena->chunk_source);
+		if (!arena->chunk) {
+			rte_spinlock_unlock(&arena->chunk_lock);
+			return NULL;
+		}
+		arena->chunk_slabs_left = SLABS_PER_CHUNK;
+	}
+	uint8_t* slab = arena->chunk;
+	uint8_t source = arena->chunk_source;
+	arena->chunk += SLAB_SIZE;
+	arena->chunk_slabs_left--;
+	rte_spinlock_unlock(&arena->chunk_lock);
+	__atomic_add_fetch(&arena->stats.slabs, 1, __ATOMIC_RELAXED);
+	size_t size = (size_t) 1 << (class + MIN_CLASS_SHIFT);
+	struct slab_header* header = (struct slab_header*) slab;
+	header->magic = ARENA_MAGIC;
+	header->class = class;
+	header->source = source;
+	header->socket = socket;
+	header->size = size;
+	uint32_t count = (SLAB_SIZE - SLAB_HEADER_SIZE) / size;
+	struct free_obj* head = NULL;
+	// link in reverse so that objects are handed out in address order
+	for (uint32_t i = count; i > 0; i--) {
+		struct free_obj* obj = (struct free_obj*) (slab + SLAB_HEADER_SIZE + (i - 1) * size);
+		obj->next = head;
+		head = obj;
+	}
+	*num = count;
+	return head;
+}
+
+static void* alloc_large(struct socket_arena* arena, int32_t socket, size_t size) {
+	size_t total = size + SLAB_HEADER_SIZE;
+	uint8_t source;
+	struct slab_header* header = alloc_aligned(arena, socket, total, &source);
+	if (!header) {
+		return NULL;
+	}
+	header->magic = ARENA_MAGIC;
+	header->class = LARGE_CLASS;
+	header->source = source;
+	header->socket = socket;
+	header->size = size;
+	__atomic_add_fetch(&arena->stats.large_allocs, 1, __ATOMIC_RELAXED);
+	return (uint8_t*) header + SLAB_HEADER_SIZE;
+}
+
+// moves up to n objects from the socket's free list into the thread cache
+static int refill(struct socket_arena* arena, struct thread_cache* cache, int32_t socket, int class, uint32_t n) {
+	struct central_list* list = &arena->classes[class];
+	rte_spinlock_lock(&list->lock);
+	if (!list->head) {
+		uint32_t num;
+		struct free_obj* objs = new_slab(arena, socket, class, &num);
+		if (!objs) {
+			rte_spinlock_unlock(&list->lock);
+			return -1;
+		}
+		list->head = objs;
+	}
+	for (uint32_t i = 0; i < n && list->head; i++) {
+		struct free_obj* obj = list->head;
+		list->head = obj->next;
+		obj->next = cache->head;
+		cache->head = obj;
+		cache->count++;
+	}
+	rte_spinlock_unlock(&list->lock);
+	return 0;
+}
+
+// returns the first n objects of the thread cache to the socket's free list
+static void flush(struct socket_arena* arena, struct thread_cache* cache, int class, uint32_t n) {
+	if (!n) {
+		return;
+	}
+	struct free_obj* first = cache->head;
+	struct free_obj* last = first;
+	for (uint32_t i = 1; i < n; i++) {
+		last = last->next;
+	}
+	cache->head = last->next;
+	cache->count -= n;
+	struct central_list* list = &arena->classes[class];
+	rte_spinlock_lock(&list->lock);
+	last->next = list->head;
+	list->head = first;
+	rte_spinlock_unlock(&list->lock);
+}
+
+// allocates size bytes on the given socket, -1 for the socket of the calling thread
+// the memory is not initialized, objects of up to 8 KiB are aligned to min(size class, 64) bytes
+// returns NULL if the socket is >= ARENA_MAX_SOCKETS
+void* arena_alloc(size_t size, int32_t socket) {
+	socket = resolve_socket(socket);
+	if (socket < 0) {
+		return NULL;
+	}
+	struct socket_arena* arena = &arenas[socket];
+	if (size > MAX_CLASS_SIZE) {
+		return alloc_large(arena, socket, size);
+	}
+	int class = size_to_class(size);
+	struct thread_cache* cache = &thread_caches[socket][class];
+	if (!cache->head && refill(arena, cache, socket, class, THREAD_CACHE_SIZE / 2)) {
+		return NULL;
+	}
+	struct free_obj* obj = cache->head;
+	cache->head = obj->next;
+	cache->count--;
+	return obj;
+}
+
+// objects may be freed by any thread, they are returned to the socket they were allocated on
+void arena_free(void* ptr) {
+	if (!ptr) {
+		return;
+	}
+	struct slab_header* header = get_checked_header(ptr);
+	struct socket_arena* arena = &arenas[header->socket];
+	if (header->class == LARGE_CLASS) {
+		__atomic_sub_fetch(&arena->stats.large_allocs, 1, __ATOMIC_RELAXED);
+		free_aligned(arena, header, header->size + SLAB_HEADER_SIZE, header->source);
+		return;
+	}
+	struct thread_cache* cache = &thread_caches[header->socket][header->class];
+	struct free_obj* obj = ptr;
+	obj->next = cache->head;
+	cache->head = obj;
+	if (++cache->count > THREAD_CACHE_SIZE) {
+		flush(arena, cache, header->class, THREAD_CACHE_SIZE / 2);
+	}
+}
+
+size_t arena_usable_size(void* ptr) {
+	return get_checked_header(ptr)->size;
+}
+
+int32_t arena_get_socket(void* ptr) {
+	return get_checked_header(ptr)->socket;
+}
+
+// returns all objects cached by the calling thread, should be called before a thread terminates
+void arena_flush_thread_cache() {
+	for (int socket = 0; socket < ARENA_MAX_SOCKETS; socket++) {
+		for (int class = 0; class < NUM_CLASSES; class++) {
+			struct thread_cache* cache = &thread_caches[socket][class];
+			flush(&arenas[socket], cache, class, cache->count);
+		}
+	}
+}
+
+// returns NULL if the socket is >= ARENA_MAX_SOCKETS
+struct arena_stats* arena_get_stats(int32_t socket) {
+	socket = resolve_socket(socket);
+	return socket < 0 ? NULL : &arenas[socket].stats;
+}
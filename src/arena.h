@@ -0,0 +1,31 @@
+#ifndef MG_ARENA_H
+#define MG_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ARENA_MAX_SOCKETS 8
+
+struct arena_stats {
+	uint64_t huge_bytes;     // memory taken from DPDK hugepages on this socket
+	uint64_t fallback_bytes; // memory taken from the system allocator because hugepages were exhausted
+	uint64_t slabs;
+	uint64_t large_allocs;   // currently live allocations that bypass the size classes
+};
+
+void* arena_alloc(size_t size, int32_t socket);
+void arena_free(void* ptr);
+size_t arena_usable_size(void* ptr);
+int32_t arena_get_socket(void* ptr);
+void arena_flush_thread_cache();
+struct arena_stats* arena_get_stats(int32_t socket);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,390 @@
+#include <math.h>
+#include <string.h>
+#include <rte_config.h>
+#include <rte_ethdev.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+#include <rte_cycles.h>
+#include <rte_pause.h>
+
+#include "arrival.h"
+#include "lifecycle.h"
+#include "rdtsc.h"
+
+// packet generator driven by a stochastic arrival process
+// departure times are computed ahead for a small batch of packets (the pacing queue),
+// all packets that are due are then passed to the NIC in a single tx burst
+
+// packets sent later than this after their departure time are counted as late
+#define ARRIVAL_LATE_THRESHOLD_NS 1000
+
+static inline uint64_t rotl(uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+// xoshiro256+, good enough for the upper 53 bits used for doubles
+static inline double rand_uniform(struct arrival_gen* gen) {
+	uint64_t* s = gen->rng;
+	uint64_t result = s[0] + s[3];
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return (result >> 11) * 0x1.0p-53;
+}
+
+static inline double rand_exp(struct arrival_gen* gen, double mean) {
+	return -log(1.0 - rand_uniform(gen)) * mean;
+}
+
+static inline double rand_pareto(struct arrival_gen* gen, double shape, double scale) {
+	return scale / pow(1.0 - rand_uniform(gen), 1.0 / shape);
+}
+
+static double cycles_per_us() {
+	return rte_get_tsc_hz() / 1000000.0;
+}
+
+// packets must fit into a single mbuf of the pool
+static inline int size_fits(struct arrival_gen* gen, uint16_t size) {
+	return size <= rte_pktmbuf_data_room_size(gen->pool) - RTE_PKTMBUF_HEADROOM;
+}
+
+struct arrival_gen* arrival_create(uint16_t port, uint16_t queue, struct rte_mempool* pool, int32_t socket) {
+	struct arrival_gen* gen = rte_zmalloc_socket("arrival_gen", sizeof(struct arrival_gen), RTE_CACHE_LINE_SIZE, socket);
+	if (!gen) {
+		return NULL;
+	}
+	gen->port = port;
+	gen->queue = queue;
+	gen->pool = pool;
+	gen->size_min = 60;
+	gen->size_max = 60;
+	arrival_seed(gen, read_rdtsc());
+	arrival_set_deterministic(gen, 1000000);
+	return gen;
+}
+
+// drops packets generated by the previous arrival process
+static void clear_queue(struct arrival_gen* gen) {
+	for (uint32_t i = 0; i < gen->queue_len; i++) {
+		rte_pktmbuf_free(gen->queue_pkts[gen->queue_head + i]);
+	}
+	gen->queue_len = 0;
+	gen->last_departure = 0;
+}
+
+void arrival_free(struct arrival_gen* gen) {
+	clear_queue(gen);
+	rte_free(gen->trace);
+	rte_free(gen);
+}
+
+void arrival_seed(struct arrival_gen* gen, uint64_t seed) {
+	// splitmix64 to initialize the state
+	for (int i = 0; i < 4; i++) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gen->rng[i] = z ^ (z >> 31);
+	}
+}
+
+// the setters return -1 and keep the previous process if the parameters are invalid
+int arrival_set_deterministic(struct arrival_gen* gen, double pps) {
+	if (!(pps > 0)) {
+		return -1;
+	}
+	clear_queue(gen);
+	gen->process = ARRIVAL_DETERMINISTIC;
+	gen->gap = rte_get_tsc_hz() / pps;
+	return 0;
+}
+
+int arrival_set_poisson(struct arrival_gen* gen, double pps) {
+	if (!(pps > 0)) {
+		return -1;
+	}
+	clear_queue(gen);
+	gen->process = ARRIVAL_POISSON;
+	gen->gap = rte_get_tsc_hz() / pps;
+	return 0;
+}
+
+// on and off periods are pareto distributed with the given means, shapes must be > 1
+// packets are sent at the peak rate during on periods
+int arrival_set_pareto_onoff(struct arrival_gen* gen, double peak_pps, double on_shape, double on_mean_us, double off_shape, double off_mean_us) {
+	// shapes <= 1 have an infinite mean
+	if (!(peak_pps > 0) || !(on_shape > 1) || !(off_shape > 1) || !(on_mean_us > 0) || !(off_mean_us >= 0)) {
+		return -1;
+	}
+	clear_queue(gen);
+	gen->process = ARRIVAL_PARETO_ONOFF;
+	gen->gap = rte_get_tsc_hz() / peak_pps;
+	gen->on_shape = on_shape;
+	gen->on_scale = on_mean_us * cycles_per_us() * (on_shape - 1) / on_shape;
+	gen->off_shape = off_shape;
+	gen->off_scale = off_mean_us * cycles_per_us() * (off_shape - 1) / off_shape;
+	gen->state_end = 0;
+	return 0;
+}
+
+// markov-modulated poisson process, the chain stays in state i for an exponentially distributed time with mean dwell_us[i]
+// and emits a poisson process with rate pps[i] while in this state.
+// transitions is a row-major num_states x num_states matrix, row i contains the probabilities to go from state i to state j
+int arrival_set_mmpp(struct arrival_gen* gen, uint32_t num_states, const double* pps, const double* dwell_us, const double* transitions) {
+	if (num_states == 0 || num_states > ARRIVAL_MAX_MMPP_STATES) {
+		return -1;
+	}
+	// at least one state must emit packets, otherwise the generator never finds a departure time
+	uint8_t active = 0;
+	for (uint32_t i = 0; i < num_states; i++) {
+		if (!(pps[i] >= 0) || !(dwell_us[i] > 0)) {
+			return -1;
+		}
+		active |= pps[i] > 0;
+	}
+	if (!active) {
+		return -1;
+	}
+	for (uint32_t i = 0; i < num_states; i++) {
+		gen->mmpp_gap[i] = pps[i] > 0 ? rte_get_tsc_hz() / pps[i] : INFINITY;
+		gen->mmpp_dwell[i] = dwell_us[i] * cycles_per_us();
+		double sum = 0;
+		for (uint32_t j = 0; j < num_states; j++) {
+			sum += transitions[i * num_states + j];
+		}
+		if (sum <= 0) {
+			return -1;
+		}
+		double cumulative = 0;
+		for (uint32_t j = 0; j < num_states; j++) {
+			cumulative += transitions[i * num_states + j] / sum;
+			gen->mmpp_transitions[i][j] = cumulative;
+		}
+	}
+	clear_queue(gen);
+	gen->process = ARRIVAL_MMPP;
+	gen->mmpp_states = num_states;
+	gen->mmpp_state = 0;
+	gen->state_end = 0;
+	return 0;
+}
+
+// replays the given inter-arrival times, the generator stops at the end of the trace unless loop is set
+int arrival_set_trace(struct arrival_gen* gen, const double* gaps_ns, uint32_t len, uint8_t loop) {
+	double* trace = rte_malloc_socket("arrival_trace", len * sizeof(double), 0, rte_socket_id());
+	if (!trace || !len) {
+		rte_free(trace);
+		return -1;
+	}
+	double cycles_per_ns = rte_get_tsc_hz() / 1000000000.0;
+	for (uint32_t i = 0; i < len; i++) {
+		trace[i] = gaps_ns[i] * cycles_per_ns;
+	}
+	clear_queue(gen);
+	rte_free(gen->trace);
+	gen->trace = trace;
+	gen->trace_len = len;
+	gen->trace_pos = 0;
+	gen->trace_loop = loop;
+	gen->process = ARRIVAL_TRACE;
+	return 0;
+}
+
+int arrival_set_size_uniform(struct arrival_gen* gen, uint16_t min, uint16_t max) {
+	max = max < min ? min : max;
+	if (!size_fits(gen, max)) {
+		return -1;
+	}
+	gen->num_sizes = 0;
+	gen->size_min = min;
+	gen->size_max = max;
+	return 0;
+}
+
+int arrival_set_size_weighted(struct arrival_gen* gen, uint32_t num, const uint16_t* sizes, const double* weights) {
+	if (num == 0 || num > ARRIVAL_MAX_SIZES) {
+		return -1;
+	}
+	double sum = 0;
+	for (uint32_t i = 0; i < num; i++) {
+		if (!size_fits(gen, sizes[i])) {
+			return -1;
+		}
+		sum += weights[i];
+	}
+	if (sum <= 0) {
+		return -1;
+	}
+	double cumulative = 0;
+	for (uint32_t i = 0; i < num; i++) {
+		cumulative += weights[i] / sum;
+		gen->sizes[i] = sizes[i];
+		gen->size_weights[i] = cumulative;
+	}
+	gen->num_sizes = num;
+	return 0;
+}
+
+static inline uint16_t next_size(struct arrival_gen* gen) {
+	if (gen->num_sizes) {
+		double u = rand_uniform(gen);
+		for (uint32_t i = 0; i < gen->num_sizes - 1; i++) {
+			if (u < gen->size_weights[i]) {
+				return gen->sizes[i];
+			}
+		}
+		return gen->sizes[gen->num_sizes - 1];
+	}
+	if (gen->size_min == gen->size_max) {
+		return gen->size_min;
+	}
+	return gen->size_min + (uint16_t) (rand_uniform(gen) * (gen->size_max - gen->size_min + 1));
+}
+
+// next arrival of the poisson process of an MMPP state, states without packets never emit one
+static inline double mmpp_arrival(struct arrival_gen* gen, double t, uint32_t state) {
+	return isinf(gen->mmpp_gap[state]) ? INFINITY : t + rand_exp(gen, gen->mmpp_gap[state]);
+}
+
+// returns the departure time of the packet after a packet sent at time t or a negative value at the end of a trace
+static inline double next_departure(struct arrival_gen* gen, double t) {
+	switch (gen->process) {
+		case ARRIVAL_DETERMINISTIC:
+			return t + gen->gap;
+		case ARRIVAL_POISSON:
+			return t + rand_exp(gen, gen->gap);
+		case ARRIVAL_PARETO_ONOFF: {
+			if (gen->state_end == 0) {
+				gen->state_end = t + rand_pareto(gen, gen->on_shape, gen->on_scale);
+			}
+			double next = t + gen->gap;
+			if (next > gen->state_end) {
+				next = gen->state_end + rand_pareto(gen, gen->off_shape, gen->off_scale);
+				gen->state_end = next + rand_pareto(gen, gen->on_shape, gen->on_scale);
+			}
+			return next;
+		}
+		case ARRIVAL_MMPP: {
+			if (gen->state_end == 0) {
+				gen->state_end = t + rand_exp(gen, gen->mmpp_dwell[gen->mmpp_state]);
+			}
+			// the exponential distribution is memoryless, so we can just restart at state changes
+			double next = mmpp_arrival(gen, t, gen->mmpp_state);
+			while (next > gen->state_end) {
+				double u = rand_uniform(gen);
+				uint32_t state = 0;
+				while (state < gen->mmpp_states - 1 && u >= gen->mmpp_transitions[gen->mmpp_state][state]) {
+					state++;
+				}
+				gen->mmpp_state = state;
+				next = mmpp_arrival(gen, gen->state_end, state);
+				gen->state_end += rand_exp(gen, gen->mmpp_dwell[state]);
+			}
+			return next;
+		}
+		case ARRIVAL_TRACE:
+			if (gen->trace_pos >= gen->trace_len) {
+				if (!gen->trace_loop) {
+					return -1;
+				}
+				gen->trace_pos = 0;
+			}
+			return t + gen->trace[gen->trace_pos++];
+		default:
+			return -1;
+	}
+}
+
+// fills the empty pacing queue with up to n packets
+// returns 0 if the arrival process ended, a failed allocation is retried by the caller
+static uint32_t refill(struct arrival_gen* gen, uint32_t n) {
+	if (rte_pktmbuf_alloc_bulk(gen->pool, gen->queue_pkts, n) != 0) {
+		gen->stats.alloc_failures++;
+		return 1;
+	}
+	gen->queue_head = 0;
+	uint32_t i;
+	for (i = 0; i < n; i++) {
+		double departure = next_departure(gen, gen->last_departure);
+		if (departure < 0) {
+			break;
+		}
+		gen->last_departure = departure;
+		uint16_t size = next_size(gen);
+		gen->queue_pkts[i]->pkt_len = size;
+		gen->queue_pkts[i]->data_len = size;
+		gen->queue_departures[i] = (uint64_t) departure;
+	}
+	for (uint32_t j = i; j < n; j++) {
+		rte_pktmbuf_free(gen->queue_pkts[j]);
+	}
+	gen->queue_len = i;
+	return i;
+}
+
+// generates packets until max_pkts were generated, max_seconds passed (0 for no limit), the trace ended, or libmoon is stopped
+// can be called repeatedly, the arrival process continues where it stopped
+// returns the number of packets sent
+uint64_t arrival_run(struct arrival_gen* gen, uint64_t max_pkts, double max_seconds) {
+	uint64_t start = read_rdtsc();
+	uint64_t end = max_seconds > 0 ? start + (uint64_t) (max_seconds * rte_get_tsc_hz()) : UINT64_MAX;
+	uint64_t late_threshold = rte_get_tsc_hz() / 1000000000.0 * ARRIVAL_LATE_THRESHOLD_NS;
+	uint64_t generated = gen->queue_len;
+	uint64_t sent = 0;
+	if (gen->last_departure < start && !gen->queue_len) {
+		// do not try to catch up with the time spent outside of this function
+		gen->last_departure = start;
+	}
+	if (!gen->stats.first_tsc) {
+		gen->stats.first_tsc = start;
+	}
+	while (libmoon_is_running()) {
+		if (!gen->queue_len) {
+			if (generated >= max_pkts) {
+				break;
+			}
+			uint64_t n = max_pkts - generated;
+			if (!refill(gen, n < ARRIVAL_QUEUE_SIZE ? n : ARRIVAL_QUEUE_SIZE)) {
+				break;
+			}
+			generated += gen->queue_len;
+			continue;
+		}
+		uint64_t now = read_rdtsc();
+		uint32_t head = gen->queue_head;
+		if (gen->queue_departures[head] > end) {
+			break;
+		}
+		uint32_t due = 0;
+		while (due < gen->queue_len && gen->queue_departures[head + due] <= now) {
+			due++;
+		}
+		if (!due) {
+			rte_pause();
+			continue;
+		}
+		uint32_t tx = rte_eth_tx_burst(gen->port, gen->queue, gen->queue_pkts + head, due);
+		for (uint32_t i = 0; i < tx; i++) {
+			uint64_t lateness = now - gen->queue_departures[head + i];
+			gen->stats.late_cycles += lateness;
+			gen->stats.late += lateness > late_threshold;
+			gen->stats.bytes += gen->queue_pkts[head + i]->pkt_len;
+		}
+		gen->queue_head += tx;
+		gen->queue_len -= tx;
+		gen->stats.packets += tx;
+		gen->stats.last_tsc = now;
+		sent += tx;
+	}
+	return sent;
+}
+
+struct arrival_stats* arrival_get_stats(struct arrival_gen* gen) {
+	return &gen->stats;
+}
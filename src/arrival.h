@@ -0,0 +1,103 @@
+#ifndef MG_ARRIVAL_H
+#define MG_ARRIVAL_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum arrival_process {
+	ARRIVAL_DETERMINISTIC = 0,
+	ARRIVAL_POISSON = 1,
+	ARRIVAL_PARETO_ONOFF = 2,
+	ARRIVAL_MMPP = 3,
+	ARRIVAL_TRACE = 4,
+};
+
+#define ARRIVAL_MAX_MMPP_STATES 8
+#define ARRIVAL_MAX_SIZES 16
+// number of packets generated ahead of time
+#define ARRIVAL_QUEUE_SIZE 64
+
+struct arrival_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	// failed allocations, the generator retries until the pool has free buffers
+	uint64_t alloc_failures;
+	// packets sent after their departure time
+	uint64_t late;
+	// sum of the lateness of all packets in cycles
+	uint64_t late_cycles;
+	uint64_t first_tsc;
+	uint64_t last_tsc;
+};
+
+// traffic generator for a single tx queue, not thread-safe
+// all times are stored in TSC cycles
+struct arrival_gen {
+	uint16_t port;
+	uint16_t queue;
+	uint32_t process;
+	struct rte_mempool* pool;
+	// xoshiro256+ state
+	uint64_t rng[4];
+	// deterministic/poisson: mean gap; pareto on/off: gap during the on period
+	double gap;
+	// pareto on/off
+	double on_shape;
+	double on_scale;
+	double off_shape;
+	double off_scale;
+	// end of the current on period (pareto) or state (mmpp)
+	double state_end;
+	// mmpp
+	uint32_t mmpp_states;
+	uint32_t mmpp_state;
+	double mmpp_gap[ARRIVAL_MAX_MMPP_STATES];
+	double mmpp_dwell[ARRIVAL_MAX_MMPP_STATES];
+	// cumulative transition probabilities per state
+	double mmpp_transitions[ARRIVAL_MAX_MMPP_STATES][ARRIVAL_MAX_MMPP_STATES];
+	// trace replay
+	double* trace;
+	uint32_t trace_len;
+	uint32_t trace_pos;
+	uint8_t trace_loop;
+	// packet sizes, drawn uniformly from [min, max] if num_sizes is 0
+	uint32_t num_sizes;
+	uint16_t size_min;
+	uint16_t size_max;
+	uint16_t sizes[ARRIVAL_MAX_SIZES];
+	// cumulative weights
+	double size_weights[ARRIVAL_MAX_SIZES];
+	// departure time of the last generated packet
+	double last_departure;
+	// pacing queue: generated packets and their departure times
+	uint32_t queue_head;
+	uint32_t queue_len;
+	struct rte_mbuf* queue_pkts[ARRIVAL_QUEUE_SIZE];
+	uint64_t queue_departures[ARRIVAL_QUEUE_SIZE];
+	struct arrival_stats stats;
+};
+
+struct arrival_gen* arrival_create(uint16_t port, uint16_t queue, struct rte_mempool* pool, int32_t socket);
+void arrival_free(struct arrival_gen* gen);
+void arrival_seed(struct arrival_gen* gen, uint64_t seed);
+int arrival_set_deterministic(struct arrival_gen* gen, double pps);
+int arrival_set_poisson(struct arrival_gen* gen, double pps);
+int arrival_set_pareto_onoff(struct arrival_gen* gen, double peak_pps, double on_shape, double on_mean_us, double off_shape, double off_mean_us);
+int arrival_set_mmpp(struct arrival_gen* gen, uint32_t num_states, const double* pps, const double* dwell_us, const double* transitions);
+int arrival_set_trace(struct arrival_gen* gen, const double* gaps_ns, uint32_t len, uint8_t loop);
+int arrival_set_size_uniform(struct arrival_gen* gen, uint16_t min, uint16_t max);
+int arrival_set_size_weighted(struct arrival_gen* gen, uint32_t num, const uint16_t* sizes, const double* weights);
+uint64_t arrival_run(struct arrival_gen* gen, uint64_t max_pkts, double max_seconds);
+struct arrival_stats* arrival_get_stats(struct arrival_gen* gen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,244 @@
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+#include <rte_config.h>
+#include <rte_byteorder.h>
+#include <rte_mbuf.h>
+
+#include "checksum.h"
+
+// software internet checksums (RFC 1071) for NICs and vdevs without checksum offloading
+// the one's complement sum is independent of the byte order, so everything is summed in host order
+// and the result is stored without swapping
+
+#define PROTO_ICMP 1
+#define PROTO_TCP 6
+#define PROTO_UDP 17
+#define PROTO_ICMPV6 58
+
+static inline uint64_t hsum_32(const uint32_t* lanes, int n) {
+	uint64_t sum = 0;
+	for (int i = 0; i < n; i++) {
+		sum += lanes[i];
+	}
+	return sum;
+}
+
+// returns the unfolded sum of data as 16 bit words
+uint32_t checksum_partial(const void* data, uint32_t len, uint32_t initial) {
+	const uint8_t* p = data;
+	uint64_t sum = initial;
+#ifdef __AVX2__
+	{
+		const __m256i mask = _mm256_set1_epi32(0xFFFF);
+		while (len >= 32) {
+			__m256i acc = _mm256_setzero_si256();
+			// every lane grows by at most 2 * 0xFFFF per iteration, fold before it overflows
+			uint32_t blocks = len / 32 < 16384 ? len / 32 : 16384;
+			for (uint32_t i = 0; i < blocks; i++) {
+				__m256i v = _mm256_loadu_si256((const __m256i*) p);
+				acc = _mm256_add_epi32(acc, _mm256_and_si256(v, mask));
+				acc = _mm256_add_epi32(acc, _mm256_srli_epi32(v, 16));
+				p += 32;
+			}
+			len -= blocks * 32;
+			uint32_t lanes[8];
+			_mm256_storeu_si256((__m256i*) lanes, acc);
+			sum += hsum_32(lanes, 8);
+		}
+	}
+#endif
+	{
+		const __m128i mask = _mm_set1_epi32(0xFFFF);
+		while (len >= 16) {
+			__m128i acc = _mm_setzero_si128();
+			uint32_t blocks = len / 16 < 16384 ? len / 16 : 16384;
+			for (uint32_t i = 0; i < blocks; i++) {
+				__m128i v = _mm_loadu_si128((const __m128i*) p);
+				acc = _mm_add_epi32(acc, _mm_and_si128(v, mask));
+				acc = _mm_add_epi32(acc, _mm_srli_epi32(v, 16));
+				p += 16;
+			}
+			len -= blocks * 16;
+			uint32_t lanes[4];
+			_mm_storeu_si128((__m128i*) lanes, acc);
+			sum += hsum_32(lanes, 4);
+		}
+	}
+	while (len >= 2) {
+		uint16_t word;
+		memcpy(&word, p, 2);
+		sum += word;
+		p += 2;
+		len -= 2;
+	}
+	if (len) {
+		// pad with a zero byte
+		uint16_t word = 0;
+		memcpy(&word, p, 1);
+		sum += word;
+	}
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	return sum;
+}
+
+uint16_t checksum_fold(uint32_t sum) {
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return sum;
+}
+
+// returns the complemented checksum of data, ready to be stored
+uint16_t checksum_compute(const void* data, uint32_t len) {
+	return ~checksum_fold(checksum_partial(data, len, 0));
+}
+
+// computes and sets the checksum of the IPv4 header (including options) starting at data + l2_len
+// returns -1 if this is not an IPv4 packet or if the header does not fit into data_len
+int checksum_packet_ipv4(uint8_t* data, uint32_t l2_len, uint32_t data_len) {
+	if (l2_len + 20 > data_len) {
+		return -1;
+	}
+	uint8_t* ip = data + l2_len;
+	if ((ip[0] >> 4) != 4) {
+		return -1;
+	}
+	uint32_t ihl = (ip[0] & 0xF) * 4;
+	if (ihl < 20 || l2_len + ihl > data_len) {
+		return -1;
+	}
+	memset(ip + 10, 0, 2);
+	uint16_t csum = checksum_compute(ip, ihl);
+	memcpy(ip + 10, &csum, 2);
+	return 0;
+}
+
+// pseudo header sum in host order
+static inline uint32_t pseudo_header_sum(const uint8_t* src, const uint8_t* dst, uint32_t addr_len, uint8_t proto, uint32_t l4_len) {
+	uint32_t sum = checksum_partial(src, addr_len, 0);
+	sum = checksum_partial(dst, addr_len, sum);
+	uint16_t words[2] = { rte_cpu_to_be_16(proto), rte_cpu_to_be_16(l4_len) };
+	return checksum_partial(words, 4, sum);
+}
+
+// folded but not complemented pseudo header sum for the IPv4 or IPv6 header at ip
+// this is what NICs expect in the L4 checksum field when offloading L4 checksums
+uint16_t checksum_pseudo_header(const uint8_t* ip, uint8_t proto, uint32_t l4_len) {
+	if ((ip[0] >> 4) == 4) {
+		return checksum_fold(pseudo_header_sum(ip + 12, ip + 16, 4, proto, l4_len));
+	}
+	return checksum_fold(pseudo_header_sum(ip + 8, ip + 24, 16, proto, l4_len));
+}
+
+// computes and sets the UDP, TCP, or ICMP(v6) checksum of a packet with an IPv4 or IPv6 header at data + l2_len
+// IPv6 extension headers are not supported, data_len is used to check the length fields
+// returns -1 if the packet is not supported
+int checksum_packet_l4(uint8_t* data, uint32_t l2_len, uint32_t data_len) {
+	if (l2_len + 1 > data_len) {
+		return -1;
+	}
+	uint8_t* ip = data + l2_len;
+	uint8_t version = ip[0] >> 4;
+	uint8_t proto;
+	uint8_t* l4;
+	uint32_t l4_len;
+	uint32_t sum;
+	if (version == 4) {
+		uint32_t ihl = (ip[0] & 0xF) * 4;
+		if (ihl < 20 || l2_len + ihl > data_len) {
+			return -1;
+		}
+		uint16_t total_len;
+		memcpy(&total_len, ip + 2, 2);
+		total_len = rte_be_to_cpu_16(total_len);
+		proto = ip[9];
+		l4 = ip + ihl;
+		l4_len = total_len - ihl;
+		if (total_len < ihl || l2_len + total_len > data_len) {
+			return -1;
+		}
+		// ICMP over IPv4 has no pseudo header
+		sum = proto == PROTO_ICMP ? 0 : pseudo_header_sum(ip + 12, ip + 16, 4, proto, l4_len);
+	} else if (version == 6) {
+		uint16_t payload_len;
+		memcpy(&payload_len, ip + 4, 2);
+		l4_len = rte_be_to_cpu_16(payload_len);
+		proto = ip[6];
+		l4 = ip + 40;
+		if (l2_len + 40 + l4_len > data_len) {
+			return -1;
+		}
+		sum = pseudo_header_sum(ip + 8, ip + 24, 16, proto, l4_len);
+	} else {
+		return -1;
+	}
+	uint32_t csum_offset;
+	switch (proto) {
+		case PROTO_UDP:
+			csum_offset = 6;
+			break;
+		case PROTO_TCP:
+			csum_offset = 16;
+			break;
+		case PROTO_ICMP:
+		case PROTO_ICMPV6:
+			csum_offset = 2;
+			break;
+		default:
+			return -1;
+	}
+	if (l4_len < csum_offset + 2) {
+		return -1;
+	}
+	memset(l4 + csum_offset, 0, 2);
+	uint16_t csum = ~checksum_fold(checksum_partial(l4, l4_len, sum));
+	// 0 means "no checksum" for UDP
+	if (proto == PROTO_UDP && csum == 0) {
+		csum = 0xFFFF;
+	}
+	memcpy(l4 + csum_offset, &csum, 2);
+	return 0;
+}
+
+// calculates checksums for a burst of packets
+// l2_len is the length of the L2 header, 0 to use the l2_len field of each mbuf
+// flags: CHECKSUM_IP for IPv4 header checksums, CHECKSUM_L4 for UDP/TCP/ICMP checksums
+// only the outer headers of tunneled packets are handled
+void checksum_burst(struct rte_mbuf** bufs, uint32_t n, uint32_t l2_len, uint32_t flags) {
+	for (uint32_t i = 0; i < n; i++) {
+		struct rte_mbuf* buf = bufs[i];
+		uint8_t* data = rte_pktmbuf_mtod(buf, uint8_t*);
+		uint32_t len = l2_len;
+		if (!len) {
+			len = RTE_ETH_IS_TUNNEL_PKT(buf->packet_type) ? buf->outer_l2_len : buf->l2_len;
+		}
+		if (flags & CHECKSUM_IP) {
+			checksum_packet_ipv4(data, len, buf->data_len);
+		}
+		if (flags & CHECKSUM_L4) {
+			checksum_packet_l4(data, len, buf->data_len);
+		}
+	}
+}
+
+// incremental updates according to RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m')
+// all values must be in the same byte order as the checksum
+
+uint16_t checksum_update16(uint16_t csum, uint16_t old_val, uint16_t new_val) {
+	uint32_t sum = (uint16_t) ~csum + (uint16_t) ~old_val + new_val;
+	return ~checksum_fold(sum);
+}
+
+uint16_t checksum_update32(uint16_t csum, uint32_t old_val, uint32_t new_val) {
+	uint32_t sum = (uint16_t) ~csum
+		+ (uint16_t) ~(old_val & 0xFFFF) + (uint16_t) ~(old_val >> 16)
+		+ (new_val & 0xFFFF) + (new_val >> 16);
+	return ~checksum_fold(sum);
+}
+
+// update for a modified field of even length starting at an even offset
+uint16_t checksum_update(uint16_t csum, const void* old_data, const void* new_data, uint32_t len) {
+	uint32_t sum = (uint16_t) ~csum + (uint16_t) ~checksum_fold(checksum_partial(old_data, len, 0));
+	return ~checksum_fold(checksum_partial(new_data, len, sum));
+}
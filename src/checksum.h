@@ -0,0 +1,32 @@
+#ifndef MG_CHECKSUM_H
+#define MG_CHECKSUM_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// flags for checksum_burst()
+#define CHECKSUM_IP 1
+#define CHECKSUM_L4 2
+
+// all sums are in memory byte order, i.e., the folded and complemented result can be stored directly
+uint32_t checksum_partial(const void* data, uint32_t len, uint32_t sum);
+uint16_t checksum_fold(uint32_t sum);
+uint16_t checksum_compute(const void* data, uint32_t len);
+uint16_t checksum_pseudo_header(const uint8_t* ip, uint8_t proto, uint32_t l4_len);
+int checksum_packet_ipv4(uint8_t* data, uint32_t l2_len, uint32_t data_len);
+int checksum_packet_l4(uint8_t* data, uint32_t l2_len, uint32_t data_len);
+void checksum_burst(struct rte_mbuf** bufs, uint32_t n, uint32_t l2_len, uint32_t flags);
+uint16_t checksum_update16(uint16_t csum, uint16_t old_val, uint16_t new_val);
+uint16_t checksum_update32(uint16_t csum, uint32_t old_val, uint32_t new_val);
+uint16_t checksum_update(uint16_t csum, const void* old_data, const void* new_data, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,3 +8,8 @@
 #ifndef LIBMOON_LUA_MAIN_MODULE
 #define LIBMOON_LUA_MAIN_MODULE "main"
 #endif
+
+// cache the bytecode of Lua modules loaded via require() and share it between tasks
+#ifndef LIBMOON_BYTECODE_CACHE
+#define LIBMOON_BYTECODE_CACHE 1
+#endif
@@ -0,0 +1,283 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <rte_config.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_spinlock.h>
+
+#include "flightrec.h"
+#include "pcap.h"
+
+// the ring must hold a few maximum size records
+#define FLIGHTREC_MIN_SIZE (1024 * 1024)
+#define FLIGHTREC_MAX_CAP_LEN 65535
+// dumps are written through a buffer of this size
+#define FLIGHTREC_DUMP_BUF_SIZE (4 * 1024 * 1024)
+
+static inline uint64_t record_size(uint32_t cap_len) {
+	return (sizeof(struct flightrec_record) + cap_len + 15) & ~15ULL;
+}
+
+static inline struct flightrec_record* record_at(struct flightrec* rec, uint64_t pos) {
+	return (struct flightrec_record*) (rec->ring + pos % rec->size);
+}
+
+// size of the record at pos, padding records fill the ring up to its end
+static inline uint64_t size_at(struct flightrec* rec, uint64_t pos, uint32_t cap_len) {
+	return cap_len == FLIGHTREC_PADDING ? rec->size - pos % rec->size : record_size(cap_len);
+}
+
+// size: capacity of the ring in bytes, i.e., how much traffic is retained
+// start_ns: added to relative timestamps
+struct flightrec* flightrec_create(uint64_t size, uint64_t start_ns, int32_t socket) {
+	size = (size < FLIGHTREC_MIN_SIZE ? FLIGHTREC_MIN_SIZE : size) & ~15ULL;
+	struct flightrec* rec = rte_zmalloc_socket("flightrec", sizeof(struct flightrec), RTE_CACHE_LINE_SIZE, socket);
+	if (!rec) {
+		return NULL;
+	}
+	// records are scattered over the whole ring, huge pages keep the TLB misses low
+	rec->ring = rte_malloc_socket("flightrec_ring", size, RTE_CACHE_LINE_SIZE, socket);
+	if (!rec->ring) {
+		rte_free(rec);
+		return NULL;
+	}
+	rec->size = size;
+	rec->start_ns = start_ns;
+	rte_spinlock_init(&rec->trigger.lock);
+	return rec;
+}
+
+void flightrec_free(struct flightrec* rec) {
+	rte_free(rec->ring);
+	rte_free(rec);
+}
+
+// limits the age of retained records, 0 keeps records until they are overwritten
+// must be called before capturing starts or from the capture thread
+void flightrec_set_max_age(struct flightrec* rec, uint64_t max_age_ns) {
+	rec->max_age_ns = max_age_ns;
+	rec->tail_ts = 0;
+}
+
+// evicts the oldest records until end - tail fits into the ring
+static inline void make_room(struct flightrec* rec, uint64_t end) {
+	uint64_t tail = rec->tail;
+	if (end - tail <= rec->size) {
+		return;
+	}
+	while (end - tail > rec->size) {
+		uint32_t cap_len = record_at(rec, tail)->cap_len;
+		tail += size_at(rec, tail, cap_len);
+		rec->stats.evicted += cap_len != FLIGHTREC_PADDING;
+	}
+	// a dump that observes the overwritten data also observes the new tail
+	__atomic_store_n(&rec->tail, tail, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// drops records older than ts_ns - max_age_ns from the tail, stops at the first record that is recent enough
+// tail_ts is only updated here, make_room() may leave it older than the tail which just causes another check
+static void expire(struct flightrec* rec, uint64_t ts_ns) {
+	uint64_t min_ts = ts_ns - rec->max_age_ns;
+	uint64_t tail = rec->tail;
+	uint64_t head = rec->head;
+	rec->tail_ts = ts_ns;
+	while (tail != head) {
+		struct flightrec_record* record = record_at(rec, tail);
+		if (record->cap_len != FLIGHTREC_PADDING) {
+			if (record->ts_ns >= min_ts) {
+				rec->tail_ts = record->ts_ns;
+				break;
+			}
+			rec->stats.expired++;
+		}
+		tail += size_at(rec, tail, record->cap_len);
+	}
+	if (tail != rec->tail) {
+		__atomic_store_n(&rec->tail, tail, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+}
+
+static inline void write_record(struct flightrec* rec, const void* data, uint32_t len, uint32_t orig_len, uint64_t ts_ns) {
+	len = RTE_MIN(len, FLIGHTREC_MAX_CAP_LEN);
+	if (rec->max_age_ns && ts_ns > rec->max_age_ns && ts_ns - rec->max_age_ns > rec->tail_ts) {
+		expire(rec, ts_ns);
+	}
+	uint64_t size = record_size(len);
+	uint64_t head = rec->head;
+	uint64_t space = rec->size - head % rec->size;
+	if (space < size) {
+		make_room(rec, head + space);
+		record_at(rec, head)->cap_len = FLIGHTREC_PADDING;
+		head += space;
+	}
+	make_room(rec, head + size);
+	struct flightrec_record* record = record_at(rec, head);
+	record->ts_ns = ts_ns;
+	record->cap_len = len;
+	record->orig_len = orig_len;
+	memcpy(record->data, data, len);
+	__atomic_store_n(&rec->last_ts, ts_ns, __ATOMIC_RELAXED);
+	rec->stats.packets++;
+	rec->stats.bytes += len;
+	__atomic_store_n(&rec->head, head + size, __ATOMIC_RELEASE);
+}
+
+// records a packet, the timestamp is relative to start_ns
+void flightrec_write(struct flightrec* rec, const void* data, uint32_t len, uint32_t orig_len, uint64_t ts_ns) {
+	write_record(rec, data, len, orig_len, rec->start_ns + ts_ns);
+}
+
+// records a burst of packets with the same timestamp relative to start_ns, packets are truncated to snap_len
+void flightrec_write_burst(struct flightrec* rec, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t snap_len, uint64_t ts_ns) {
+	ts_ns += rec->start_ns;
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		struct rte_mbuf* buf = bufs[i];
+		write_record(rec, rte_pktmbuf_mtod(buf, void*), RTE_MIN(buf->data_len, snap_len), buf->pkt_len, ts_ns);
+	}
+}
+
+// requests a dump of [ts_ns - before_ns, ts_ns + after_ns], timestamps are relative to start_ns
+// can be called from any thread
+void flightrec_trigger(struct flightrec* rec, uint64_t ts_ns, uint64_t before_ns, uint64_t after_ns) {
+	ts_ns += rec->start_ns;
+	uint64_t start = ts_ns > before_ns ? ts_ns - before_ns : 0;
+	uint64_t end = ts_ns + after_ns;
+	rte_spinlock_lock(&rec->trigger.lock);
+	if (rec->trigger.seq != rec->trigger.consumed) {
+		start = RTE_MIN(start, rec->trigger.start_ns);
+		end = RTE_MAX(end, rec->trigger.end_ns);
+	}
+	rec->trigger.start_ns = start;
+	rec->trigger.end_ns = end;
+	__atomic_store_n(&rec->trigger.seq, rec->trigger.seq + 1, __ATOMIC_RELEASE);
+	rte_spinlock_unlock(&rec->trigger.lock);
+}
+
+// returns 1 and the window relative to start_ns if a triggered window is complete, i.e., now_ns (relative) or the
+// newest captured packet is past the end of the window
+uint8_t flightrec_poll_trigger(struct flightrec* rec, uint64_t now_ns, uint64_t* start_ns, uint64_t* end_ns) {
+	if (__atomic_load_n(&rec->trigger.seq, __ATOMIC_ACQUIRE) == rec->trigger.consumed) {
+		return 0;
+	}
+	uint8_t due = 0;
+	rte_spinlock_lock(&rec->trigger.lock);
+	uint64_t now = RTE_MAX(rec->start_ns + now_ns, __atomic_load_n(&rec->last_ts, __ATOMIC_RELAXED));
+	if (rec->trigger.end_ns <= now) {
+		*start_ns = rec->trigger.start_ns > rec->start_ns ? rec->trigger.start_ns - rec->start_ns : 0;
+		*end_ns = rec->trigger.end_ns - rec->start_ns;
+		rec->trigger.consumed = rec->trigger.seq;
+		due = 1;
+	}
+	rte_spinlock_unlock(&rec->trigger.lock);
+	return due;
+}
+
+static int flush(int fd, const uint8_t* buf, uint32_t len) {
+	while (len) {
+		ssize_t res = write(fd, buf, len);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += res;
+		len -= res;
+	}
+	return 0;
+}
+
+// writes all retained packets in [start_ns, end_ns] (relative to start_ns) to a pcap or pcapng file
+// runs concurrently with the capture thread, packets overwritten while dumping are skipped
+// returns the number of packets written or -1 and sets errno on failure
+int64_t flightrec_dump(struct flightrec* rec, const char* filename, uint32_t format, uint64_t start_ns, uint64_t end_ns) {
+	start_ns += rec->start_ns;
+	// UINT64_MAX selects everything up to the newest packet
+	end_ns = end_ns > UINT64_MAX - rec->start_ns ? UINT64_MAX : end_ns + rec->start_ns;
+	uint8_t* buf = malloc(FLIGHTREC_DUMP_BUF_SIZE);
+	if (!buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+	int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+	if (fd < 0) {
+		int err = errno;
+		free(buf);
+		errno = err;
+		return -1;
+	}
+	uint32_t fill;
+	if (format == FLIGHTREC_PCAPNG) {
+		fill = libmoon_write_pcapng_shb(buf);
+		fill += libmoon_write_pcapng_idb(buf + fill, "flightrec", 9, 1, 0);
+	} else {
+		fill = libmoon_write_pcap_header(buf);
+	}
+	int64_t written = 0;
+	// records after head are written after the dump started and not included
+	uint64_t head = __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE);
+	uint64_t pos = __atomic_load_n(&rec->tail, __ATOMIC_ACQUIRE);
+	int failed = 0;
+	while (pos < head && !failed) {
+		struct flightrec_record* record = record_at(rec, pos);
+		struct flightrec_record header = *record;
+		// the record is valid if it was not evicted before reading it
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		uint64_t tail = __atomic_load_n(&rec->tail, __ATOMIC_RELAXED);
+		if (tail > pos) {
+			rec->stats.dump_overruns++;
+			pos = tail;
+			continue;
+		}
+		uint64_t size = size_at(rec, pos, header.cap_len);
+		if (header.cap_len == FLIGHTREC_PADDING || header.ts_ns < start_ns || header.ts_ns > end_ns) {
+			pos += size;
+			continue;
+		}
+		uint32_t len = RTE_MIN(header.cap_len, FLIGHTREC_MAX_CAP_LEN);
+		if (fill + len + 64 > FLIGHTREC_DUMP_BUF_SIZE) {
+			failed = flush(fd, buf, fill);
+			fill = 0;
+		}
+		uint32_t out_len;
+		if (format == FLIGHTREC_PCAPNG) {
+			out_len = libmoon_write_pcapng(buf + fill, record->data, len, header.orig_len, 0, header.ts_ns);
+		} else {
+			libmoon_write_pcap((struct pcapRecHeader*) (buf + fill), record->data, len, header.orig_len, header.ts_ns / 1000000000, header.ts_ns % 1000000000 / 1000);
+			out_len = sizeof(struct pcapRecHeader) + len;
+		}
+		// the copy is only committed if the data was not overwritten while copying
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&rec->tail, __ATOMIC_RELAXED);
+		if (tail > pos) {
+			rec->stats.dump_overruns++;
+			pos = tail;
+			continue;
+		}
+		fill += out_len;
+		written++;
+		pos += size;
+	}
+	if (!failed) {
+		failed = flush(fd, buf, fill);
+	}
+	int err = errno;
+	close(fd);
+	free(buf);
+	rec->stats.dumps++;
+	rec->stats.dumped_packets += written;
+	if (failed) {
+		errno = err;
+		return -1;
+	}
+	return written;
+}
+
+struct flightrec_stats* flightrec_get_stats(struct flightrec* rec) {
+	return &rec->stats;
+}
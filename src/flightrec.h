@@ -0,0 +1,88 @@
+#ifndef MG_FLIGHTREC_H
+#define MG_FLIGHTREC_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+#include <rte_spinlock.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum flightrec_format {
+	FLIGHTREC_PCAP = 0,
+	FLIGHTREC_PCAPNG = 1,
+};
+
+// header of a record in the ring, followed by the packet data padded to 16 bytes
+struct flightrec_record {
+	uint64_t ts_ns;
+	uint32_t cap_len;
+	uint32_t orig_len;
+	uint8_t data[];
+};
+
+// cap_len of the record filling the end of the ring if the next record does not fit
+#define FLIGHTREC_PADDING UINT32_MAX
+
+struct flightrec_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	// records overwritten by newer ones
+	uint64_t evicted;
+	// records dropped because they were older than the maximum age
+	uint64_t expired;
+	uint64_t dumps;
+	uint64_t dumped_packets;
+	// records overwritten while being dumped, the ring is too small for the dump window
+	uint64_t dump_overruns;
+};
+
+// window to dump, triggers that fire before the previous window was dumped extend it
+struct flightrec_trigger {
+	rte_spinlock_t lock;
+	// incremented on every trigger, the window is pending while seq != consumed
+	uint64_t seq;
+	uint64_t consumed;
+	uint64_t start_ns;
+	uint64_t end_ns;
+};
+
+// flight recorder: continuously captures packets into a ring on huge pages, overwriting the oldest packets
+// written by a single capture thread, dumped by another thread
+// positions are monotonic byte counts, the offset in the ring is position % size
+struct flightrec {
+	// next record is written here, only written by the capture thread
+	uint64_t head __attribute__((aligned(64)));
+	// oldest record that is not overwritten, only written by the capture thread
+	uint64_t tail;
+	// timestamp of the newest record
+	uint64_t last_ts;
+	// timestamp of the oldest record or older, only used if max_age_ns is set
+	uint64_t tail_ts;
+	// records older than this relative to the newest record are dropped, 0 to only evict when the ring is full
+	uint64_t max_age_ns;
+	struct flightrec_stats stats;
+	// written by other threads
+	struct flightrec_trigger trigger __attribute__((aligned(64)));
+	uint64_t size;
+	uint64_t start_ns;
+	uint8_t* ring;
+};
+
+struct flightrec* flightrec_create(uint64_t size, uint64_t start_ns, int32_t socket);
+void flightrec_free(struct flightrec* rec);
+void flightrec_set_max_age(struct flightrec* rec, uint64_t max_age_ns);
+void flightrec_write(struct flightrec* rec, const void* data, uint32_t len, uint32_t orig_len, uint64_t ts_ns);
+void flightrec_write_burst(struct flightrec* rec, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t snap_len, uint64_t ts_ns);
+void flightrec_trigger(struct flightrec* rec, uint64_t ts_ns, uint64_t before_ns, uint64_t after_ns);
+uint8_t flightrec_poll_trigger(struct flightrec* rec, uint64_t now_ns, uint64_t* start_ns, uint64_t* end_ns);
+int64_t flightrec_dump(struct flightrec* rec, const char* filename, uint32_t format, uint64_t start_ns, uint64_t end_ns);
+struct flightrec_stats* flightrec_get_stats(struct flightrec* rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
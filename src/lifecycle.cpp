@@ -8,20 +8,28 @@
 
 #include "lifecycle.hpp"
 
+struct libmoon_run_state libmoon_run_state = { LIBMOON_RUN_FOREVER, 0 };
+
 namespace libmoon {
-	// this code is, strictly speaking, incorrect as there are no memory fences
-	// and these variables are accessed by multiple threads
-	// however, memory fences are slow and this works in practice
-	static volatile uint64_t stop_at = -1;
-	static volatile uint64_t signal_at = -1;
+	// the deadline is the minimum of the runtime set via set_runtime() and the time a signal was received
+	// accesses use the atomic builtins as the plain struct is shared with C code and LuaJIT
+	static volatile sig_atomic_t signal_received = 0;
+
+	static void lower_deadline(uint64_t deadline) {
+		uint64_t current = __atomic_load_n(&libmoon_run_state.deadline, __ATOMIC_RELAXED);
+		while (deadline < current && !__atomic_compare_exchange_n(&libmoon_run_state.deadline, &current, deadline,
+				true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		}
+	}
 
 	static void handler(int unused) {
-		if (signal_at != (uint64_t) -1) {
+		if (signal_received) {
 			// cancel was requested more than once, just bail out
 			std::cerr << "Received more than one SIGINT/SIGTERM, aborting" << std::endl;
 			std::abort();
 		}
-		signal_at = rte_rdtsc();
+		signal_received = 1;
+		lower_deadline(rte_rdtsc());
 	}
 
 	void install_signal_handlers() {
@@ -29,21 +37,41 @@ namespace libmoon {
 		signal(SIGTERM, handler);
 	}
 
+	// rte_get_tsc_hz() is only valid after the EAL was initialized, so this can't be done on startup
+	static uint64_t tsc_per_ms() {
+		uint64_t result = __atomic_load_n(&libmoon_run_state.tsc_per_ms, __ATOMIC_RELAXED);
+		if (!result) {
+			result = rte_get_tsc_hz() / 1000;
+			__atomic_store_n(&libmoon_run_state.tsc_per_ms, result, __ATOMIC_RELAXED);
+		}
+		return result;
+	}
+
 	// do not change the return type to bool as luajit doesn't like this
 	uint8_t is_running(uint32_t extra_time) {
-		uint64_t extra_time_cycles = (uint64_t) extra_time * rte_get_tsc_hz() / 1000;
-		uint64_t time = rte_rdtsc() - extra_time_cycles;
-		return signal_at > time && stop_at > time;
+		uint64_t deadline = __atomic_load_n(&libmoon_run_state.deadline, __ATOMIC_ACQUIRE);
+		return rte_rdtsc() < deadline + extra_time * tsc_per_ms();
 	}
 }
 
 extern "C" {
+	struct libmoon_run_state* get_run_state() {
+		libmoon::tsc_per_ms();
+		return &libmoon_run_state;
+	}
+
 	uint8_t is_running(uint32_t extra_time) {
 		return libmoon::is_running(extra_time);
 	}
 
 	void set_runtime(uint32_t run_time) {
-		libmoon::stop_at = rte_rdtsc() + run_time * rte_get_tsc_hz() / 1000;
+		uint64_t stop_at = rte_rdtsc() + run_time * libmoon::tsc_per_ms();
+		if (libmoon::signal_received) {
+			// a signal takes precedence over a longer runtime
+			libmoon::lower_deadline(stop_at);
+		} else {
+			__atomic_store_n(&libmoon_run_state.deadline, stop_at, __ATOMIC_RELEASE);
+		}
 	}
 }
 
@@ -1,9 +1,35 @@
 #pragma once
+#include <stdint.h>
+
+#include "rdtsc.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
+
+// run state shared by all tasks, keep in sync with dpdkc.lua
+// tasks are running as long as the TSC is below the deadline
+// on its own cache line as it is read in every rx/tx loop iteration on every core
+struct libmoon_run_state {
+	uint64_t deadline;
+	uint64_t tsc_per_ms;
+} __attribute__((aligned(64)));
+
+// deadline value if no runtime was set and no signal was received
+// far enough away to add extra time without overflowing
+#define LIBMOON_RUN_FOREVER (UINT64_MAX >> 1)
+
+extern struct libmoon_run_state libmoon_run_state;
+
+struct libmoon_run_state* get_run_state(void);
 uint8_t is_running(uint32_t extra_time);
+void set_runtime(uint32_t run_time);
+
+// fast path for loops in C code, inlined into the caller
+static inline uint8_t libmoon_is_running(void) {
+	return read_rdtsc() < __atomic_load_n(&libmoon_run_state.deadline, __ATOMIC_ACQUIRE);
+}
+
 #ifdef __cplusplus
 }
 #endif
-
@@ -1,6 +1,8 @@
 #ifndef LIFECYCLE_H__
 #define LIFECYCLE_H__
 
+#include "lifecycle.h"
+
 namespace libmoon {
 	void install_signal_handlers();
 	uint8_t is_running(uint32_t extra_time);
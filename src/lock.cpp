@@ -1,28 +1,209 @@
 #include <cstdint>
+#include <cstdlib>
+#include <new>
 #include <mutex>
 
+#include <rte_config.h>
+#include <rte_pause.h>
+
+#include "lock.hpp"
+
+namespace libmoon {
+
+	// spin locks and queue nodes are cache line aligned to avoid false sharing with neighboring objects
+	// operator new does not respect over-alignment before C++17
+	template<typename T>
+	static T* make_aligned() {
+		void* mem;
+		if (posix_memalign(&mem, alignof(T), sizeof(T))) {
+			return nullptr;
+		}
+		return new (mem) T();
+	}
+
+	bool lock_base::try_lock_for(std::chrono::microseconds timeout) {
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		do {
+			if (try_lock()) {
+				return true;
+			}
+			rte_pause();
+		} while (std::chrono::steady_clock::now() < deadline);
+		return false;
+	}
+
+	void ticket_lock::lock() {
+		uint32_t ticket = next.fetch_add(1, std::memory_order_relaxed);
+		while (owner.load(std::memory_order_acquire) != ticket) {
+			rte_pause();
+		}
+	}
+
+	void ticket_lock::unlock() {
+		owner.store(owner.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	bool ticket_lock::try_lock() {
+		uint32_t ticket = owner.load(std::memory_order_acquire);
+		uint32_t expected = ticket;
+		return next.compare_exchange_strong(expected, ticket + 1, std::memory_order_acquire);
+	}
+
+	// queue nodes are recycled per thread, a node is free again once its lock was released
+	static thread_local mcs_lock::node* mcs_free_nodes = nullptr;
+
+	static mcs_lock::node* mcs_get_node() {
+		mcs_lock::node* n = mcs_free_nodes;
+		if (n) {
+			mcs_free_nodes = n->free_next;
+		} else {
+			n = make_aligned<mcs_lock::node>();
+			if (!n) {
+				throw std::bad_alloc();
+			}
+		}
+		n->next.store(nullptr, std::memory_order_relaxed);
+		n->locked.store(true, std::memory_order_relaxed);
+		return n;
+	}
+
+	static void mcs_put_node(mcs_lock::node* n) {
+		n->free_next = mcs_free_nodes;
+		mcs_free_nodes = n;
+	}
+
+	void mcs_lock::lock() {
+		node* n = mcs_get_node();
+		node* prev = tail.exchange(n, std::memory_order_acq_rel);
+		if (prev) {
+			prev->next.store(n, std::memory_order_release);
+			while (n->locked.load(std::memory_order_acquire)) {
+				rte_pause();
+			}
+		}
+		owner_node = n;
+	}
+
+	void mcs_lock::unlock() {
+		node* n = owner_node;
+		node* succ = n->next.load(std::memory_order_acquire);
+		if (!succ) {
+			node* expected = n;
+			if (tail.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel)) {
+				mcs_put_node(n);
+				return;
+			}
+			// a new waiter swapped the tail but did not link itself yet
+			while (!(succ = n->next.load(std::memory_order_acquire))) {
+				rte_pause();
+			}
+		}
+		succ->locked.store(false, std::memory_order_release);
+		mcs_put_node(n);
+	}
+
+	bool mcs_lock::try_lock() {
+		node* n = mcs_get_node();
+		node* expected = nullptr;
+		if (tail.compare_exchange_strong(expected, n, std::memory_order_acq_rel)) {
+			owner_node = n;
+			return true;
+		}
+		mcs_put_node(n);
+		return false;
+	}
+
+	void rw_spinlock::lock() {
+		while (true) {
+			uint32_t s = state.load(std::memory_order_relaxed);
+			if ((s & ~WRITER_PENDING) == 0) {
+				if (state.compare_exchange_weak(s, WRITER, std::memory_order_acquire)) {
+					return;
+				}
+				continue;
+			}
+			// block new readers until we got the lock
+			if (!(s & WRITER_PENDING)) {
+				state.fetch_or(WRITER_PENDING, std::memory_order_relaxed);
+			}
+			rte_pause();
+		}
+	}
+
+	void rw_spinlock::unlock() {
+		// keep the pending flag set by other waiting writers
+		state.fetch_and(~WRITER, std::memory_order_release);
+	}
+
+	bool rw_spinlock::try_lock() {
+		uint32_t expected = 0;
+		return state.compare_exchange_strong(expected, WRITER, std::memory_order_acquire);
+	}
+
+	void rw_spinlock::lock_shared() {
+		while (true) {
+			uint32_t s = state.load(std::memory_order_relaxed);
+			if (!(s & (WRITER | WRITER_PENDING))) {
+				if (state.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) {
+					return;
+				}
+				continue;
+			}
+			rte_pause();
+		}
+	}
+
+	void rw_spinlock::unlock_shared() {
+		state.fetch_sub(1, std::memory_order_release);
+	}
+
+}
+
 extern "C" {
-	
-	using mutex = std::recursive_timed_mutex;
 
-	mutex* make_lock() {
-		return new mutex();
+	using libmoon::lock_base;
+
+	lock_base* make_lock() {
+		return new libmoon::mutex_lock();
+	}
+
+	lock_base* make_lock_kind(uint32_t kind) {
+		switch (kind) {
+			case libmoon::LOCK_KIND_MUTEX:
+				return make_lock();
+			case libmoon::LOCK_KIND_TICKET:
+				return libmoon::make_aligned<libmoon::ticket_lock>();
+			case libmoon::LOCK_KIND_MCS:
+				return libmoon::make_aligned<libmoon::mcs_lock>();
+			case libmoon::LOCK_KIND_RW:
+				return libmoon::make_aligned<libmoon::rw_spinlock>();
+			default:
+				return nullptr;
+		}
 	}
 
-	void lock_lock(mutex* lock) {
+	void lock_lock(lock_base* lock) {
 		lock->lock();
 	}
 
-	void lock_unlock(mutex* lock) {
+	void lock_unlock(lock_base* lock) {
 		lock->unlock();
 	}
 
-	uint32_t lock_try_lock(mutex* lock) {
+	uint32_t lock_try_lock(lock_base* lock) {
 		return lock->try_lock();
 	}
 
-	uint32_t lock_try_lock_for(mutex* lock, uint32_t us) {
+	uint32_t lock_try_lock_for(lock_base* lock, uint32_t us) {
 		return lock->try_lock_for(std::chrono::microseconds(us));
 	}
+
+	void lock_lock_shared(lock_base* lock) {
+		lock->lock_shared();
+	}
+
+	void lock_unlock_shared(lock_base* lock) {
+		lock->unlock_shared();
+	}
 }
 
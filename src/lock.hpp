@@ -0,0 +1,82 @@
+#ifndef LOCK_H__
+#define LOCK_H__
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+
+namespace libmoon {
+
+	// lock kinds selectable via make_lock_kind(), keep in sync with lock.lua
+	enum lock_kind : uint32_t {
+		LOCK_KIND_MUTEX = 0,
+		LOCK_KIND_TICKET = 1,
+		LOCK_KIND_MCS = 2,
+		LOCK_KIND_RW = 3,
+	};
+
+	// base class of all locks handed out to Lua as struct lock*
+	// only the mutex kind is recursive, the spin locks deadlock if acquired twice by the same task
+	struct lock_base {
+		virtual ~lock_base() {}
+		virtual void lock() = 0;
+		virtual void unlock() = 0;
+		virtual bool try_lock() = 0;
+		virtual bool try_lock_for(std::chrono::microseconds timeout);
+		// shared (reader) lock, only the reader-writer lock allows multiple concurrent holders
+		virtual void lock_shared() { lock(); }
+		virtual void unlock_shared() { unlock(); }
+	};
+
+	struct mutex_lock : lock_base {
+		std::recursive_timed_mutex mutex;
+
+		void lock() override { mutex.lock(); }
+		void unlock() override { mutex.unlock(); }
+		bool try_lock() override { return mutex.try_lock(); }
+		bool try_lock_for(std::chrono::microseconds timeout) override { return mutex.try_lock_for(timeout); }
+	};
+
+	// FIFO spin lock, a single atomic increment on the fast path
+	struct alignas(64) ticket_lock : lock_base {
+		std::atomic<uint32_t> next{0};
+		std::atomic<uint32_t> owner{0};
+
+		void lock() override;
+		void unlock() override;
+		bool try_lock() override;
+	};
+
+	// queue lock, every waiter spins on its own cache line instead of the shared lock word
+	struct alignas(64) mcs_lock : lock_base {
+		struct alignas(64) node {
+			std::atomic<node*> next;
+			std::atomic<bool> locked;
+			node* free_next;
+		};
+		std::atomic<node*> tail{nullptr};
+		// only accessed by the current owner
+		node* owner_node = nullptr;
+
+		void lock() override;
+		void unlock() override;
+		bool try_lock() override;
+	};
+
+	// writer-preferring reader-writer spin lock
+	struct alignas(64) rw_spinlock : lock_base {
+		static constexpr uint32_t WRITER = 1u << 31;
+		static constexpr uint32_t WRITER_PENDING = 1u << 30;
+		// number of readers in the lower bits
+		std::atomic<uint32_t> state{0};
+
+		void lock() override;
+		void unlock() override;
+		bool try_lock() override;
+		void lock_shared() override;
+		void unlock_shared() override;
+	};
+}
+
+#endif
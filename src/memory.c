@@ -2,24 +2,177 @@
 #include <rte_mbuf.h>
 #include <rte_mempool.h>
 #include <rte_errno.h>
+#include <rte_ethdev.h>
+#include <rte_cycles.h>
+#include <rte_pause.h>
 #include <rte_spinlock.h>
+#include <rte_branch_prediction.h>
 #include <sys/mman.h>
 
+#include "memory.h"
+#include "lifecycle.h"
+
 #include <stdint.h>
+#include <string.h>
 
 #define MEMPOOL_CACHE_SIZE 256
 
+// pool of pools, DPDK cannot free mempools so we recycle pools of terminated tasks
+// the registry is only touched when creating pools and when tasks start/stop
+#define MEMPOOL_REGISTRY_SIZE 1024
+
+enum pool_state {
+	POOL_EMPTY,   // unused registry slot
+	POOL_BUSY,    // slot is being modified by a thread
+	POOL_USED,    // owned by at least one task
+	POOL_CACHED,  // all owners released the pool, can be recycled once drained
+};
+
+struct pool_entry {
+	struct rte_mempool* pool;
+	struct mempool_alloc_stats stats;
+	uint32_t n;
+	int32_t socket;
+	uint32_t mbuf_size;
+	uint32_t refs;
+	uint32_t state;
+};
+
+static struct pool_entry pool_registry[MEMPOOL_REGISTRY_SIZE];
+static volatile uint32_t cache_enabled = 0;
+
+static inline int claim_entry(struct pool_entry* entry, uint32_t expected) {
+	return __atomic_compare_exchange_n(&entry->state, &expected, POOL_BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void publish_entry(struct pool_entry* entry, uint32_t state) {
+	__atomic_store_n(&entry->state, state, __ATOMIC_RELEASE);
+}
+
+static struct pool_entry* find_entry(struct rte_mempool* pool) {
+	for (uint32_t i = 0; i < MEMPOOL_REGISTRY_SIZE; i++) {
+		struct pool_entry* entry = &pool_registry[i];
+		uint32_t state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+		if ((state == POOL_USED || state == POOL_CACHED) && entry->pool == pool) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static void register_pool(struct rte_mempool* pool, uint32_t n, int32_t socket, uint32_t mbuf_size) {
+	for (uint32_t i = 0; i < MEMPOOL_REGISTRY_SIZE; i++) {
+		struct pool_entry* entry = &pool_registry[i];
+		if (__atomic_load_n(&entry->state, __ATOMIC_RELAXED) == POOL_EMPTY && claim_entry(entry, POOL_EMPTY)) {
+			entry->pool = pool;
+			entry->n = n;
+			entry->socket = socket;
+			entry->mbuf_size = mbuf_size;
+			memset(&entry->stats, 0, sizeof(entry->stats));
+			__atomic_store_n(&entry->refs, 1, __ATOMIC_RELAXED);
+			publish_entry(entry, POOL_USED);
+			return;
+		}
+	}
+	// registry full, the pool is simply never recycled
+}
+
+// resets an mbuf and clears its data, used as rte_mempool_obj_iter() callback
+static void reset_obj(struct rte_mempool* mp, void* opaque, void* obj, unsigned idx) {
+	rte_pktmbuf_init(mp, opaque, obj, idx);
+	struct rte_mbuf* m = obj;
+	memset(m->buf_addr, 0, m->buf_len);
+}
+
+void mempool_cache_enable(uint32_t enabled) {
+	cache_enabled = enabled;
+}
+
+uint32_t mempool_cache_is_enabled() {
+	return cache_enabled;
+}
+
+// returns a cached pool with the same parameters or NULL
+// pools are only handed out once all their mbufs were returned, buffers are reset and zeroed
+struct rte_mempool* mempool_cache_get(uint32_t n, int32_t socket, uint32_t mbuf_size) {
+	for (uint32_t i = 0; i < MEMPOOL_REGISTRY_SIZE; i++) {
+		struct pool_entry* entry = &pool_registry[i];
+		if (__atomic_load_n(&entry->state, __ATOMIC_RELAXED) != POOL_CACHED) {
+			continue;
+		}
+		if (entry->n != n || entry->socket != socket || entry->mbuf_size != mbuf_size) {
+			continue;
+		}
+		if (!claim_entry(entry, POOL_CACHED)) {
+			continue;
+		}
+		// mbufs may still be in flight, e.g., in a pipe or not yet reclaimed tx descriptors
+		// the per-lcore caches are included in the count
+		if (rte_mempool_avail_count(entry->pool) != entry->pool->size) {
+			publish_entry(entry, POOL_CACHED);
+			continue;
+		}
+		rte_mempool_obj_iter(entry->pool, reset_obj, NULL);
+		__atomic_store_n(&entry->refs, 1, __ATOMIC_RELAXED);
+		publish_entry(entry, POOL_USED);
+		return entry->pool;
+	}
+	return NULL;
+}
+
+// adds an owner to a pool, e.g., a task the pool is passed to
+void mempool_cache_retain(struct rte_mempool* pool) {
+	struct pool_entry* entry = find_entry(pool);
+	if (!entry) {
+		return;
+	}
+	if (__atomic_add_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 1) {
+		// the last owner already released the pool, take it back out of the cache
+		uint32_t expected = POOL_CACHED;
+		while (!__atomic_compare_exchange_n(&entry->state, &expected, POOL_USED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			if (expected == POOL_USED) {
+				break;
+			}
+			// POOL_BUSY: mempool_cache_get() is checking the pool
+			expected = POOL_CACHED;
+			rte_pause();
+		}
+	}
+}
+
+// removes an owner, the pool is returned to the cache once the last owner released it
+void mempool_cache_release(struct rte_mempool* pool) {
+	struct pool_entry* entry = find_entry(pool);
+	if (!entry) {
+		return;
+	}
+	if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		// keep the pool if someone raced us, e.g., by calling retain() without holding a reference
+		uint32_t expected = POOL_USED;
+		if (__atomic_compare_exchange_n(&entry->state, &expected, POOL_CACHED, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+		&& __atomic_load_n(&entry->refs, __ATOMIC_ACQUIRE) != 0) {
+			// retain() ran between the decrement and the state change
+			expected = POOL_CACHED;
+			__atomic_compare_exchange_n(&entry->state, &expected, POOL_USED, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+		}
+	}
+}
+
 struct rte_mempool* init_mem(uint32_t nb_mbuf, uint32_t socket, uint32_t mbuf_size) {
 	static volatile uint32_t mbuf_cnt = 0;
 	char pool_name[32];
 	sprintf(pool_name, "mbuf_pool%d", __sync_fetch_and_add(&mbuf_cnt, 1));
 	// rte_mempool_create is apparently not thread-safe :(
+	// only new pools take the lock, recycled pools from mempool_cache_get() do not
 	static rte_spinlock_t lock = RTE_SPINLOCK_INITIALIZER;
 	rte_spinlock_lock(&lock);
 	struct rte_mempool* pool = rte_pktmbuf_pool_create(pool_name, nb_mbuf, MEMPOOL_CACHE_SIZE,
 		0, mbuf_size + RTE_PKTMBUF_HEADROOM,
 		socket
 	);
+	if (pool) {
+		register_pool(pool, nb_mbuf, socket, mbuf_size);
+	}
 	rte_spinlock_unlock(&lock);
 	if (!pool) {
 		printf("Memory allocation failed: %s (%d)\n", rte_strerror(-rte_errno), rte_errno); 
@@ -32,12 +185,15 @@ struct rte_mbuf* rte_pktmbuf_alloc_export(struct rte_mempool* mp) {
 	return rte_pktmbuf_alloc(mp);
 }
 
-void alloc_mbufs(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len) {
-	// this is essentially rte_pktmbuf_alloc_bulk()
+static inline void init_mbufs(struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len) {
+	// this is essentially the init loop of rte_pktmbuf_alloc_bulk()
 	// but the loop is optimized to directly set the pkt/data len flags as well
 	// since most allocs directly do this (packet generators)
-	rte_mempool_get_bulk(mp, (void **)bufs, len);
 	uint32_t i = 0;
+	// the switch jumps into the loop body, so the condition is not checked before the first iteration
+	if (!len) {
+		return;
+	}
 	switch (len % 4) {
 		while (i != len) {
 			case 0:
@@ -71,6 +227,115 @@ void alloc_mbufs(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len,
 	}
 }
 
+// registry entry of the pool that failed last on this thread
+// entries are never unregistered, so a cached entry stays valid as long as it still points to the pool
+static __thread struct pool_entry* last_failed_entry;
+
+// exhaustion counters live in the registry entry, only updated on the slow path
+// a task polling an exhausted pool calls this in a loop, so the registry is only scanned once per pool
+static inline void count_failure(struct rte_mempool* mp, int partial, int timeout) {
+	struct pool_entry* entry = last_failed_entry;
+	if (unlikely(!entry || entry->pool != mp)) {
+		entry = find_entry(mp);
+		if (!entry) {
+			return;
+		}
+		last_failed_entry = entry;
+	}
+	__atomic_add_fetch(&entry->stats.failures, 1, __ATOMIC_RELAXED);
+	if (partial) {
+		__atomic_add_fetch(&entry->stats.partial, 1, __ATOMIC_RELAXED);
+	}
+	if (timeout) {
+		__atomic_add_fetch(&entry->stats.timeouts, 1, __ATOMIC_RELAXED);
+	}
+}
+
+// allocates up to len mbufs, falls back to smaller bursts (halving down to min_burst) if the pool runs low
+// returns the number of mbufs, they are stored in bufs[0] to bufs[n - 1]
+static uint32_t get_partial(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint32_t min_burst) {
+	uint32_t got = 0;
+	uint32_t burst = len;
+	min_burst = min_burst ? min_burst : 1;
+	while (got < len && burst >= min_burst) {
+		if (rte_mempool_get_bulk(mp, (void**) bufs + got, burst) == 0) {
+			got += burst;
+			burst = RTE_MIN(burst, len - got);
+		} else {
+			burst /= 2;
+		}
+	}
+	return got;
+}
+
+// allocates exactly len mbufs, does not wait if the pool is exhausted
+// returns len or 0, the caller should keep polling its tx queues (e.g., an empty send) so that sent mbufs are freed
+uint32_t alloc_mbufs(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len) {
+	if (unlikely(rte_mempool_get_bulk(mp, (void**) bufs, len) != 0)) {
+		count_failure(mp, 0, 1);
+		return 0;
+	}
+	init_mbufs(bufs, len, pkt_len);
+	return len;
+}
+
+// mbufs are usually stuck in tx queues until the driver cleans up the descriptors of sent packets
+// drivers without tx_done_cleanup do this when the queue is polled, even with an empty burst
+void reclaim_tx_mbufs(uint16_t port, uint16_t queue) {
+	if (rte_eth_tx_done_cleanup(port, queue, 0) < 0) {
+		rte_eth_tx_burst(port, queue, NULL, 0);
+	}
+}
+
+// allocates exactly len mbufs, waits up to timeout_us microseconds if the pool is exhausted
+// port and queue (ignored if port < 0) are reclaimed while waiting, the queue must not be used by other threads
+// returns len or 0 on timeout or if libmoon was stopped while waiting
+uint32_t alloc_mbufs_wait(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len, uint32_t timeout_us, int32_t port, uint16_t queue) {
+	if (likely(rte_mempool_get_bulk(mp, (void**) bufs, len) == 0)) {
+		init_mbufs(bufs, len, pkt_len);
+		return len;
+	}
+	uint64_t deadline = rte_get_tsc_cycles() + timeout_us * (rte_get_tsc_hz() / 1000000);
+	int ret;
+	do {
+		if (port >= 0) {
+			reclaim_tx_mbufs(port, queue);
+		}
+		rte_pause();
+		ret = rte_mempool_get_bulk(mp, (void**) bufs, len);
+	} while (ret != 0 && rte_get_tsc_cycles() < deadline && libmoon_is_running());
+	count_failure(mp, 0, ret != 0);
+	if (ret != 0) {
+		return 0;
+	}
+	init_mbufs(bufs, len, pkt_len);
+	return len;
+}
+
+// allocates up to len mbufs, see get_partial(), and waits up to timeout_us microseconds if no mbufs are available
+// returns the number of mbufs allocated
+uint32_t alloc_mbufs_partial(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len, uint32_t min_burst, uint32_t timeout_us) {
+	if (likely(rte_mempool_get_bulk(mp, (void**) bufs, len) == 0)) {
+		init_mbufs(bufs, len, pkt_len);
+		return len;
+	}
+	uint32_t got = get_partial(mp, bufs, len, min_burst);
+	if (!got && timeout_us) {
+		uint64_t deadline = rte_get_tsc_cycles() + timeout_us * (rte_get_tsc_hz() / 1000000);
+		while (!got && rte_get_tsc_cycles() < deadline && libmoon_is_running()) {
+			rte_pause();
+			got = get_partial(mp, bufs, len, min_burst);
+		}
+	}
+	count_failure(mp, got > 0, got == 0 && timeout_us);
+	init_mbufs(bufs, got, pkt_len);
+	return got;
+}
+
+struct mempool_alloc_stats* mempool_get_alloc_stats(struct rte_mempool* mp) {
+	struct pool_entry* entry = find_entry(mp);
+	return entry ? &entry->stats : NULL;
+}
 
 uint16_t rte_mbuf_refcnt_read_export(struct rte_mbuf* m) {
 	return rte_mbuf_refcnt_read(m);
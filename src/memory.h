@@ -5,6 +5,23 @@
 #include <rte_mempool.h>
 #include <rte_mbuf.h>
 
-struct rte_mempool* init_mem(uint32_t nb_mbuf, int32_t socket);
+// per-pool counters for allocation failures
+struct mempool_alloc_stats {
+	uint64_t failures; // bulk allocations that could not be served completely at the first try
+	uint64_t partial;  // allocations that returned fewer mbufs than requested
+	uint64_t timeouts; // allocations that returned no mbufs, immediately or after waiting
+};
+
+struct rte_mempool* init_mem(uint32_t nb_mbuf, uint32_t socket, uint32_t mbuf_size);
+void mempool_cache_enable(uint32_t enabled);
+uint32_t mempool_cache_is_enabled();
+struct rte_mempool* mempool_cache_get(uint32_t n, int32_t socket, uint32_t mbuf_size);
+void mempool_cache_retain(struct rte_mempool* pool);
+void mempool_cache_release(struct rte_mempool* pool);
+uint32_t alloc_mbufs(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len);
+void reclaim_tx_mbufs(uint16_t port, uint16_t queue);
+uint32_t alloc_mbufs_wait(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len, uint32_t timeout_us, int32_t port, uint16_t queue);
+uint32_t alloc_mbufs_partial(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len, uint32_t min_burst, uint32_t timeout_us);
+struct mempool_alloc_stats* mempool_get_alloc_stats(struct rte_mempool* mp);
 
 #endif /* MEMORY_H__ */
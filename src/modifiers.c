@@ -0,0 +1,216 @@
+#include <string.h>
+#include <rte_config.h>
+#include <rte_byteorder.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+
+#include "checksum.h"
+#include "modifiers.h"
+
+// field modifiers for packet generators, e.g., to generate many flows by varying the ports
+// values for a whole burst are generated per field first (tight loop without memory accesses to the packets),
+// then written to the packets with an incremental checksum update according to RFC 1624.
+// note: AVX2 has gathers but no scatters and every value goes to a different mbuf,
+// so the stores are scalar; the value generation loops are vectorized by the compiler where possible
+
+struct mod_program* mod_program_create(uint64_t seed, int32_t socket) {
+	struct mod_program* prog = rte_zmalloc_socket("mod_program", sizeof(struct mod_program), RTE_CACHE_LINE_SIZE, socket);
+	if (!prog) {
+		return NULL;
+	}
+	// xorshift128+ must not be seeded with all zeroes
+	prog->rng[0] = seed ^ 0x9e3779b97f4a7c15ULL;
+	prog->rng[1] = (seed * 0xbf58476d1ce4e5b9ULL) | 1;
+	return prog;
+}
+
+void mod_program_free(struct mod_program* prog) {
+	for (uint32_t i = 0; i < prog->count; i++) {
+		rte_free(prog->fields[i].list);
+	}
+	rte_free(prog);
+}
+
+// returns the index of the field or -1 on error
+int mod_program_add(struct mod_program* prog, uint32_t offset, uint32_t bits, uint32_t op, uint64_t min, uint64_t max, uint64_t step, const uint64_t* list, uint32_t list_len) {
+	if (prog->count >= MOD_MAX_FIELDS || op > MOD_OP_LIST) {
+		return -1;
+	}
+	uint32_t width = bits / 8;
+	if (bits % 8 || !(width == 1 || width == 2 || width == 4 || width == 6 || width == 8 || width == 16)) {
+		return -1;
+	}
+	struct mod_field* field = &prog->fields[prog->count];
+	memset(field, 0, sizeof(*field));
+	if (op == MOD_OP_LIST) {
+		if (!list_len) {
+			return -1;
+		}
+		field->list = rte_malloc("mod_list", list_len * sizeof(uint64_t), 0);
+		if (!field->list) {
+			return -1;
+		}
+		memcpy(field->list, list, list_len * sizeof(uint64_t));
+		field->list_len = list_len;
+	}
+	// limit the range to the field width
+	uint64_t width_max = width >= 8 ? UINT64_MAX : (1ULL << (width * 8)) - 1;
+	if (max > width_max) {
+		max = width_max;
+	}
+	if (min > max) {
+		min = max;
+	}
+	field->offset = offset;
+	field->width = width;
+	field->op = op;
+	field->min = min;
+	field->range = max - min + 1;
+	field->step = field->range ? step % field->range : step;
+	field->current = op == MOD_OP_DEC ? max : min;
+	for (int i = 0; i < MOD_MAX_CHECKSUMS; i++) {
+		field->checksums[i].offset = -1;
+	}
+	return prog->count++;
+}
+
+// fix up the checksum at the given offset whenever the field is modified
+int mod_program_add_checksum(struct mod_program* prog, uint32_t field, uint32_t offset, uint32_t start, uint8_t udp) {
+	if (field >= prog->count) {
+		return -1;
+	}
+	for (int i = 0; i < MOD_MAX_CHECKSUMS; i++) {
+		struct mod_checksum* csum = &prog->fields[field].checksums[i];
+		if (csum->offset < 0) {
+			csum->offset = offset;
+			csum->start = start;
+			csum->udp = udp;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static inline uint64_t next_random(struct mod_program* prog) {
+	uint64_t s1 = prog->rng[0];
+	uint64_t s0 = prog->rng[1];
+	prog->rng[0] = s0;
+	s1 ^= s1 << 23;
+	prog->rng[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+	return prog->rng[1] + s0;
+}
+
+static void generate_values(struct mod_program* prog, struct mod_field* field, uint64_t* values, uint32_t n) {
+	switch (field->op) {
+		case MOD_OP_INC: {
+			uint64_t cur = field->current - field->min;
+			for (uint32_t i = 0; i < n; i++) {
+				values[i] = field->min + cur;
+				cur += field->step;
+				// step < range, so a single subtraction wraps around
+				if (field->range && cur >= field->range) {
+					cur -= field->range;
+				}
+			}
+			field->current = field->min + cur;
+			break;
+		}
+		case MOD_OP_DEC: {
+			uint64_t cur = field->current - field->min;
+			for (uint32_t i = 0; i < n; i++) {
+				values[i] = field->min + cur;
+				cur = cur >= field->step || !field->range ? cur - field->step : cur + field->range - field->step;
+			}
+			field->current = field->min + cur;
+			break;
+		}
+		case MOD_OP_RANDOM:
+			for (uint32_t i = 0; i < n; i++) {
+				uint64_t r = next_random(prog);
+				// multiply-shift instead of modulo
+				values[i] = field->min + (field->range ? (uint64_t) (((unsigned __int128) r * field->range) >> 64) : r);
+			}
+			break;
+		case MOD_OP_LIST:
+			for (uint32_t i = 0; i < n; i++) {
+				values[i] = field->list[field->list_pos];
+				if (++field->list_pos == field->list_len) {
+					field->list_pos = 0;
+				}
+			}
+			break;
+	}
+}
+
+// folded sum of a field in memory byte order, a field at an odd offset contributes its bytes swapped
+static inline uint16_t field_sum(const uint8_t* data, uint32_t len, uint32_t odd) {
+	uint16_t sum = checksum_fold(checksum_partial(data, len, 0));
+	return odd ? rte_bswap16(sum) : sum;
+}
+
+static inline void update_checksum(uint8_t* pkt, const struct mod_checksum* csum, uint32_t offset, const uint8_t* old, const uint8_t* new, uint32_t len) {
+	unaligned_uint16_t* field = (unaligned_uint16_t*) (pkt + csum->offset);
+	uint16_t hc = *field;
+	if (csum->udp && hc == 0) {
+		return;
+	}
+	uint32_t odd = (offset - csum->start) & 1;
+	uint16_t result = checksum_update16(hc, field_sum(old, len, odd), field_sum(new, len, odd));
+	if (csum->udp && result == 0) {
+		result = 0xFFFF;
+	}
+	*field = result;
+}
+
+static inline void store_value(uint8_t* dst, uint64_t value, uint32_t width) {
+	switch (width) {
+		case 1:
+			*dst = value;
+			break;
+		case 2:
+			*(unaligned_uint16_t*) dst = rte_cpu_to_be_16(value);
+			break;
+		case 4:
+			*(unaligned_uint32_t*) dst = rte_cpu_to_be_32(value);
+			break;
+		case 6: {
+			uint64_t be = rte_cpu_to_be_64(value << 16);
+			memcpy(dst, &be, 6);
+			break;
+		}
+		default: {
+			// 8 and 16 byte fields, only the lower 64 bits are modified
+			uint64_t be = rte_cpu_to_be_64(value);
+			memcpy(dst + width - 8, &be, 8);
+			break;
+		}
+	}
+}
+
+void mod_program_apply(struct mod_program* prog, struct rte_mbuf** bufs, uint32_t n) {
+	for (uint32_t done = 0; done < n; done += 64) {
+		uint32_t burst = n - done < 64 ? n - done : 64;
+		for (uint32_t f = 0; f < prog->count; f++) {
+			struct mod_field* field = &prog->fields[f];
+			generate_values(prog, field, prog->values, burst);
+			// bytes that are actually modified
+			uint32_t offset = field->width == 16 ? field->offset + 8 : field->offset;
+			uint32_t len = field->width == 16 ? 8 : field->width;
+			int has_checksum = field->checksums[0].offset >= 0;
+			for (uint32_t i = 0; i < burst; i++) {
+				uint8_t* pkt = rte_pktmbuf_mtod(bufs[done + i], uint8_t*);
+				uint8_t* dst = pkt + field->offset;
+				if (has_checksum) {
+					uint8_t old[8];
+					memcpy(old, pkt + offset, len);
+					store_value(dst, prog->values[i], field->width);
+					for (int c = 0; c < MOD_MAX_CHECKSUMS && field->checksums[c].offset >= 0; c++) {
+						update_checksum(pkt, &field->checksums[c], offset, old, pkt + offset, len);
+					}
+				} else {
+					store_value(dst, prog->values[i], field->width);
+				}
+			}
+		}
+	}
+}
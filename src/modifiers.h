@@ -0,0 +1,68 @@
+#ifndef MG_MODIFIERS_H
+#define MG_MODIFIERS_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOD_MAX_FIELDS 16
+#define MOD_MAX_CHECKSUMS 2
+
+enum mod_op {
+	MOD_OP_INC = 0,
+	MOD_OP_DEC = 1,
+	MOD_OP_RANDOM = 2,
+	MOD_OP_LIST = 3,
+};
+
+struct mod_checksum {
+	// offset of the 16 bit checksum field, negative if unused
+	int32_t offset;
+	// an offset at which the one's complement sum starts (or any offset with the same parity)
+	uint32_t start;
+	// UDP: a checksum of 0 means no checksum, a computed 0 is transmitted as 0xFFFF
+	uint8_t udp;
+};
+
+// a single field modification, values are in host byte order and written in network byte order
+struct mod_field {
+	uint32_t offset;
+	// width in bytes: 1, 2, 4, 6, 8, or 16 (only the lower 64 bits are modified for 16 byte fields)
+	uint32_t width;
+	uint32_t op;
+	uint64_t min;
+	// max - min + 1, 0 for the full 64 bit range
+	uint64_t range;
+	// increment/decrement, always < range
+	uint64_t step;
+	uint64_t current;
+	uint64_t* list;
+	uint32_t list_len;
+	uint32_t list_pos;
+	struct mod_checksum checksums[MOD_MAX_CHECKSUMS];
+};
+
+// a list of field modifications applied to every packet of a burst, not thread-safe
+struct mod_program {
+	uint32_t count;
+	uint64_t rng[2];
+	struct mod_field fields[MOD_MAX_FIELDS];
+	// scratch space for the values of one field for a burst
+	uint64_t values[64];
+};
+
+struct mod_program* mod_program_create(uint64_t seed, int32_t socket);
+void mod_program_free(struct mod_program* prog);
+int mod_program_add(struct mod_program* prog, uint32_t offset, uint32_t bits, uint32_t op, uint64_t min, uint64_t max, uint64_t step, const uint64_t* list, uint32_t list_len);
+int mod_program_add_checksum(struct mod_program* prog, uint32_t field, uint32_t offset, uint32_t start, uint8_t udp);
+void mod_program_apply(struct mod_program* prog, struct rte_mbuf** bufs, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
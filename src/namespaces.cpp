@@ -1,66 +1,236 @@
 #include <cstdint>
-#include <unordered_map>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <set>
+#include <vector>
 #include <mutex>
+#include <atomic>
 
-// note: namespaces aka 'global maps' are not meant to be fast
+#include <tbb/concurrent_hash_map.h>
+
+#include <rte_config.h>
 
+#include "lock.hpp"
+
+// typed numeric slots for statistics shared between tasks, these bypass the string map and the lock entirely
+// the layout is mirrored in namespaces.lua, which computes shard pointers without calling into C
+enum ns_slot_type : uint32_t {
+	NS_SLOT_INT64 = 0,
+	NS_SLOT_DOUBLE = 1,
+};
+
+#define NS_SLOT_CACHE_LINE 64
+
+struct ns_slot {
+	uint32_t type;
+	uint32_t size;   // number of elements per shard
+	uint32_t shards; // 1 or RTE_MAX_LCORE, sharded slots have one single-writer shard per lcore
+	uint32_t stride; // elements between the start of two shards, shards start on separate cache lines
+	uint8_t* data;
+};
+
+// note: namespaces aka 'global maps' are not meant to be fast
+// however, reads happen from many tasks at the same time, so they must not contend on a global lock:
+// readers only take a shared per-bucket lock in the concurrent map
+// writers are serialized via the namespace lock which is also exposed for explicit transactions
 template<typename K, typename V>
 struct lockable_map {
-	std::unordered_map<K, V> map;
-	std::recursive_timed_mutex lock;
+	tbb::concurrent_hash_map<K, V> map;
+	libmoon::mutex_lock lock;
 
 	lockable_map() : map(), lock() {
 	}
 };
 
-using ns = lockable_map<std::string, std::string>;
+struct ns : lockable_map<std::string, std::string> {
+	// all keys of the map, only accessed with the lock held
+	// iterating the map itself is not safe: find() rehashes buckets lazily without the namespace lock
+	std::set<std::string> keys;
+	// slots are never freed, so pointers handed out to tasks stay valid
+	tbb::concurrent_hash_map<std::string, ns_slot*> slots;
+};
 
 static lockable_map<std::string, ns*> namespaces;
 
+static inline std::atomic<int64_t>* slot_int64(ns_slot* slot, uint32_t shard, uint32_t idx) {
+	return reinterpret_cast<std::atomic<int64_t>*>(slot->data) + (size_t) shard * slot->stride + idx;
+}
+
+static inline std::atomic<double>* slot_double(ns_slot* slot, uint32_t shard, uint32_t idx) {
+	return reinterpret_cast<std::atomic<double>*>(slot->data) + (size_t) shard * slot->stride + idx;
+}
+
 extern "C" {
 
 	ns* create_or_get_namespace(const char* name) {
-		std::lock_guard<std::recursive_timed_mutex> lock(namespaces.lock);
-		auto result = namespaces.map.find(name);
-		if (result != namespaces.map.end()) {
+		decltype(namespaces.map)::const_accessor result;
+		if (namespaces.map.find(result, name)) {
 			return result->second;
 		}
-		auto new_ns = new ns();
-		namespaces.map[name] = new_ns;
-		return new_ns;
+		result.release();
+		decltype(namespaces.map)::accessor new_entry;
+		if (namespaces.map.insert(new_entry, name)) {
+			new_entry->second = new ns();
+		}
+		return new_entry->second;
 	}
-	
+
 	// key and value are copied and must be freed by the caller
 	void namespace_store(ns* ns, const char* key, const char* value) {
-		std::lock_guard<std::recursive_timed_mutex> lock(ns->lock);
-		ns->map[key] = value;
+		std::lock_guard<libmoon::mutex_lock> lock(ns->lock);
+		decltype(ns->map)::accessor entry;
+		if (ns->map.insert(entry, key)) {
+			ns->keys.insert(key);
+		}
+		entry->second = value;
 	}
 
 	void namespace_delete(ns* ns, const char* key) {
-		std::lock_guard<std::recursive_timed_mutex> lock(ns->lock);
+		std::lock_guard<libmoon::mutex_lock> lock(ns->lock);
 		ns->map.erase(key);
+		ns->keys.erase(key);
 	}
 
+	// the returned pointer is only valid until the next store or delete of this key
+	// use namespace_retrieve_copy() if other tasks might modify the key concurrently
 	const char* namespace_retrieve(ns* ns, const char* key) {
-		std::lock_guard<std::recursive_timed_mutex> lock(ns->lock);
-		auto value = ns->map.find(key);
-		if (value != ns->map.end()) {
+		decltype(ns->map)::const_accessor value;
+		if (ns->map.find(value, key)) {
 			return value->second.c_str();
 		} else {
 			return nullptr;
 		}
 	}
 
+	// copies the value including the terminating null byte to buf if it fits into buf_len bytes
+	// returns the length of the value (without the null byte) or -1 if the key does not exist
+	// callers must retry with a larger buffer if the returned length is >= buf_len
+	int64_t namespace_retrieve_copy(ns* ns, const char* key, char* buf, size_t buf_len) {
+		decltype(ns->map)::const_accessor value;
+		if (!ns->map.find(value, key)) {
+			return -1;
+		}
+		size_t len = value->second.length();
+		if (len < buf_len) {
+			std::memcpy(buf, value->second.c_str(), len + 1);
+		}
+		return len;
+	}
+
 	void namespace_iterate(ns* ns, void (*cb)(const char*, const char*)) {
-		std::lock_guard<std::recursive_timed_mutex> lock(ns->lock);
-		for (auto e : ns->map) {
-			cb(e.first.c_str(), e.second.c_str());
+		std::lock_guard<libmoon::mutex_lock> lock(ns->lock);
+		// values are looked up like concurrent readers do, the callback may modify the namespace
+		std::vector<std::string> keys(ns->keys.begin(), ns->keys.end());
+		for (auto& key : keys) {
+			std::string value;
+			{
+				decltype(ns->map)::const_accessor entry;
+				if (!ns->map.find(entry, key)) {
+					continue;
+				}
+				value = entry->second;
+			}
+			cb(key.c_str(), value.c_str());
 		}
 	}
 
-	std::recursive_timed_mutex* namespace_get_lock(ns* ns) {
+	libmoon::lock_base* namespace_get_lock(ns* ns) {
 		return &ns->lock;
 	}
 
-}
+	// returns an existing slot or creates a new zero-initialized one
+	// returns nullptr if the slot already exists with a different type or layout
+	ns_slot* namespace_get_slot(ns* ns, const char* key, uint32_t type, uint32_t size, uint8_t sharded) {
+		uint32_t shards = sharded ? RTE_MAX_LCORE : 1;
+		decltype(ns->slots)::accessor entry;
+		if (ns->slots.insert(entry, key)) {
+			uint32_t per_line = NS_SLOT_CACHE_LINE / sizeof(int64_t);
+			ns_slot* slot = new ns_slot();
+			slot->type = type;
+			slot->size = size;
+			slot->shards = shards;
+			slot->stride = (size + per_line - 1) / per_line * per_line;
+			size_t bytes = (size_t) slot->stride * shards * sizeof(int64_t);
+			void* data;
+			if (posix_memalign(&data, NS_SLOT_CACHE_LINE, bytes)) {
+				delete slot;
+				ns->slots.erase(entry);
+				return nullptr;
+			}
+			std::memset(data, 0, bytes);
+			slot->data = (uint8_t*) data;
+			entry->second = slot;
+		}
+		ns_slot* slot = entry->second;
+		if (slot->type != type || slot->size != size || slot->shards != shards) {
+			return nullptr;
+		}
+		return slot;
+	}
+
+	// atomic updates of the first shard, mainly intended for slots that are not sharded
+	// set also clears all other shards, this races with concurrent updates of sharded slots
+	// out of range indices are ignored, reads return 0
+	int64_t ns_slot_add_int64(ns_slot* slot, uint32_t idx, int64_t val) {
+		if (idx >= slot->size) {
+			return 0;
+		}
+		return slot_int64(slot, 0, idx)->fetch_add(val, std::memory_order_relaxed) + val;
+	}
 
+	void ns_slot_set_int64(ns_slot* slot, uint32_t idx, int64_t val) {
+		if (idx >= slot->size) {
+			return;
+		}
+		for (uint32_t shard = 1; shard < slot->shards; shard++) {
+			slot_int64(slot, shard, idx)->store(0, std::memory_order_relaxed);
+		}
+		slot_int64(slot, 0, idx)->store(val, std::memory_order_release);
+	}
+
+	double ns_slot_add_double(ns_slot* slot, uint32_t idx, double val) {
+		if (idx >= slot->size) {
+			return 0;
+		}
+		auto* elem = slot_double(slot, 0, idx);
+		double old = elem->load(std::memory_order_relaxed);
+		while (!elem->compare_exchange_weak(old, old + val, std::memory_order_relaxed)) {
+		}
+		return old + val;
+	}
+
+	void ns_slot_set_double(ns_slot* slot, uint32_t idx, double val) {
+		if (idx >= slot->size) {
+			return;
+		}
+		for (uint32_t shard = 1; shard < slot->shards; shard++) {
+			slot_double(slot, shard, idx)->store(0, std::memory_order_relaxed);
+		}
+		slot_double(slot, 0, idx)->store(val, std::memory_order_release);
+	}
+
+	// reads sum up all shards, this is not an atomic snapshot if other tasks update the slot concurrently
+	int64_t ns_slot_read_int64(ns_slot* slot, uint32_t idx) {
+		int64_t sum = 0;
+		if (idx >= slot->size) {
+			return 0;
+		}
+		for (uint32_t shard = 0; shard < slot->shards; shard++) {
+			sum += slot_int64(slot, shard, idx)->load(std::memory_order_acquire);
+		}
+		return sum;
+	}
+
+	double ns_slot_read_double(ns_slot* slot, uint32_t idx) {
+		double sum = 0;
+		if (idx >= slot->size) {
+			return 0;
+		}
+		for (uint32_t shard = 0; shard < slot->shards; shard++) {
+			sum += slot_double(slot, shard, idx)->load(std::memory_order_acquire);
+		}
+		return sum;
+	}
+
+}
@@ -7,13 +7,43 @@
 #include <rte_mbuf.h>
 #include <rte_mempool.h>
 
-struct pcapRecHeader {
-	uint32_t ts_sec;   /* timestamp seconds */
-	uint32_t ts_usec;  /* timestamp microseconds */
-	uint32_t incl_len; /* number of octets of packet saved in file */
-	uint32_t orig_len; /* actual length of packet */
-	uint8_t data[];
-};
+#include "pcap.h"
+
+// adds the interface described by an interface description block to the reader state
+void libmoon_pcapng_add_interface(pcapngReaderState* state, const uint8_t* block, uint32_t total_len) {
+	if (state->num_interfaces >= PCAPNG_MAX_INTERFACES) {
+		return;
+	}
+	uint8_t tsresol = PCAPNG_DEFAULT_TSRESOL;
+	// options start after type, length, link type + reserved, and snap len
+	uint32_t offset = 16;
+	while (offset + 4 <= total_len - 4) {
+		uint16_t code, len;
+		memcpy(&code, block + offset, 2);
+		memcpy(&len, block + offset + 2, 2);
+		if (code == 0) {
+			break;
+		}
+		if (code == PCAPNG_OPT_IF_TSRESOL && len >= 1) {
+			tsresol = block[offset + 4];
+		}
+		offset += 4 + ((len + 3) & ~3);
+	}
+	uint64_t mul = 1, div = 1;
+	if (tsresol & 0x80) {
+		// negative power of 2, precision beyond 2^-30 is not supported
+		uint32_t exp = std::min(tsresol & 0x7F, 30);
+		mul = 1000000000ULL;
+		div = 1ULL << exp;
+	} else if (tsresol <= 9) {
+		for (uint32_t i = tsresol; i < 9; i++) mul *= 10;
+	} else {
+		for (uint32_t i = 9; i < std::min<uint32_t>(tsresol, 19); i++) div *= 10;
+	}
+	state->ts_mul[state->num_interfaces] = mul;
+	state->ts_div[state->num_interfaces] = div;
+	state->num_interfaces++;
+}
 
 extern "C" {
 	void libmoon_write_pcap(pcapRecHeader* dst, const void* packet, uint32_t len, uint32_t orig_len, uint32_t ts_sec, uint32_t ts_usec) {
@@ -25,7 +55,7 @@ extern "C" {
 	}
 
 	rte_mbuf* libmoon_read_pcap(rte_mempool* mp, const pcapRecHeader* src, uint64_t remaining, uint32_t mempool_buf_size) {
-		if (src->incl_len >= remaining) {
+		if (remaining < sizeof(pcapRecHeader) || src->incl_len > remaining - sizeof(pcapRecHeader)) {
 			return nullptr;
 		}
 		uint32_t copy_len = src->incl_len;
@@ -58,4 +88,116 @@ extern "C" {
 		}
 		return num_bufs;
 	}
+
+	// writes an enhanced packet block with a timestamp in nanoseconds, returns the size of the block
+	uint32_t libmoon_write_pcapng(uint8_t* dst, const void* packet, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns) {
+		pcapngEnhancedPacketBlock* block = reinterpret_cast<pcapngEnhancedPacketBlock*>(dst);
+		uint32_t padded_len = (len + 3) & ~3;
+		uint32_t total_len = sizeof(pcapngEnhancedPacketBlock) + padded_len + 4;
+		block->type = PCAPNG_EPB;
+		block->total_len = total_len;
+		block->interface_id = interface_id;
+		block->ts_high = ts_ns >> 32;
+		block->ts_low = (uint32_t) ts_ns;
+		block->cap_len = len;
+		block->orig_len = orig_len;
+		memcpy(block->data, packet, len);
+		memset(block->data + len, 0, padded_len - len);
+		memcpy(dst + total_len - 4, &total_len, 4);
+		return total_len;
+	}
+
+	// writes a section header block with unknown section length, returns its size
+	// writes a classic pcap file header for Ethernet with microsecond timestamps, returns its size
+	uint32_t libmoon_write_pcap_header(uint8_t* dst) {
+		uint32_t hdr[6] = { PCAP_MAGIC, 2 | (4 << 16) /* version 2.4 */, 0, 0, 0x40000 /* snap len */, 1 /* Ethernet */ };
+		memcpy(dst, hdr, sizeof(hdr));
+		return sizeof(hdr);
+	}
+
+	uint32_t libmoon_write_pcapng_shb(uint8_t* dst) {
+		uint32_t hdr[7] = { PCAPNG_SHB, 28, PCAPNG_BYTE_ORDER_MAGIC, 1 /* version 1.0 */, 0xFFFFFFFF, 0xFFFFFFFF, 28 };
+		memcpy(dst, hdr, sizeof(hdr));
+		return sizeof(hdr);
+	}
+
+	// size of an interface description block written by libmoon_write_pcapng_idb()
+	uint32_t libmoon_pcapng_idb_size(uint32_t name_len) {
+		// header, if_name, if_tsresol, end of options, and trailer
+		return 16 + (name_len ? 4 + ((name_len + 3) & ~3) : 0) + 8 + 4 + 4;
+	}
+
+	// writes an interface description block with nanosecond timestamps, returns its size
+	uint32_t libmoon_write_pcapng_idb(uint8_t* dst, const char* name, uint32_t name_len, uint16_t link_type, uint32_t snap_len) {
+		uint32_t total_len = libmoon_pcapng_idb_size(name_len);
+		memset(dst, 0, total_len);
+		uint32_t type = PCAPNG_IDB;
+		memcpy(dst, &type, 4);
+		memcpy(dst + 4, &total_len, 4);
+		memcpy(dst + 8, &link_type, 2);
+		memcpy(dst + 12, &snap_len, 4);
+		uint8_t* opt = dst + 16;
+		if (name_len) {
+			uint16_t opt_hdr[2] = { PCAPNG_OPT_IF_NAME, (uint16_t) name_len };
+			memcpy(opt, opt_hdr, 4);
+			memcpy(opt + 4, name, name_len);
+			opt += 4 + ((name_len + 3) & ~3);
+		}
+		uint16_t opt_hdr[2] = { PCAPNG_OPT_IF_TSRESOL, 1 };
+		memcpy(opt, opt_hdr, 4);
+		opt[4] = 9;
+		// the end of options marker and padding are already zero
+		memcpy(dst + total_len - 4, &total_len, 4);
+		return total_len;
+	}
+
+	// reads packets from the enhanced packet blocks of a pcapng file, other blocks are skipped
+	// the timestamp is stored in udata64 as nanoseconds, the number of bytes processed is stored in consumed
+	// returns the number of packets read, stops early at the end of the file or if the mempool is empty
+	uint32_t libmoon_read_pcapng_batch(rte_mempool* mp, rte_mbuf** bufs, uint32_t num_bufs, const uint8_t* pcap, uint64_t remaining, uint32_t mempool_buf_size, pcapngReaderState* state, uint64_t* consumed) {
+		uint64_t offset = 0;
+		uint32_t i = 0;
+		while (i < num_bufs && remaining - offset >= sizeof(pcapngBlockHeader)) {
+			const uint8_t* block = pcap + offset;
+			const pcapngBlockHeader* header = reinterpret_cast<const pcapngBlockHeader*>(block);
+			uint32_t total_len = header->total_len;
+			if (total_len < 12 || total_len > remaining - offset) {
+				// truncated file
+				break;
+			}
+			if (header->type == PCAPNG_EPB && total_len >= sizeof(pcapngEnhancedPacketBlock) + 4) {
+				const pcapngEnhancedPacketBlock* epb = reinterpret_cast<const pcapngEnhancedPacketBlock*>(block);
+				uint32_t cap_len = std::min<uint32_t>(epb->cap_len, total_len - sizeof(pcapngEnhancedPacketBlock) - 4);
+				uint32_t copy_len = std::min(cap_len, mempool_buf_size - 128);
+				uint32_t zero_fill_len = std::min(mempool_buf_size - copy_len - 128, epb->orig_len - std::min(epb->orig_len, cap_len));
+				rte_mbuf* buf = rte_pktmbuf_alloc(mp);
+				if (!buf) {
+					break;
+				}
+				// chained mbufs not supported for now
+				buf->pkt_len = copy_len + zero_fill_len;
+				buf->data_len = copy_len + zero_fill_len;
+				uint64_t ts = ((uint64_t) epb->ts_high << 32) | epb->ts_low;
+				uint32_t id = epb->interface_id;
+				if (id < state->num_interfaces) {
+					ts = (unsigned __int128) ts * state->ts_mul[id] / state->ts_div[id];
+				} else {
+					ts *= 1000;
+				}
+				buf->udata64 = ts;
+				uint8_t* data = rte_pktmbuf_mtod(buf, uint8_t*);
+				memcpy(data, epb->data, copy_len);
+				memset(data + copy_len, 0, zero_fill_len);
+				bufs[i++] = buf;
+			} else if (header->type == PCAPNG_IDB) {
+				libmoon_pcapng_add_interface(state, block, total_len);
+			} else if (header->type == PCAPNG_SHB) {
+				// interface ids are scoped to a section
+				state->num_interfaces = 0;
+			}
+			offset += total_len;
+		}
+		*consumed = offset;
+		return i;
+	}
 }
@@ -0,0 +1,76 @@
+#ifndef MG_PCAP_H
+#define MG_PCAP_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_HEADER_SIZE 24
+#define PCAP_REC_HEADER_SIZE 16
+
+// pcapng, see https://github.com/pcapng/pcapng
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+// timestamps of interfaces without if_tsresol option are in microseconds
+#define PCAPNG_DEFAULT_TSRESOL 6
+#define PCAPNG_MAX_INTERFACES 256
+
+struct pcapRecHeader {
+	uint32_t ts_sec;   /* timestamp seconds */
+	uint32_t ts_usec;  /* timestamp microseconds */
+	uint32_t incl_len; /* number of octets of packet saved in file */
+	uint32_t orig_len; /* actual length of packet */
+	uint8_t data[];
+};
+
+struct pcapngBlockHeader {
+	uint32_t type;
+	uint32_t total_len;
+};
+
+struct pcapngEnhancedPacketBlock {
+	uint32_t type;
+	uint32_t total_len;
+	uint32_t interface_id;
+	uint32_t ts_high;
+	uint32_t ts_low;
+	uint32_t cap_len;
+	uint32_t orig_len;
+	uint8_t data[];
+};
+
+// state of a pcapng reader, interfaces are described by IDBs that can appear anywhere in a section
+// timestamps are converted to nanoseconds: ts * ts_mul / ts_div
+// keep in sync with pcap.lua
+struct pcapngReaderState {
+	uint32_t num_interfaces;
+	uint64_t ts_mul[PCAPNG_MAX_INTERFACES];
+	uint64_t ts_div[PCAPNG_MAX_INTERFACES];
+};
+
+void libmoon_write_pcap(struct pcapRecHeader* dst, const void* packet, uint32_t len, uint32_t orig_len, uint32_t ts_sec, uint32_t ts_usec);
+uint32_t libmoon_write_pcapng(uint8_t* dst, const void* packet, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns);
+uint32_t libmoon_write_pcap_header(uint8_t* dst);
+uint32_t libmoon_write_pcapng_shb(uint8_t* dst);
+uint32_t libmoon_pcapng_idb_size(uint32_t name_len);
+uint32_t libmoon_write_pcapng_idb(uint8_t* dst, const char* name, uint32_t name_len, uint16_t link_type, uint32_t snap_len);
+struct rte_mbuf* libmoon_read_pcap(struct rte_mempool* mp, const struct pcapRecHeader* src, uint64_t remaining, uint32_t mempool_buf_size);
+uint32_t libmoon_read_pcap_batch(struct rte_mempool* mp, struct rte_mbuf** bufs, uint32_t num_bufs, const uint8_t* pcap, uint64_t remaining, uint32_t mempool_buf_size);
+void libmoon_pcapng_add_interface(struct pcapngReaderState* state, const uint8_t* block, uint32_t total_len);
+uint32_t libmoon_read_pcapng_batch(struct rte_mempool* mp, struct rte_mbuf** bufs, uint32_t num_bufs, const uint8_t* pcap, uint64_t remaining, uint32_t mempool_buf_size, struct pcapngReaderState* state, uint64_t* consumed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
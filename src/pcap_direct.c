@@ -0,0 +1,432 @@
+// O_DIRECT
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <rte_config.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+
+#include "pcap_direct.h"
+#include "pcap.h"
+#include "rdtsc.h"
+
+// the io_uring header is only available with kernel headers >= 5.1, writes are synchronous without it
+// IORING_OP_WRITE and the opcode probe need headers >= 5.6 (IO_URING_OP_SUPPORTED), IORING_OP_WRITEV is used otherwise
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define PCAP_DIRECT_HAVE_URING
+#endif
+#endif
+
+#ifdef PCAP_DIRECT_HAVE_URING
+
+// minimal io_uring wrapper using raw system calls, only one thread submits and reaps
+struct pcap_direct_uring {
+	int fd;
+	// IORING_OP_WRITE_FIXED for registered buffers, otherwise IORING_OP_WRITE or IORING_OP_WRITEV
+	uint8_t opcode;
+	uint32_t* sq_head;
+	uint32_t* sq_tail;
+	uint32_t* sq_mask;
+	uint32_t* sq_array;
+	struct io_uring_sqe* sqes;
+	uint32_t* cq_head;
+	uint32_t* cq_tail;
+	uint32_t* cq_mask;
+	struct io_uring_cqe* cqes;
+	void* sq_ring;
+	size_t sq_ring_len;
+	void* cq_ring;
+	size_t cq_ring_len;
+	size_t sqes_len;
+	// IORING_OP_WRITEV only, must stay valid until the write completed
+	struct iovec iov[PCAP_DIRECT_MAX_BUFS];
+};
+
+static void uring_free(struct pcap_direct_uring* uring) {
+	if (uring->sqes) {
+		munmap(uring->sqes, uring->sqes_len);
+	}
+	if (uring->cq_ring) {
+		munmap(uring->cq_ring, uring->cq_ring_len);
+	}
+	if (uring->sq_ring) {
+		munmap(uring->sq_ring, uring->sq_ring_len);
+	}
+	close(uring->fd);
+	rte_free(uring);
+}
+
+// IORING_OP_WRITE was added in 5.6 together with the probe, older kernels fail the probe with EINVAL
+static uint8_t uring_write_opcode(int fd) {
+	uint8_t opcode = IORING_OP_WRITEV;
+#ifdef IO_URING_OP_SUPPORTED
+	size_t len = sizeof(struct io_uring_probe) + (IORING_OP_WRITE + 1) * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe* probe = calloc(1, len);
+	if (probe && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_WRITE + 1) == 0
+	&& probe->last_op >= IORING_OP_WRITE && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)) {
+		opcode = IORING_OP_WRITE;
+	}
+	free(probe);
+#endif
+	return opcode;
+}
+
+// returns NULL if io_uring is not supported, e.g., old kernel or disabled by seccomp
+static struct pcap_direct_uring* uring_create(struct pcap_direct_writer* writer, int32_t socket) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = syscall(__NR_io_uring_setup, writer->num_bufs, &params);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct pcap_direct_uring* uring = rte_zmalloc_socket("pcap_direct_uring", sizeof(struct pcap_direct_uring), RTE_CACHE_LINE_SIZE, socket);
+	if (!uring) {
+		close(fd);
+		return NULL;
+	}
+	uring->fd = fd;
+	uring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	uring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	uint8_t* sq = mmap(NULL, uring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	uint8_t* cq = mmap(NULL, uring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	void* sqes = mmap(NULL, uring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	uring->sq_ring = sq == MAP_FAILED ? NULL : sq;
+	uring->cq_ring = cq == MAP_FAILED ? NULL : cq;
+	uring->sqes = sqes == MAP_FAILED ? NULL : sqes;
+	if (!uring->sq_ring || !uring->cq_ring || !uring->sqes) {
+		uring_free(uring);
+		return NULL;
+	}
+	uring->sq_head = (uint32_t*) (sq + params.sq_off.head);
+	uring->sq_tail = (uint32_t*) (sq + params.sq_off.tail);
+	uring->sq_mask = (uint32_t*) (sq + params.sq_off.ring_mask);
+	uring->sq_array = (uint32_t*) (sq + params.sq_off.array);
+	uring->cq_head = (uint32_t*) (cq + params.cq_off.head);
+	uring->cq_tail = (uint32_t*) (cq + params.cq_off.tail);
+	uring->cq_mask = (uint32_t*) (cq + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+	// registered buffers are pinned once instead of on every write
+	struct iovec iov[PCAP_DIRECT_MAX_BUFS];
+	for (uint32_t i = 0; i < writer->num_bufs; i++) {
+		iov[i].iov_base = writer->bufs[i].data;
+		iov[i].iov_len = writer->buf_size;
+	}
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, writer->num_bufs) == 0) {
+		uring->opcode = IORING_OP_WRITE_FIXED;
+	} else {
+		uring->opcode = uring_write_opcode(fd);
+	}
+	return uring;
+}
+
+static void uring_submit(struct pcap_direct_writer* writer, uint32_t id) {
+	struct pcap_direct_uring* uring = writer->uring;
+	struct pcap_direct_buf* buf = &writer->bufs[id];
+	uint32_t tail = *uring->sq_tail;
+	uint32_t idx = tail & *uring->sq_mask;
+	struct io_uring_sqe* sqe = &uring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = uring->opcode;
+	sqe->fd = writer->fd;
+	if (uring->opcode == IORING_OP_WRITEV) {
+		uring->iov[id].iov_base = buf->data + buf->done;
+		uring->iov[id].iov_len = buf->len - buf->done;
+		sqe->addr = (uint64_t) (uintptr_t) &uring->iov[id];
+		sqe->len = 1;
+	} else {
+		sqe->addr = (uint64_t) (uintptr_t) (buf->data + buf->done);
+		sqe->len = buf->len - buf->done;
+	}
+	sqe->off = buf->file_offset + buf->done;
+	sqe->buf_index = id;
+	sqe->user_data = id;
+	uring->sq_array[idx] = idx;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	while (syscall(__NR_io_uring_enter, uring->fd, 1, 0, 0, NULL, 0) < 0 && errno == EINTR);
+}
+
+#else
+
+struct pcap_direct_uring;
+
+static struct pcap_direct_uring* uring_create(struct pcap_direct_writer* writer, int32_t socket) {
+	return NULL;
+}
+
+static void uring_free(struct pcap_direct_uring* uring) {
+}
+
+static void uring_submit(struct pcap_direct_writer* writer, uint32_t id) {
+}
+
+#endif
+
+// now is the time at which the completion was seen, completions are only polled when writing or reading the stats
+static void complete(struct pcap_direct_writer* writer, uint32_t id, uint64_t now) {
+	struct pcap_direct_buf* buf = &writer->bufs[id];
+	uint64_t latency = now - buf->submit_tsc;
+	writer->stats.reap_latency_cycles += latency;
+	if (latency > writer->stats.max_reap_latency_cycles) {
+		writer->stats.max_reap_latency_cycles = latency;
+	}
+	writer->stats.writes++;
+	writer->stats.bytes += buf->done;
+	writer->stats.queue_depth--;
+	buf->in_flight = 0;
+}
+
+// adds a (short) write to the completed bytes, returns 0 if the write made no progress
+// O_DIRECT writes must start at an aligned offset, so the unaligned tail of a short write is written again
+static uint8_t advance(struct pcap_direct_writer* writer, struct pcap_direct_buf* buf, uint32_t written) {
+	uint32_t done = buf->done + written;
+	if (writer->stats.direct && done < buf->len) {
+		done &= ~(PCAP_DIRECT_ALIGN - 1);
+	}
+	if (done <= buf->done) {
+		return 0;
+	}
+	buf->done = done;
+	return 1;
+}
+
+// processes completed writes, blocks until at least one write completed if wait is set
+static void reap(struct pcap_direct_writer* writer, uint8_t wait) {
+#ifdef PCAP_DIRECT_HAVE_URING
+	struct pcap_direct_uring* uring = writer->uring;
+	if (!uring) {
+		return;
+	}
+	if (wait) {
+		while (syscall(__NR_io_uring_enter, uring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno == EINTR);
+	}
+	uint32_t head = *uring->cq_head;
+	uint32_t tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	uint64_t now = head != tail ? read_rdtsc() : 0;
+	while (head != tail) {
+		struct io_uring_cqe* cqe = &uring->cqes[head & *uring->cq_mask];
+		uint32_t id = cqe->user_data;
+		struct pcap_direct_buf* buf = &writer->bufs[id];
+		if (cqe->res <= 0 || !advance(writer, buf, cqe->res)) {
+			// data is lost, the file keeps its size to not shift the following records
+			writer->stats.errors++;
+			buf->done = buf->len;
+			complete(writer, id, now);
+		} else if (buf->done < buf->len) {
+			uring_submit(writer, id);
+		} else {
+			complete(writer, id, now);
+		}
+		head++;
+	}
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+#endif
+}
+
+static void submit(struct pcap_direct_writer* writer, uint32_t id, uint32_t len) {
+	struct pcap_direct_buf* buf = &writer->bufs[id];
+	buf->len = len;
+	buf->done = 0;
+	buf->file_offset = writer->file_offset;
+	buf->in_flight = 1;
+	buf->submit_tsc = read_rdtsc();
+	writer->file_offset += len;
+	writer->stats.queue_depth++;
+	writer->stats.queue_depth_sum += writer->stats.queue_depth;
+	if (writer->stats.queue_depth > writer->stats.max_queue_depth) {
+		writer->stats.max_queue_depth = writer->stats.queue_depth;
+	}
+	if (writer->uring) {
+		uring_submit(writer, id);
+		reap(writer, 0);
+		return;
+	}
+	while (buf->done < buf->len) {
+		ssize_t res = pwrite(writer->fd, buf->data + buf->done, buf->len - buf->done, buf->file_offset + buf->done);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0 || !advance(writer, buf, res)) {
+			writer->stats.errors++;
+			buf->done = buf->len;
+		}
+	}
+	complete(writer, id, read_rdtsc());
+}
+
+// submits the current buffer and waits until the next one is available
+static void next_buffer(struct pcap_direct_writer* writer) {
+	submit(writer, writer->cur, writer->buf_size);
+	writer->cur = (writer->cur + 1) % writer->num_bufs;
+	writer->fill = 0;
+	if (writer->bufs[writer->cur].in_flight) {
+		writer->stats.stalls++;
+		while (writer->bufs[writer->cur].in_flight) {
+			reap(writer, 1);
+		}
+	}
+}
+
+// buf_size: size of each buffer, rounded up to PCAP_DIRECT_ALIGN, should be at least a few 100 KiB
+// num_bufs: number of buffers, i.e., the maximum number of writes in flight, at least 2
+// returns NULL and sets errno on failure
+struct pcap_direct_writer* pcap_direct_create(const char* filename, uint32_t format, uint32_t buf_size, uint32_t num_bufs, uint64_t start_ns, int32_t socket) {
+	buf_size = (buf_size + PCAP_DIRECT_ALIGN - 1) & ~(PCAP_DIRECT_ALIGN - 1);
+	if (buf_size < PCAP_DIRECT_MAX_RECORD || num_bufs < 2 || num_bufs > PCAP_DIRECT_MAX_BUFS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	struct pcap_direct_writer* writer = rte_zmalloc_socket("pcap_direct_writer", sizeof(struct pcap_direct_writer), RTE_CACHE_LINE_SIZE, socket);
+	if (!writer) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	writer->format = format;
+	writer->buf_size = buf_size;
+	writer->num_bufs = num_bufs;
+	writer->start_ns = start_ns;
+	writer->fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC | O_DIRECT, 0666);
+	writer->stats.direct = writer->fd >= 0;
+	if (writer->fd < 0 && errno == EINVAL) {
+		// the file system does not support O_DIRECT, still useful for testing
+		writer->fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+	}
+	if (writer->fd < 0) {
+		int err = errno;
+		rte_free(writer);
+		errno = err;
+		return NULL;
+	}
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		writer->bufs[i].data = rte_malloc_socket("pcap_direct_buf", buf_size, PCAP_DIRECT_ALIGN, socket);
+		if (!writer->bufs[i].data) {
+			for (uint32_t j = 0; j < i; j++) {
+				rte_free(writer->bufs[j].data);
+			}
+			close(writer->fd);
+			rte_free(writer);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+	writer->uring = uring_create(writer, socket);
+	writer->stats.uring = writer->uring != NULL;
+	if (format == PCAP_DIRECT_PCAPNG) {
+		writer->fill = libmoon_write_pcapng_shb(writer->bufs[0].data);
+	} else {
+		writer->fill = libmoon_write_pcap_header(writer->bufs[0].data);
+	}
+	return writer;
+}
+
+// copies a record that was assembled in writer->record, the record may cross a buffer boundary
+static void append(struct pcap_direct_writer* writer, const uint8_t* record, uint32_t len) {
+	while (len) {
+		uint32_t n = RTE_MIN(len, writer->buf_size - writer->fill);
+		memcpy(writer->bufs[writer->cur].data + writer->fill, record, n);
+		writer->fill += n;
+		record += n;
+		len -= n;
+		if (writer->fill == writer->buf_size) {
+			next_buffer(writer);
+		}
+	}
+}
+
+static inline uint32_t record_overhead(struct pcap_direct_writer* writer) {
+	return writer->format == PCAP_DIRECT_PCAPNG ? sizeof(struct pcapngEnhancedPacketBlock) + 3 + 4 : sizeof(struct pcapRecHeader);
+}
+
+// writes a packet with an absolute timestamp, returns 0 if a previous write failed
+static uint8_t write_record(struct pcap_direct_writer* writer, const void* data, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns) {
+	len = RTE_MIN(len, PCAP_DIRECT_MAX_RECORD - record_overhead(writer));
+	// records are written directly into the buffer if they fit, the common case
+	uint8_t* dst = writer->buf_size - writer->fill >= len + record_overhead(writer) ? writer->bufs[writer->cur].data + writer->fill : writer->record;
+	uint32_t size;
+	if (writer->format == PCAP_DIRECT_PCAPNG) {
+		size = libmoon_write_pcapng(dst, data, len, orig_len, interface_id, ts_ns);
+	} else {
+		libmoon_write_pcap((struct pcapRecHeader*) dst, data, len, orig_len, ts_ns / 1000000000, ts_ns % 1000000000 / 1000);
+		size = sizeof(struct pcapRecHeader) + len;
+	}
+	if (dst == writer->record) {
+		append(writer, dst, size);
+	} else {
+		writer->fill += size;
+		if (writer->fill == writer->buf_size) {
+			next_buffer(writer);
+		}
+	}
+	return writer->stats.errors == 0;
+}
+
+// writes a single packet, the timestamp is relative to start_ns
+// returns 0 if writing to the disk failed
+uint8_t pcap_direct_write(struct pcap_direct_writer* writer, const void* data, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns) {
+	return write_record(writer, data, len, orig_len, interface_id, writer->start_ns + ts_ns);
+}
+
+// writes a burst of packets with the same timestamp relative to start_ns, packets are truncated to snap_len
+// returns the number of packets written, 0 if writing to the disk failed
+uint32_t pcap_direct_write_burst(struct pcap_direct_writer* writer, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t snap_len, uint32_t interface_id, uint64_t ts_ns) {
+	ts_ns += writer->start_ns;
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		struct rte_mbuf* buf = bufs[i];
+		write_record(writer, rte_pktmbuf_mtod(buf, void*), RTE_MIN(buf->data_len, snap_len), buf->pkt_len, interface_id, ts_ns);
+	}
+	// poll completions without blocking to keep the queue depth up to date
+	reap(writer, 0);
+	return writer->stats.errors ? 0 : num_bufs;
+}
+
+// adds a pcapng interface with nanosecond timestamps, returns the size of the interface block
+uint32_t pcap_direct_add_interface(struct pcap_direct_writer* writer, const char* name, uint32_t name_len, uint16_t link_type, uint32_t snap_len) {
+	name_len = RTE_MIN(name_len, 256);
+	uint32_t size = libmoon_write_pcapng_idb(writer->record, name, name_len, link_type, snap_len);
+	append(writer, writer->record, size);
+	return size;
+}
+
+struct pcap_direct_stats* pcap_direct_get_stats(struct pcap_direct_writer* writer) {
+	reap(writer, 0);
+	return &writer->stats;
+}
+
+// flushes all buffers and closes the file, returns the file size or -1 if a write failed
+int64_t pcap_direct_close(struct pcap_direct_writer* writer) {
+	uint64_t size = writer->file_offset + writer->fill;
+	if (writer->fill) {
+		// O_DIRECT writes must be aligned, the padding is truncated below
+		uint32_t len = (writer->fill + PCAP_DIRECT_ALIGN - 1) & ~(PCAP_DIRECT_ALIGN - 1);
+		memset(writer->bufs[writer->cur].data + writer->fill, 0, len - writer->fill);
+		submit(writer, writer->cur, len);
+	}
+	for (uint32_t i = 0; i < writer->num_bufs; i++) {
+		while (writer->bufs[i].in_flight) {
+			reap(writer, 1);
+		}
+	}
+	if (ftruncate(writer->fd, size)) {
+		writer->stats.errors++;
+	}
+	close(writer->fd);
+	if (writer->uring) {
+		uring_free(writer->uring);
+	}
+	for (uint32_t i = 0; i < writer->num_bufs; i++) {
+		rte_free(writer->bufs[i].data);
+	}
+	int64_t result = writer->stats.errors ? -1 : (int64_t) size;
+	rte_free(writer);
+	return result;
+}
@@ -0,0 +1,87 @@
+#ifndef MG_PCAP_DIRECT_H
+#define MG_PCAP_DIRECT_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// O_DIRECT requires buffers, lengths, and offsets aligned to the logical block size, 4 KiB covers all devices
+#define PCAP_DIRECT_ALIGN 4096
+#define PCAP_DIRECT_MAX_BUFS 64
+// large enough for a pcapng block containing a jumbo frame
+#define PCAP_DIRECT_MAX_RECORD (16 * 1024)
+
+enum pcap_direct_format {
+	PCAP_DIRECT_PCAP = 0,
+	PCAP_DIRECT_PCAPNG = 1,
+};
+
+struct pcap_direct_stats {
+	uint64_t writes;
+	uint64_t bytes;
+	// time from submission of a write until its completion was reaped, completions are only polled when
+	// writing or reading the stats, so this is an upper bound of the disk latency
+	uint64_t reap_latency_cycles;
+	uint64_t max_reap_latency_cycles;
+	// number of writes in flight, sampled at every submission
+	uint64_t queue_depth_sum;
+	uint32_t queue_depth;
+	uint32_t max_queue_depth;
+	// the writer had to wait for a buffer to complete, i.e., the disk is too slow
+	uint64_t stalls;
+	uint64_t errors;
+	// 1 if the file was opened with O_DIRECT, 0 if the file system does not support it (e.g., old tmpfs)
+	uint8_t direct;
+	// 1 if writes are submitted with io_uring, 0 if they are written synchronously with pwrite()
+	uint8_t uring;
+};
+
+struct pcap_direct_buf {
+	uint8_t* data;
+	uint64_t file_offset;
+	uint32_t len;
+	// bytes completed so far, writes are resubmitted after short writes
+	uint32_t done;
+	uint8_t in_flight;
+	uint64_t submit_tsc;
+};
+
+struct pcap_direct_uring;
+
+// capture writer bypassing the page cache, not thread-safe
+// records are collected in aligned buffers on huge pages, full buffers are written asynchronously while
+// the next buffer is filled, the writer only blocks if all buffers are in flight
+struct pcap_direct_writer {
+	int fd;
+	uint32_t format;
+	uint32_t buf_size;
+	uint32_t num_bufs;
+	// buffer that is currently filled and the fill level
+	uint32_t cur;
+	uint32_t fill;
+	// file offset of the current buffer
+	uint64_t file_offset;
+	uint64_t start_ns;
+	struct pcap_direct_uring* uring;
+	struct pcap_direct_buf bufs[PCAP_DIRECT_MAX_BUFS];
+	struct pcap_direct_stats stats;
+	// records crossing a buffer boundary are assembled here
+	uint8_t record[PCAP_DIRECT_MAX_RECORD];
+};
+
+struct pcap_direct_writer* pcap_direct_create(const char* filename, uint32_t format, uint32_t buf_size, uint32_t num_bufs, uint64_t start_ns, int32_t socket);
+uint8_t pcap_direct_write(struct pcap_direct_writer* writer, const void* data, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns);
+uint32_t pcap_direct_write_burst(struct pcap_direct_writer* writer, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t snap_len, uint32_t interface_id, uint64_t ts_ns);
+uint32_t pcap_direct_add_interface(struct pcap_direct_writer* writer, const char* name, uint32_t name_len, uint16_t link_type, uint32_t snap_len);
+struct pcap_direct_stats* pcap_direct_get_stats(struct pcap_direct_writer* writer);
+int64_t pcap_direct_close(struct pcap_direct_writer* writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
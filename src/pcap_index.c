@@ -0,0 +1,368 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pcap_index.h"
+#include "pcap.h"
+
+// sparse index of pcap and pcapng files stored in a sidecar file
+// seeking walks at most stride records from the closest index entry
+
+#define PCAP_INDEX_INITIAL_CAPACITY 1024
+
+struct pcap_index* pcap_index_create(uint32_t format, uint32_t stride, uint64_t data_start) {
+	struct pcap_index* index = calloc(1, sizeof(struct pcap_index));
+	if (!index) {
+		return NULL;
+	}
+	index->capacity = PCAP_INDEX_INITIAL_CAPACITY;
+	index->entries = malloc(index->capacity * sizeof(struct pcap_index_entry));
+	if (!index->entries) {
+		free(index);
+		return NULL;
+	}
+	index->header.magic = PCAP_INDEX_MAGIC;
+	index->header.version = PCAP_INDEX_VERSION;
+	index->header.format = format;
+	index->header.stride = stride ? stride : 1;
+	index->header.data_start = data_start;
+	index->header.data_end = data_start;
+	return index;
+}
+
+void pcap_index_free(struct pcap_index* index) {
+	free(index->entries);
+	free(index);
+}
+
+// adds the record starting at offset and ending at end, records must be added in file order
+int pcap_index_add(struct pcap_index* index, uint64_t ts_ns, uint64_t offset, uint64_t end) {
+	struct pcap_index_header* header = &index->header;
+	if (header->num_records % header->stride == 0) {
+		if (header->num_entries == index->capacity) {
+			struct pcap_index_entry* entries = realloc(index->entries, index->capacity * 2 * sizeof(struct pcap_index_entry));
+			if (!entries) {
+				return -1;
+			}
+			index->entries = entries;
+			index->capacity *= 2;
+		}
+		struct pcap_index_entry* entry = &index->entries[header->num_entries++];
+		entry->ts_ns = ts_ns;
+		entry->record = header->num_records;
+		entry->offset = offset;
+	}
+	if (!header->num_records || ts_ns < header->first_ts) {
+		header->first_ts = ts_ns;
+	}
+	if (ts_ns > header->last_ts) {
+		header->last_ts = ts_ns;
+	}
+	header->num_records++;
+	header->data_end = end;
+	return 0;
+}
+
+// adds a pcapng interface, must be called for every interface block when building the index while writing
+void pcap_index_add_interface(struct pcap_index* index, const uint8_t* block, uint32_t total_len, uint64_t offset) {
+	uint32_t id = index->state.num_interfaces;
+	libmoon_pcapng_add_interface(&index->state, block, total_len);
+	if (id < index->state.num_interfaces) {
+		index->interface_offsets[id] = offset;
+	}
+}
+
+// reader state for a pcapng reader starting at offset
+void pcap_index_get_state(struct pcap_index* index, uint64_t offset, struct pcapngReaderState* state) {
+	*state = index->state;
+	uint32_t num = 0;
+	while (num < index->state.num_interfaces && index->interface_offsets[num] < offset) {
+		num++;
+	}
+	state->num_interfaces = num;
+}
+
+static inline uint64_t pcapng_ts(struct pcapngReaderState* state, const struct pcapngEnhancedPacketBlock* epb) {
+	uint64_t ts = ((uint64_t) epb->ts_high << 32) | epb->ts_low;
+	if (epb->interface_id < state->num_interfaces) {
+		return (unsigned __int128) ts * state->ts_mul[epb->interface_id] / state->ts_div[epb->interface_id];
+	}
+	return ts * 1000;
+}
+
+// finds the first record at or after offset in an indexed file
+// returns the offset of the record or data_end, the timestamp and the end of the record are stored in ts_ns and end
+static uint64_t next_record(struct pcap_index* index, const uint8_t* data, uint64_t offset, uint64_t* ts_ns, uint64_t* end) {
+	uint64_t data_end = index->header.data_end;
+	if (index->header.format == PCAP_INDEX_PCAPNG) {
+		while (offset < data_end) {
+			const struct pcapngBlockHeader* block = (const struct pcapngBlockHeader*) (data + offset);
+			if (block->type == PCAPNG_EPB) {
+				*ts_ns = pcapng_ts(&index->state, (const struct pcapngEnhancedPacketBlock*) block);
+				*end = offset + block->total_len;
+				return offset;
+			}
+			offset += block->total_len;
+		}
+		return data_end;
+	}
+	if (offset >= data_end) {
+		return data_end;
+	}
+	const struct pcapRecHeader* header = (const struct pcapRecHeader*) (data + offset);
+	*ts_ns = header->ts_sec * 1000000000ULL + (uint64_t) header->ts_usec * (index->header.format == PCAP_INDEX_PCAP_NS ? 1 : 1000);
+	*end = offset + sizeof(struct pcapRecHeader) + header->incl_len;
+	return offset;
+}
+
+// indexes every stride-th record of a mapped file, stops at the first truncated record
+struct pcap_index* pcap_index_build(const uint8_t* data, uint64_t size, uint32_t format, uint32_t stride) {
+	uint64_t offset = format == PCAP_INDEX_PCAPNG ? 0 : PCAP_HEADER_SIZE;
+	struct pcap_index* index = pcap_index_create(format, stride, offset);
+	if (!index) {
+		return NULL;
+	}
+	index->header.file_size = size;
+	uint32_t ts_mul = format == PCAP_INDEX_PCAP_NS ? 1 : 1000;
+	while (offset < size && size - offset >= sizeof(struct pcapngBlockHeader)) {
+		if (format == PCAP_INDEX_PCAPNG) {
+			const struct pcapngBlockHeader* block = (const struct pcapngBlockHeader*) (data + offset);
+			uint32_t total_len = block->total_len;
+			if (total_len < 12 || total_len > size - offset) {
+				break;
+			}
+			if (block->type == PCAPNG_EPB && total_len >= sizeof(struct pcapngEnhancedPacketBlock) + 4) {
+				uint64_t ts = pcapng_ts(&index->state, (const struct pcapngEnhancedPacketBlock*) block);
+				if (pcap_index_add(index, ts, offset, offset + total_len)) {
+					pcap_index_free(index);
+					return NULL;
+				}
+			} else if (block->type == PCAPNG_IDB) {
+				pcap_index_add_interface(index, data + offset, total_len, offset);
+			} else if (block->type == PCAPNG_SHB && offset > 0) {
+				index->header.multi_section = 1;
+			}
+			offset += total_len;
+			// trailing blocks without packets are part of the data
+			index->header.data_end = offset;
+		} else {
+			if (size - offset < sizeof(struct pcapRecHeader)) {
+				break;
+			}
+			const struct pcapRecHeader* header = (const struct pcapRecHeader*) (data + offset);
+			if (header->incl_len > size - offset - sizeof(struct pcapRecHeader)) {
+				break;
+			}
+			uint64_t end = offset + sizeof(struct pcapRecHeader) + header->incl_len;
+			if (pcap_index_add(index, header->ts_sec * 1000000000ULL + (uint64_t) header->ts_usec * ts_mul, offset, end)) {
+				pcap_index_free(index);
+				return NULL;
+			}
+			offset = end;
+		}
+	}
+	return index;
+}
+
+static int write_all(int fd, const void* buf, size_t len) {
+	const uint8_t* ptr = buf;
+	while (len) {
+		ssize_t res = write(fd, ptr, len);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		ptr += res;
+		len -= res;
+	}
+	return 0;
+}
+
+static int read_all(int fd, void* buf, size_t len) {
+	uint8_t* ptr = buf;
+	while (len) {
+		ssize_t res = read(fd, ptr, len);
+		if (res <= 0) {
+			if (res < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		ptr += res;
+		len -= res;
+	}
+	return 0;
+}
+
+// size and modification time of the capture file the index belongs to
+static int stat_capture(const char* capture, uint64_t* size, uint64_t* mtime_ns) {
+	struct stat st;
+	if (stat(capture, &st)) {
+		return -1;
+	}
+	*size = st.st_size;
+	*mtime_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+	return 0;
+}
+
+// writes the index of the file capture to a sidecar file, the sidecar is written to a
+// temporary file and renamed so that readers never see a partially written index
+// returns 0 on success, -1 and sets errno on failure
+int pcap_index_save(struct pcap_index* index, const char* filename, const char* capture) {
+	if (stat_capture(capture, &index->header.file_size, &index->header.file_mtime_ns)) {
+		return -1;
+	}
+	char tmp[PATH_MAX];
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", filename) >= (int) sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	// unique per call, tasks are threads of the same process and may save the index of the same file concurrently
+	int fd = mkstemp(tmp);
+	if (fd < 0) {
+		return -1;
+	}
+	// mkstemp() creates the file with mode 0600
+	int res = fchmod(fd, 0644)
+		|| write_all(fd, &index->header, sizeof(index->header))
+		|| write_all(fd, &index->state, sizeof(index->state))
+		|| write_all(fd, index->interface_offsets, sizeof(index->interface_offsets))
+		|| write_all(fd, index->entries, index->header.num_entries * sizeof(struct pcap_index_entry));
+	res = close(fd) || res;
+	if (!res) {
+		res = rename(tmp, filename);
+	}
+	if (res) {
+		int err = errno;
+		unlink(tmp);
+		errno = err;
+	}
+	return res ? -1 : 0;
+}
+
+// loads a sidecar file, returns NULL if it does not exist or does not belong to the current version of capture
+struct pcap_index* pcap_index_load(const char* filename, const char* capture) {
+	uint64_t file_size, file_mtime_ns;
+	if (stat_capture(capture, &file_size, &file_mtime_ns)) {
+		return NULL;
+	}
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct pcap_index_header header;
+	struct pcap_index* index = NULL;
+	if (read_all(fd, &header, sizeof(header)) == 0
+	 && header.magic == PCAP_INDEX_MAGIC && header.version == PCAP_INDEX_VERSION
+	 && header.file_size == file_size && header.file_mtime_ns == file_mtime_ns
+	 && header.data_end <= file_size && header.stride) {
+		index = pcap_index_create(header.format, header.stride, header.data_start);
+	}
+	if (index) {
+		index->header = header;
+		free(index->entries);
+		index->capacity = header.num_entries ? header.num_entries : 1;
+		index->entries = malloc(index->capacity * sizeof(struct pcap_index_entry));
+		if (!index->entries
+		 || read_all(fd, &index->state, sizeof(index->state))
+		 || read_all(fd, index->interface_offsets, sizeof(index->interface_offsets))
+		 || read_all(fd, index->entries, header.num_entries * sizeof(struct pcap_index_entry))) {
+			pcap_index_free(index);
+			index = NULL;
+		}
+	}
+	if (index && index->state.num_interfaces > PCAPNG_MAX_INTERFACES) {
+		pcap_index_free(index);
+		index = NULL;
+	}
+	for (uint64_t i = 0; index && i < header.num_entries; i++) {
+		if (index->entries[i].offset >= header.data_end) {
+			pcap_index_free(index);
+			index = NULL;
+		}
+	}
+	close(fd);
+	return index;
+}
+
+// returns the offset of the first record with a timestamp >= ts_ns, records are assumed to be sorted by time
+// returns data_end if there is no such record
+uint64_t pcap_index_seek_time(struct pcap_index* index, const uint8_t* data, uint64_t ts_ns) {
+	uint64_t num = index->header.num_entries;
+	if (!num) {
+		return index->header.data_end;
+	}
+	// last entry with a timestamp < ts_ns, the record we are looking for follows it
+	uint64_t lo = 0, hi = num;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (index->entries[mid].ts_ns < ts_ns) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return index->entries[0].offset;
+	}
+	uint64_t offset = index->entries[lo - 1].offset;
+	uint64_t ts, end;
+	while ((offset = next_record(index, data, offset, &ts, &end)) < index->header.data_end && ts < ts_ns) {
+		offset = end;
+	}
+	return offset;
+}
+
+// returns the offset of the nth record (starting at 0) or data_end if the file has fewer records
+uint64_t pcap_index_seek_record(struct pcap_index* index, const uint8_t* data, uint64_t record) {
+	if (record >= index->header.num_records) {
+		return index->header.data_end;
+	}
+	struct pcap_index_entry* entry = &index->entries[record / index->header.stride];
+	uint64_t offset = entry->offset;
+	uint64_t ts, end;
+	for (uint64_t i = entry->record; i < record; i++) {
+		next_record(index, data, offset, &ts, &end);
+		offset = next_record(index, data, end, &ts, &end);
+	}
+	return offset;
+}
+
+// splits the records in [start, end) into num_ranges byte ranges of roughly equal size that start at record boundaries
+// start must be the offset of a record, e.g., returned by a seek function, end is clamped to data_end
+// stores num_ranges + 1 bounds, range i is [bounds[i], bounds[i + 1]), ranges may be empty for small files
+void pcap_index_split(struct pcap_index* index, uint64_t start, uint64_t end, uint32_t num_ranges, uint64_t* bounds) {
+	if (end > index->header.data_end) {
+		end = index->header.data_end;
+	}
+	if (start > end) {
+		start = end;
+	}
+	uint64_t num = index->header.num_entries;
+	bounds[0] = start;
+	for (uint32_t i = 1; i < num_ranges; i++) {
+		uint64_t target = start + (end - start) / num_ranges * i;
+		// first entry at or after the target
+		uint64_t lo = 0, hi = num;
+		while (lo < hi) {
+			uint64_t mid = lo + (hi - lo) / 2;
+			if (index->entries[mid].offset < target) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		bounds[i] = lo < num && index->entries[lo].offset < end ? index->entries[lo].offset : end;
+		if (bounds[i] < bounds[i - 1]) {
+			bounds[i] = bounds[i - 1];
+		}
+	}
+	bounds[num_ranges] = end;
+}
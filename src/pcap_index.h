@@ -0,0 +1,77 @@
+#ifndef MG_PCAP_INDEX_H
+#define MG_PCAP_INDEX_H
+
+#include <stdint.h>
+
+#include "pcap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PCAP_INDEX_MAGIC 0x3158495041434D4CULL // "LMCAPIX1"
+#define PCAP_INDEX_VERSION 2
+
+enum pcap_index_format {
+	// classic pcap with microsecond timestamps
+	PCAP_INDEX_PCAP_US = 0,
+	// classic pcap with nanosecond timestamps (magic 0xa1b23c4d)
+	PCAP_INDEX_PCAP_NS = 1,
+	PCAP_INDEX_PCAPNG = 2,
+};
+
+// every stride-th record of the file
+struct pcap_index_entry {
+	uint64_t ts_ns;
+	uint64_t record;
+	uint64_t offset;
+};
+
+// sidecar file: header, reader state, interface offsets, and entries
+struct pcap_index_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t format;
+	uint32_t stride;
+	// pcapng files with multiple sections can not be indexed, interface ids are scoped to a section
+	uint32_t multi_section;
+	// size and modification time of the indexed file, the index is stale if either changed
+	uint64_t file_size;
+	uint64_t file_mtime_ns;
+	// offset of the first record and the end of the last complete record
+	uint64_t data_start;
+	uint64_t data_end;
+	uint64_t num_records;
+	uint64_t num_entries;
+	uint64_t first_ts;
+	uint64_t last_ts;
+};
+
+// sparse index mapping timestamps and record numbers to file offsets
+struct pcap_index {
+	struct pcap_index_header header;
+	// reader state after all interfaces of a pcapng file were read, needed to start reading in the middle
+	struct pcapngReaderState state;
+	// interface description blocks can appear anywhere, readers starting at an offset only know the ones before it
+	uint64_t interface_offsets[PCAPNG_MAX_INTERFACES];
+	uint64_t capacity;
+	struct pcap_index_entry* entries;
+};
+
+struct pcap_index* pcap_index_create(uint32_t format, uint32_t stride, uint64_t data_start);
+void pcap_index_free(struct pcap_index* index);
+int pcap_index_add(struct pcap_index* index, uint64_t ts_ns, uint64_t offset, uint64_t end);
+void pcap_index_add_interface(struct pcap_index* index, const uint8_t* block, uint32_t total_len, uint64_t offset);
+struct pcap_index* pcap_index_build(const uint8_t* data, uint64_t size, uint32_t format, uint32_t stride);
+int pcap_index_save(struct pcap_index* index, const char* filename, const char* capture);
+struct pcap_index* pcap_index_load(const char* filename, const char* capture);
+uint64_t pcap_index_seek_time(struct pcap_index* index, const uint8_t* data, uint64_t ts_ns);
+uint64_t pcap_index_seek_record(struct pcap_index* index, const uint8_t* data, uint64_t record);
+void pcap_index_get_state(struct pcap_index* index, uint64_t offset, struct pcapngReaderState* state);
+void pcap_index_split(struct pcap_index* index, uint64_t start, uint64_t end, uint32_t num_ranges, uint64_t* bounds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
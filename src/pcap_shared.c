@@ -0,0 +1,193 @@
+// fallocate()
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <rte_config.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+
+#include "pcap_shared.h"
+#include "pcap.h"
+
+// file size is a multiple of this to keep the mapped chunks page-aligned, also fits huge pages
+#define PCAP_SHARED_ALIGN (2 * 1024 * 1024)
+
+static uint64_t align_up(uint64_t size) {
+	return (size + PCAP_SHARED_ALIGN - 1) & ~(uint64_t) (PCAP_SHARED_ALIGN - 1);
+}
+
+// allocates and maps file space until at least end bytes are mapped
+static int grow(struct pcap_shared_writer* writer, uint64_t end) {
+	pthread_mutex_lock(&writer->grow_lock);
+	uint64_t mapped = writer->mapped;
+	while (mapped < end) {
+		uint64_t len = writer->chunk_size;
+		if (mapped + len > writer->max_size) {
+			len = writer->max_size - mapped;
+		}
+		if (fallocate(writer->fd, 0, mapped, len)) {
+			break;
+		}
+		// replaces part of the reserved range, existing mappings are not touched
+		if (mmap(writer->base + mapped, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, writer->fd, mapped) == MAP_FAILED) {
+			break;
+		}
+		mapped += len;
+		__atomic_store_n(&writer->mapped, mapped, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&writer->grow_lock);
+	return mapped >= end ? 0 : -1;
+}
+
+// chunk_size: the file grows in steps of this size
+// max_size: size of the reserved virtual address range, only address space is reserved, not memory
+// returns NULL and sets errno on failure
+struct pcap_shared_writer* pcap_shared_create(const char* filename, uint32_t format, uint64_t chunk_size, uint64_t max_size, uint64_t start_ns) {
+	chunk_size = align_up(chunk_size);
+	max_size = align_up(max_size < chunk_size ? chunk_size : max_size);
+	struct pcap_shared_writer* writer = rte_zmalloc("pcap_shared_writer", sizeof(struct pcap_shared_writer), RTE_CACHE_LINE_SIZE);
+	if (!writer) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	writer->fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, 0666);
+	if (writer->fd < 0) {
+		rte_free(writer);
+		return NULL;
+	}
+	void* base = mmap(NULL, max_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		int err = errno;
+		close(writer->fd);
+		rte_free(writer);
+		errno = err;
+		return NULL;
+	}
+	writer->base = base;
+	writer->format = format;
+	writer->chunk_size = chunk_size;
+	writer->max_size = max_size;
+	writer->overflow = UINT64_MAX;
+	writer->start_ns = start_ns;
+	pthread_mutex_init(&writer->grow_lock, NULL);
+	pthread_mutex_init(&writer->interface_lock, NULL);
+	if (grow(writer, chunk_size)) {
+		int err = errno;
+		pthread_mutex_destroy(&writer->grow_lock);
+		pthread_mutex_destroy(&writer->interface_lock);
+		munmap(base, max_size);
+		close(writer->fd);
+		rte_free(writer);
+		errno = err;
+		return NULL;
+	}
+	if (format == PCAP_SHARED_PCAPNG) {
+		writer->offset = libmoon_write_pcapng_shb(writer->base);
+	} else {
+		writer->offset = libmoon_write_pcap_header(writer->base);
+	}
+	return writer;
+}
+
+// reserves len bytes in the file, the returned memory stays valid until the writer is closed
+// returns NULL if the file would exceed max_size or the file system is full
+uint8_t* pcap_shared_reserve(struct pcap_shared_writer* writer, uint64_t len) {
+	uint64_t start = __atomic_fetch_add(&writer->offset, len, __ATOMIC_RELAXED);
+	uint64_t end = start + len;
+	uint64_t overflow = __atomic_load_n(&writer->overflow, __ATOMIC_RELAXED);
+	if (start >= overflow) {
+		// the file is truncated before this record
+		return NULL;
+	}
+	if (end > __atomic_load_n(&writer->mapped, __ATOMIC_ACQUIRE) && grow(writer, end)) {
+		// the file ends at the earliest failed reservation
+		while (start < overflow && !__atomic_compare_exchange_n(&writer->overflow, &overflow, start, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+		return NULL;
+	}
+	return writer->base + start;
+}
+
+// adds a pcapng interface with nanosecond timestamps, e.g., one per thread
+// the interface must be added before packets referring to it are written
+// returns the interface id or -1 if the file is full or not a pcapng file
+int32_t pcap_shared_add_interface(struct pcap_shared_writer* writer, const char* name, uint32_t name_len, uint16_t link_type, uint32_t snap_len) {
+	if (writer->format != PCAP_SHARED_PCAPNG) {
+		return -1;
+	}
+	// ids are implicitly given by the order of the interface blocks in the file
+	pthread_mutex_lock(&writer->interface_lock);
+	uint8_t* dst = pcap_shared_reserve(writer, libmoon_pcapng_idb_size(name_len));
+	int32_t id = -1;
+	if (dst) {
+		libmoon_write_pcapng_idb(dst, name, name_len, link_type, snap_len);
+		id = writer->next_interface++;
+	}
+	pthread_mutex_unlock(&writer->interface_lock);
+	return id;
+}
+
+static inline uint32_t record_size(struct pcap_shared_writer* writer, uint32_t len) {
+	if (writer->format == PCAP_SHARED_PCAPNG) {
+		return sizeof(struct pcapngEnhancedPacketBlock) + ((len + 3) & ~3) + 4;
+	}
+	return sizeof(struct pcapRecHeader) + len;
+}
+
+// writes a record to dst, returns its size
+static inline uint32_t write_record(struct pcap_shared_writer* writer, uint8_t* dst, const void* data, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns) {
+	if (writer->format == PCAP_SHARED_PCAPNG) {
+		return libmoon_write_pcapng(dst, data, len, orig_len, interface_id, ts_ns);
+	}
+	libmoon_write_pcap((struct pcapRecHeader*) dst, data, len, orig_len, ts_ns / 1000000000, ts_ns % 1000000000 / 1000);
+	return sizeof(struct pcapRecHeader) + len;
+}
+
+// writes a single packet, the timestamp is relative to start_ns
+// returns 0 if the file is full
+uint8_t pcap_shared_write(struct pcap_shared_writer* writer, const void* data, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns) {
+	uint8_t* dst = pcap_shared_reserve(writer, record_size(writer, len));
+	if (!dst) {
+		return 0;
+	}
+	write_record(writer, dst, data, len, orig_len, interface_id, writer->start_ns + ts_ns);
+	return 1;
+}
+
+// writes a burst of packets with a single reservation, all packets get the same timestamp relative to start_ns
+// packets are truncated to snap_len, chained mbufs are not supported
+// returns the number of packets written, i.e., 0 or num_bufs
+uint32_t pcap_shared_write_burst(struct pcap_shared_writer* writer, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t snap_len, uint32_t interface_id, uint64_t ts_ns) {
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		total += record_size(writer, RTE_MIN(bufs[i]->data_len, snap_len));
+	}
+	uint8_t* dst = pcap_shared_reserve(writer, total);
+	if (!dst) {
+		return 0;
+	}
+	ts_ns += writer->start_ns;
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		struct rte_mbuf* buf = bufs[i];
+		dst += write_record(writer, dst, rte_pktmbuf_mtod(buf, void*), RTE_MIN(buf->data_len, snap_len), buf->pkt_len, interface_id, ts_ns);
+	}
+	return num_bufs;
+}
+
+// unmaps the file and truncates it to the written size, returns the file size
+// all threads must be done writing
+uint64_t pcap_shared_close(struct pcap_shared_writer* writer) {
+	uint64_t size = RTE_MIN(writer->offset, writer->overflow);
+	munmap(writer->base, writer->max_size);
+	if (ftruncate(writer->fd, size) == 0) {
+		fsync(writer->fd);
+	}
+	close(writer->fd);
+	pthread_mutex_destroy(&writer->grow_lock);
+	pthread_mutex_destroy(&writer->interface_lock);
+	rte_free(writer);
+	return size;
+}
@@ -0,0 +1,54 @@
+#ifndef MG_PCAP_SHARED_H
+#define MG_PCAP_SHARED_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum pcap_shared_format {
+	PCAP_SHARED_PCAP = 0,
+	PCAP_SHARED_PCAPNG = 1,
+};
+
+// pcap(ng) writer shared by multiple threads writing to a single file
+// threads reserve space for a burst of records with an atomic fetch-add on the file offset, records are
+// therefore ordered by timestamp only within a thread
+// the file is mapped into a virtual address range reserved upfront, the file grows in chunks that are mapped
+// behind the existing ones, so growing the file never moves memory other threads are writing to
+struct pcap_shared_writer {
+	// next free byte in the file, written by all threads
+	uint64_t offset __attribute__((aligned(64)));
+	// bytes of the file that are allocated and mapped, grows monotonically
+	uint64_t mapped __attribute__((aligned(64)));
+	uint32_t next_interface;
+	// start of the reservation that exceeded max_size, the file is truncated there
+	uint64_t overflow;
+	pthread_mutex_t grow_lock;
+	// serializes adding interfaces so that ids match the order of interface blocks
+	pthread_mutex_t interface_lock;
+	int fd;
+	uint32_t format;
+	uint8_t* base;
+	uint64_t chunk_size;
+	uint64_t max_size;
+	// added to relative timestamps, shared so that all threads use the same time base
+	uint64_t start_ns;
+};
+
+struct pcap_shared_writer* pcap_shared_create(const char* filename, uint32_t format, uint64_t chunk_size, uint64_t max_size, uint64_t start_ns);
+uint8_t* pcap_shared_reserve(struct pcap_shared_writer* writer, uint64_t len);
+int32_t pcap_shared_add_interface(struct pcap_shared_writer* writer, const char* name, uint32_t name_len, uint16_t link_type, uint32_t snap_len);
+uint8_t pcap_shared_write(struct pcap_shared_writer* writer, const void* data, uint32_t len, uint32_t orig_len, uint32_t interface_id, uint64_t ts_ns);
+uint32_t pcap_shared_write_burst(struct pcap_shared_writer* writer, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t snap_len, uint32_t interface_id, uint64_t ts_ns);
+uint64_t pcap_shared_close(struct pcap_shared_writer* writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,282 @@
+#include <stdint.h>
+#include <string.h>
+#include <rte_config.h>
+#include <rte_byteorder.h>
+#include <rte_mbuf.h>
+#include <rte_prefetch.h>
+
+#include "ptype.h"
+#include "checksum.h"
+
+// software packet type parser for NICs that do not report (all) packet types
+// fills packet_type and the l2/l3/l4 lengths used by checksum and TSO offloading
+// for VXLAN packets the lengths follow the DPDK tunnel conventions:
+// outer_l2_len and outer_l3_len describe the outer headers, l2_len covers outer UDP + VXLAN + inner L2
+
+#define ETHER_TYPE_IPV4 0x0800
+#define ETHER_TYPE_IPV6 0x86DD
+#define ETHER_TYPE_VLAN 0x8100
+#define ETHER_TYPE_QINQ 0x88A8
+#define ETHER_TYPE_QINQ_OLD 0x9100
+
+#define PROTO_ICMP 1
+#define PROTO_TCP 6
+#define PROTO_UDP 17
+#define PROTO_ICMPV6 58
+#define PROTO_SCTP 132
+
+// IPv6 extension headers
+#define PROTO_HOPOPTS 0
+#define PROTO_ROUTING 43
+#define PROTO_FRAGMENT 44
+#define PROTO_AH 51
+#define PROTO_DSTOPTS 60
+
+enum l2_kind { L2_NONE, L2_ETHER, L2_VLAN, L2_QINQ };
+enum l3_kind { L3_NONE, L3_IPV4, L3_IPV4_EXT, L3_IPV6, L3_IPV6_EXT };
+enum l4_kind { L4_NONE, L4_TCP, L4_UDP, L4_FRAG, L4_SCTP, L4_ICMP, L4_NONFRAG };
+
+// lookup tables, index is the kind
+static const uint32_t outer_l2[] = { 0, RTE_PTYPE_L2_ETHER, RTE_PTYPE_L2_ETHER_VLAN, RTE_PTYPE_L2_ETHER_QINQ };
+static const uint32_t inner_l2[] = { 0, RTE_PTYPE_INNER_L2_ETHER, RTE_PTYPE_INNER_L2_ETHER_VLAN, RTE_PTYPE_INNER_L2_ETHER_QINQ };
+static const uint32_t outer_l3[] = { 0, RTE_PTYPE_L3_IPV4, RTE_PTYPE_L3_IPV4_EXT, RTE_PTYPE_L3_IPV6, RTE_PTYPE_L3_IPV6_EXT };
+static const uint32_t inner_l3[] = { 0, RTE_PTYPE_INNER_L3_IPV4, RTE_PTYPE_INNER_L3_IPV4_EXT, RTE_PTYPE_INNER_L3_IPV6, RTE_PTYPE_INNER_L3_IPV6_EXT };
+static const uint32_t outer_l4[] = {
+	0, RTE_PTYPE_L4_TCP, RTE_PTYPE_L4_UDP, RTE_PTYPE_L4_FRAG,
+	RTE_PTYPE_L4_SCTP, RTE_PTYPE_L4_ICMP, RTE_PTYPE_L4_NONFRAG
+};
+static const uint32_t inner_l4[] = {
+	0, RTE_PTYPE_INNER_L4_TCP, RTE_PTYPE_INNER_L4_UDP, RTE_PTYPE_INNER_L4_FRAG,
+	RTE_PTYPE_INNER_L4_SCTP, RTE_PTYPE_INNER_L4_ICMP, RTE_PTYPE_INNER_L4_NONFRAG
+};
+
+struct layers {
+	enum l2_kind l2;
+	enum l3_kind l3;
+	enum l4_kind l4;
+	uint32_t l2_len;
+	uint32_t l3_len;
+	uint32_t l4_len;
+	// offset of the L4 header and its protocol number
+	uint32_t l4_off;
+	uint8_t proto;
+};
+
+static inline uint16_t read16(const uint8_t* p) {
+	uint16_t v;
+	memcpy(&v, p, 2);
+	return rte_be_to_cpu_16(v);
+}
+
+// parses Ethernet, IPv4/IPv6, and the L4 header length starting at data[off], stops at the first unknown header
+static void parse_layers(const uint8_t* data, uint32_t off, uint32_t len, struct layers* res) {
+	memset(res, 0, sizeof(*res));
+	if (off + 14 > len) {
+		return;
+	}
+	res->l2 = L2_ETHER;
+	uint16_t ether_type = read16(data + off + 12);
+	uint32_t l2_len = 14;
+	// up to two tags: QinQ is an S-tag followed by a C-tag
+	for (int tags = 0; tags < 2; tags++) {
+		if (ether_type != ETHER_TYPE_VLAN && ether_type != ETHER_TYPE_QINQ && ether_type != ETHER_TYPE_QINQ_OLD) {
+			break;
+		}
+		if (off + l2_len + 4 > len) {
+			res->l2_len = l2_len;
+			return;
+		}
+		res->l2 = tags == 0 ? L2_VLAN : L2_QINQ;
+		ether_type = read16(data + off + l2_len + 2);
+		l2_len += 4;
+	}
+	res->l2_len = l2_len;
+	off += l2_len;
+	const uint8_t* l3 = data + off;
+	uint8_t proto;
+	uint32_t l3_len;
+	int fragment = 0;
+	if (ether_type == ETHER_TYPE_IPV4) {
+		if (off + 20 > len || (l3[0] >> 4) != 4) {
+			return;
+		}
+		l3_len = (l3[0] & 0xF) * 4;
+		if (l3_len < 20 || off + l3_len > len) {
+			return;
+		}
+		res->l3 = l3_len > 20 ? L3_IPV4_EXT : L3_IPV4;
+		proto = l3[9];
+		// more fragments flag or fragment offset set
+		fragment = (read16(l3 + 6) & 0x3FFF) != 0;
+	} else if (ether_type == ETHER_TYPE_IPV6) {
+		if (off + 40 > len || (l3[0] >> 4) != 6) {
+			return;
+		}
+		res->l3 = L3_IPV6;
+		proto = l3[6];
+		l3_len = 40;
+		// walk the extension headers, they all start with next header and length
+		while (1) {
+			uint32_t ext_len;
+			if (proto == PROTO_HOPOPTS || proto == PROTO_ROUTING || proto == PROTO_DSTOPTS) {
+				if (off + l3_len + 8 > len) {
+					return;
+				}
+				ext_len = (l3[l3_len + 1] + 1) * 8;
+			} else if (proto == PROTO_AH) {
+				if (off + l3_len + 8 > len) {
+					return;
+				}
+				ext_len = (l3[l3_len + 1] + 2) * 4;
+			} else if (proto == PROTO_FRAGMENT) {
+				if (off + l3_len + 8 > len) {
+					return;
+				}
+				ext_len = 8;
+				fragment = 1;
+			} else {
+				break;
+			}
+			res->l3 = L3_IPV6_EXT;
+			proto = l3[l3_len];
+			l3_len += ext_len;
+		}
+		if (off + l3_len > len) {
+			return;
+		}
+	} else {
+		return;
+	}
+	res->l3_len = l3_len;
+	res->proto = proto;
+	off += l3_len;
+	res->l4_off = off;
+	if (fragment) {
+		res->l4 = L4_FRAG;
+		return;
+	}
+	const uint8_t* l4 = data + off;
+	switch (proto) {
+		case PROTO_TCP:
+			if (off + 20 <= len) {
+				res->l4 = L4_TCP;
+				res->l4_len = (l4[12] >> 4) * 4;
+			}
+			break;
+		case PROTO_UDP:
+			if (off + 8 <= len) {
+				res->l4 = L4_UDP;
+				res->l4_len = 8;
+			}
+			break;
+		case PROTO_ICMP:
+		case PROTO_ICMPV6:
+			res->l4 = L4_ICMP;
+			break;
+		case PROTO_SCTP:
+			res->l4 = L4_SCTP;
+			break;
+		default:
+			res->l4 = L4_NONFRAG;
+			break;
+	}
+}
+
+// parses a single packet and sets packet_type and the header lengths, returns the packet type
+uint32_t ptype_parse(struct rte_mbuf* buf) {
+	const uint8_t* data = rte_pktmbuf_mtod(buf, const uint8_t*);
+	uint32_t len = buf->data_len;
+	struct layers outer;
+	parse_layers(data, 0, len, &outer);
+	uint32_t ptype = outer_l2[outer.l2] | outer_l3[outer.l3] | outer_l4[outer.l4];
+	buf->outer_l2_len = 0;
+	buf->outer_l3_len = 0;
+	if (outer.l4 == L4_UDP && read16(data + outer.l4_off + 2) == PTYPE_VXLAN_PORT
+	&& outer.l4_off + 16 + 14 <= len) {
+		// outer UDP + VXLAN header, the inner packet starts with Ethernet
+		struct layers inner;
+		parse_layers(data, outer.l4_off + 16, len, &inner);
+		ptype |= RTE_PTYPE_TUNNEL_VXLAN | inner_l2[inner.l2] | inner_l3[inner.l3] | inner_l4[inner.l4];
+		buf->outer_l2_len = outer.l2_len;
+		buf->outer_l3_len = outer.l3_len;
+		buf->l2_len = 16 + inner.l2_len;
+		buf->l3_len = inner.l3_len;
+		buf->l4_len = inner.l4_len;
+	} else {
+		buf->l2_len = outer.l2_len;
+		buf->l3_len = outer.l3_len;
+		buf->l4_len = outer.l4_len;
+	}
+	buf->packet_type = ptype;
+	return ptype;
+}
+
+// parses a burst of packets, returns the number of packets with a known L3 header
+uint32_t ptype_parse_burst(struct rte_mbuf** bufs, uint32_t n) {
+	uint32_t num_l3 = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		if (i + 1 < n) {
+			rte_prefetch0(rte_pktmbuf_mtod(bufs[i + 1], void*));
+		}
+		num_l3 += (ptype_parse(bufs[i]) & RTE_PTYPE_L3_MASK) != 0;
+	}
+	return num_l3;
+}
+
+// sets the offloading flags for IPv4, TCP, and UDP checksums based on the parsed packet types,
+// the IPv4 checksum is cleared and the pseudo header checksum is written into the L4 checksum field
+// VXLAN packets get offloading for the inner headers and the outer IPv4 header
+// packets must have been parsed with ptype_parse_burst()
+void ptype_prepare_tx_offload(struct rte_mbuf** bufs, uint32_t n) {
+	for (uint32_t i = 0; i < n; i++) {
+		struct rte_mbuf* buf = bufs[i];
+		uint32_t ptype = buf->packet_type;
+		uint8_t* data = rte_pktmbuf_mtod(buf, uint8_t*);
+		uint64_t flags = buf->ol_flags & ~PKT_TX_L4_MASK;
+		uint32_t l3_off = buf->l2_len;
+		int ipv4, ipv6;
+		uint32_t l4;
+		if (RTE_ETH_IS_TUNNEL_PKT(ptype)) {
+			l3_off += buf->outer_l2_len + buf->outer_l3_len;
+			flags |= PKT_TX_TUNNEL_VXLAN;
+			if (RTE_ETH_IS_IPV4_HDR(ptype)) {
+				flags |= PKT_TX_OUTER_IPV4 | PKT_TX_OUTER_IP_CKSUM;
+				memset(data + buf->outer_l2_len + 10, 0, 2);
+			} else {
+				flags |= PKT_TX_OUTER_IPV6;
+			}
+			uint32_t l3 = ptype & RTE_PTYPE_INNER_L3_MASK;
+			ipv4 = l3 == RTE_PTYPE_INNER_L3_IPV4 || l3 == RTE_PTYPE_INNER_L3_IPV4_EXT;
+			ipv6 = l3 == RTE_PTYPE_INNER_L3_IPV6 || l3 == RTE_PTYPE_INNER_L3_IPV6_EXT;
+			l4 = ptype & RTE_PTYPE_INNER_L4_MASK;
+			l4 = l4 == RTE_PTYPE_INNER_L4_TCP ? RTE_PTYPE_L4_TCP : l4 == RTE_PTYPE_INNER_L4_UDP ? RTE_PTYPE_L4_UDP : 0;
+		} else {
+			ipv4 = RTE_ETH_IS_IPV4_HDR(ptype);
+			ipv6 = RTE_ETH_IS_IPV6_HDR(ptype);
+			l4 = ptype & RTE_PTYPE_L4_MASK;
+		}
+		uint8_t* ip = data + l3_off;
+		if (ipv4) {
+			flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM;
+			memset(ip + 10, 0, 2);
+		} else if (ipv6) {
+			flags |= PKT_TX_IPV6;
+		} else {
+			buf->ol_flags = flags;
+			continue;
+		}
+		uint8_t* l4_hdr = ip + buf->l3_len;
+		uint32_t l4_len = (ipv4 ? read16(ip + 2) : read16(ip + 4) + 40) - buf->l3_len;
+		uint16_t csum;
+		if (l4 == RTE_PTYPE_L4_TCP) {
+			flags |= PKT_TX_TCP_CKSUM;
+			csum = checksum_pseudo_header(ip, PROTO_TCP, l4_len);
+			memcpy(l4_hdr + 16, &csum, 2);
+		} else if (l4 == RTE_PTYPE_L4_UDP) {
+			flags |= PKT_TX_UDP_CKSUM;
+			csum = checksum_pseudo_header(ip, PROTO_UDP, l4_len);
+			memcpy(l4_hdr + 6, &csum, 2);
+		}
+		buf->ol_flags = flags;
+	}
+}
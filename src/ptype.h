@@ -0,0 +1,22 @@
+#ifndef MG_PTYPE_H
+#define MG_PTYPE_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PTYPE_VXLAN_PORT 4789
+
+uint32_t ptype_parse(struct rte_mbuf* buf);
+uint32_t ptype_parse_burst(struct rte_mbuf** bufs, uint32_t n);
+void ptype_prepare_tx_offload(struct rte_mbuf** bufs, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
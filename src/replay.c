@@ -0,0 +1,321 @@
+#include <string.h>
+#include <rte_config.h>
+#include <rte_ethdev.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+#include <rte_cycles.h>
+#include <rte_pause.h>
+#include <rte_prefetch.h>
+
+#include "replay.h"
+#include "pcap.h"
+#include "lifecycle.h"
+#include "memory.h"
+#include "rdtsc.h"
+
+// timing-accurate replay of pcap and pcapng files
+// each file is read ahead in batches, the packet with the earliest timestamp of all files is sent next
+// packets are sent as soon as their deadline passed, all packets that are due are passed to the NIC in
+// a single tx burst, pending packets are flushed before waiting for the next deadline
+
+// packets sent later than this after their deadline are counted as late
+#define REPLAY_LATE_THRESHOLD_NS 1000
+
+struct replay* replay_create(uint16_t port, uint16_t queue, struct rte_mempool* pool, uint32_t mbuf_size, int32_t socket) {
+	struct replay* replay = rte_zmalloc_socket("replay", sizeof(struct replay), RTE_CACHE_LINE_SIZE, socket);
+	if (!replay) {
+		return NULL;
+	}
+	replay->port = port;
+	replay->queue = queue;
+	replay->pool = pool;
+	replay->mbuf_size = mbuf_size;
+	replay->socket = socket;
+	replay->cycles_per_ns = rte_get_tsc_hz() / 1000000000.0;
+	replay->speed = 1;
+	replay->loops = 1;
+	replay->read_ahead = REPLAY_BATCH_SIZE;
+	return replay;
+}
+
+void replay_free(struct replay* replay) {
+	for (uint32_t i = 0; i < replay->num_sources; i++) {
+		struct replay_source* src = replay->sources[i];
+		for (uint32_t j = src->head; j < src->len; j++) {
+			rte_pktmbuf_free(src->bufs[j]);
+		}
+		rte_free(src);
+	}
+	for (uint32_t i = 0; i < replay->tx_len; i++) {
+		rte_pktmbuf_free(replay->tx_bufs[i]);
+	}
+	rte_free(replay);
+}
+
+// all mbufs not held by the replay must fit into the pool, otherwise the replay waits for a free mbuf forever:
+// the tx ring, the per-lcore cache, the pending tx batch, and the read ahead of all sources
+// returns -1 if the pool cannot hold at least one packet per source
+static int update_read_ahead(struct replay* replay, uint32_t num_sources) {
+	struct rte_eth_txq_info info;
+	uint32_t descs = rte_eth_tx_queue_info_get(replay->port, replay->queue, &info) == 0 ? info.nb_desc : REPLAY_DEFAULT_TX_DESCS;
+	// the cache is flushed once it exceeds 1.5 times its size
+	uint32_t reserved = descs + replay->pool->cache_size * 3 / 2 + REPLAY_BATCH_SIZE;
+	if (replay->pool->size < reserved + num_sources) {
+		return -1;
+	}
+	replay->read_ahead = RTE_MIN((replay->pool->size - reserved) / num_sources, REPLAY_BATCH_SIZE);
+	return 0;
+}
+
+// the file must stay mapped until the replay is freed
+// packets are read from [start, size), state is the pcapng reader state at start or NULL to start with no interfaces
+// returns -1 on invalid arguments and -2 if the mempool is too small for another source
+int replay_add_source(struct replay* replay, const uint8_t* data, uint64_t size, uint64_t start, uint32_t format, const struct pcapngReaderState* state) {
+	if (replay->num_sources >= REPLAY_MAX_SOURCES || format > REPLAY_PCAPNG) {
+		return -1;
+	}
+	if (update_read_ahead(replay, replay->num_sources + 1)) {
+		return -2;
+	}
+	struct replay_source* src = rte_zmalloc_socket("replay_source", sizeof(struct replay_source), RTE_CACHE_LINE_SIZE, replay->socket);
+	if (!src) {
+		return -1;
+	}
+	src->data = data;
+	src->size = size;
+	src->start = start;
+	src->offset = start;
+	src->format = format;
+	if (state) {
+		src->start_state = *state;
+		src->ng_state = *state;
+	}
+	replay->sources[replay->num_sources++] = src;
+	return 0;
+}
+
+void replay_set_speed(struct replay* replay, double speed) {
+	replay->speed = speed;
+	replay->cycles_per_pkt = 0;
+}
+
+void replay_set_rate(struct replay* replay, double pps) {
+	replay->cycles_per_pkt = pps > 0 ? rte_get_tsc_hz() / pps : 0;
+}
+
+void replay_set_loops(struct replay* replay, uint64_t loops) {
+	replay->loops = loops;
+}
+
+// replays the timestamp first_ts (ns) at start_tsc instead of replaying the first packet when replay_run() starts
+// start_tsc 0 starts the timeline with the first call of replay_run(), passes are period ns long if period is not 0
+void replay_set_time_base(struct replay* replay, uint64_t first_ts, uint64_t start_tsc, uint64_t period) {
+	replay->has_time_base = 1;
+	replay->base_ts = first_ts;
+	replay->base_tsc = start_tsc;
+	replay->period = period;
+}
+
+// true if no complete record or block follows, the batch readers stop early at the end of the file
+// and if the mempool is empty, this tells the two cases apart
+static int source_at_end(struct replay_source* src, uint64_t offset) {
+	uint64_t remaining = src->size - offset;
+	if (src->format == REPLAY_PCAPNG) {
+		if (remaining < sizeof(struct pcapngBlockHeader)) {
+			return 1;
+		}
+		const struct pcapngBlockHeader* header = (const struct pcapngBlockHeader*) (src->data + offset);
+		return header->total_len < 12 || header->total_len > remaining;
+	}
+	if (remaining < sizeof(struct pcapRecHeader)) {
+		return 1;
+	}
+	const struct pcapRecHeader* header = (const struct pcapRecHeader*) (src->data + offset);
+	return header->incl_len > remaining - sizeof(struct pcapRecHeader);
+}
+
+// reads the next batch of packets, returns 0 at the end of the file or if the mempool is empty
+static uint32_t refill(struct replay* replay, struct replay_source* src) {
+	src->head = 0;
+	src->len = 0;
+	if (src->eof) {
+		return 0;
+	}
+	const uint8_t* pcap = src->data + src->offset;
+	uint64_t remaining = src->size - src->offset;
+	uint32_t n;
+	if (src->format == REPLAY_PCAPNG) {
+		uint64_t consumed;
+		n = libmoon_read_pcapng_batch(replay->pool, src->bufs, replay->read_ahead, pcap, remaining, replay->mbuf_size, &src->ng_state, &consumed);
+		src->offset += consumed;
+	} else {
+		n = remaining >= sizeof(struct pcapRecHeader) ? libmoon_read_pcap_batch(replay->pool, src->bufs, replay->read_ahead, pcap, remaining, replay->mbuf_size) : 0;
+		// the reader stores microseconds, recompute the timestamp to support nanosecond pcaps
+		uint32_t ts_mul = src->format == REPLAY_PCAP_NS ? 1 : 1000;
+		for (uint32_t i = 0; i < n; i++) {
+			const struct pcapRecHeader* header = (const struct pcapRecHeader*) (src->data + src->offset);
+			struct rte_mbuf* buf = src->bufs[i];
+			buf->udata64 = header->ts_sec * 1000000000ULL + (uint64_t) header->ts_usec * ts_mul;
+			// chained mbufs not supported for now
+			buf->pkt_len = buf->data_len;
+			src->offset += header->incl_len + sizeof(struct pcapRecHeader);
+		}
+	}
+	src->len = n;
+	if (n < replay->read_ahead) {
+		src->eof = source_at_end(src, src->offset);
+	}
+	// the next batch is read from the page cache, the kernel is asked for read ahead by the caller (madvise)
+	for (uint32_t i = 0; i < 4 && src->offset + i * 64 < src->size; i++) {
+		rte_prefetch0(src->data + src->offset + i * 64);
+	}
+	return n;
+}
+
+static void rewind_sources(struct replay* replay) {
+	for (uint32_t i = 0; i < replay->num_sources; i++) {
+		struct replay_source* src = replay->sources[i];
+		src->offset = src->start;
+		src->eof = 0;
+		src->ng_state = src->start_state;
+	}
+}
+
+// passes all pending packets to the NIC, retries until the queue accepted all of them or libmoon is stopped
+static void flush(struct replay* replay, uint64_t late_threshold) {
+	uint32_t sent = 0;
+	uint8_t paced = replay->speed > 0 || replay->cycles_per_pkt > 0;
+	while (sent < replay->tx_len) {
+		uint32_t tx = rte_eth_tx_burst(replay->port, replay->queue, replay->tx_bufs + sent, replay->tx_len - sent);
+		uint64_t now = read_rdtsc();
+		for (uint32_t i = sent; i < sent + tx; i++) {
+			if (paced && now > replay->tx_deadlines[i]) {
+				uint64_t lateness = now - replay->tx_deadlines[i];
+				replay->stats.late_cycles += lateness;
+				replay->stats.late += lateness > late_threshold;
+			}
+			replay->stats.bytes += replay->tx_bufs[i]->pkt_len;
+		}
+		sent += tx;
+		replay->stats.packets += tx;
+		replay->stats.last_tsc = now;
+		if (!tx && !libmoon_is_running()) {
+			break;
+		}
+	}
+	for (uint32_t i = sent; i < replay->tx_len; i++) {
+		rte_pktmbuf_free(replay->tx_bufs[i]);
+	}
+	replay->tx_len = 0;
+}
+
+// returns the source with the earliest next packet, NULL if all sources are at their end
+// sets *alloc_failed if a source could not be refilled because the mempool is empty, the packet order
+// is only known once all sources have a packet
+static struct replay_source* next_source(struct replay* replay, uint8_t* alloc_failed) {
+	struct replay_source* best = NULL;
+	uint64_t best_ts = UINT64_MAX;
+	*alloc_failed = 0;
+	for (uint32_t i = 0; i < replay->num_sources; i++) {
+		struct replay_source* src = replay->sources[i];
+		if (src->head == src->len && !refill(replay, src)) {
+			*alloc_failed |= !src->eof;
+			continue;
+		}
+		uint64_t ts = src->bufs[src->head]->udata64;
+		if (ts < best_ts) {
+			best = src;
+			best_ts = ts;
+		}
+	}
+	return best;
+}
+
+uint64_t replay_run(struct replay* replay, uint64_t max_pkts) {
+	uint64_t now = read_rdtsc();
+	uint64_t late_threshold = replay->cycles_per_ns * REPLAY_LATE_THRESHOLD_NS;
+	uint64_t sent = replay->stats.packets;
+	uint64_t taken = 0;
+	if (replay->started) {
+		// do not try to catch up with the time spent outside of this function
+		replay->tsc_base += now - replay->paused_tsc;
+	}
+	if (!replay->stats.first_tsc) {
+		replay->stats.first_tsc = now;
+	}
+	while (taken < max_pkts && libmoon_is_running()) {
+		uint8_t alloc_failed;
+		struct replay_source* src = next_source(replay, &alloc_failed);
+		if (alloc_failed) {
+			// pending packets hold buffers of the same pool
+			replay->stats.alloc_failures++;
+			if (replay->tx_len) {
+				flush(replay, late_threshold);
+			} else {
+				// sent packets are only returned to the pool once the driver cleans up their descriptors
+				reclaim_tx_mbufs(replay->port, replay->queue);
+			}
+			rte_pause();
+			continue;
+		}
+		if (!src) {
+			if (replay->loops && replay->stats.loops >= replay->loops) {
+				// finished in a previous call
+				break;
+			}
+			replay->stats.loops++;
+			if ((replay->loops && replay->stats.loops >= replay->loops) || !replay->pass_packets) {
+				break;
+			}
+			// the next pass starts one inter-packet gap after the last packet or after the period of the shared timeline
+			replay->loop_offset = replay->period ? replay->stats.loops * replay->period : replay->prev_rel + replay->last_gap;
+			replay->pass_packets = 0;
+			rewind_sources(replay);
+			continue;
+		}
+		struct rte_mbuf* buf = src->bufs[src->head++];
+		uint64_t ts = buf->udata64;
+		if (!replay->started) {
+			replay->started = 1;
+			replay->first_ts = replay->has_time_base ? replay->base_ts : ts;
+			replay->tsc_base = replay->base_tsc ? replay->base_tsc : read_rdtsc();
+		}
+		// packets within a file are not necessarily ordered
+		uint64_t rel = (ts > replay->first_ts ? ts - replay->first_ts : 0) + replay->loop_offset;
+		if (rel > replay->prev_rel) {
+			replay->last_gap = rel - replay->prev_rel;
+			replay->prev_rel = rel;
+		}
+		uint64_t deadline;
+		if (replay->cycles_per_pkt > 0) {
+			deadline = replay->tsc_base + (uint64_t) (replay->scheduled * replay->cycles_per_pkt);
+		} else if (replay->speed > 0) {
+			deadline = replay->tsc_base + (uint64_t) (rel * replay->cycles_per_ns / replay->speed);
+		} else {
+			deadline = 0;
+		}
+		replay->scheduled++;
+		replay->pass_packets++;
+		taken++;
+		if (deadline > read_rdtsc()) {
+			flush(replay, late_threshold);
+			// libmoon_is_running() reads the TSC, the deadline check is cheap compared to it
+			while (read_rdtsc() < deadline && libmoon_is_running()) {
+				rte_pause();
+			}
+		}
+		replay->tx_bufs[replay->tx_len] = buf;
+		replay->tx_deadlines[replay->tx_len] = deadline;
+		if (++replay->tx_len == REPLAY_BATCH_SIZE) {
+			flush(replay, late_threshold);
+		}
+	}
+	flush(replay, late_threshold);
+	replay->paused_tsc = read_rdtsc();
+	return replay->stats.packets - sent;
+}
+
+struct replay_stats* replay_get_stats(struct replay* replay) {
+	return &replay->stats;
+}
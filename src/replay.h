@@ -0,0 +1,118 @@
+#ifndef MG_REPLAY_H
+#define MG_REPLAY_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#include "pcap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPLAY_MAX_SOURCES 16
+// packets read ahead per source (at most) and sent per tx burst
+#define REPLAY_BATCH_SIZE 32
+// assumed size of the tx ring if the driver does not report it
+#define REPLAY_DEFAULT_TX_DESCS 1024
+
+enum replay_format {
+	// classic pcap with microsecond timestamps
+	REPLAY_PCAP_US = 0,
+	// classic pcap with nanosecond timestamps (magic 0xa1b23c4d)
+	REPLAY_PCAP_NS = 1,
+	REPLAY_PCAPNG = 2,
+};
+
+struct replay_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	// failed allocations while reading, the replay retries until the pool has free buffers
+	uint64_t alloc_failures;
+	// packets sent more than REPLAY_LATE_THRESHOLD_NS after their deadline
+	uint64_t late;
+	// sum of the lateness of all packets in cycles
+	uint64_t late_cycles;
+	// completed passes over all files
+	uint64_t loops;
+	uint64_t first_tsc;
+	uint64_t last_tsc;
+};
+
+// a memory-mapped capture file, packets are read ahead into bufs
+// timestamps of read packets are stored in udata64 as nanoseconds
+struct replay_source {
+	const uint8_t* data;
+	uint64_t size;
+	// offset of the first packet (record or block), used to restart the file when looping
+	uint64_t start;
+	uint64_t offset;
+	// reader state at start, contains the interfaces defined before start if the source starts in the middle of a pcapng file
+	struct pcapngReaderState start_state;
+	uint32_t format;
+	uint8_t eof;
+	uint32_t head;
+	uint32_t len;
+	struct rte_mbuf* bufs[REPLAY_BATCH_SIZE];
+	struct pcapngReaderState ng_state;
+};
+
+// replays one or more capture files on a tx queue with the original inter-packet gaps, not thread-safe
+// packets from multiple files are merged by timestamp
+struct replay {
+	uint16_t port;
+	uint16_t queue;
+	int32_t socket;
+	uint32_t mbuf_size;
+	struct rte_mempool* pool;
+	// packets read ahead per source, reduced if the pool is too small for REPLAY_BATCH_SIZE per source
+	uint32_t read_ahead;
+	uint32_t num_sources;
+	struct replay_source* sources[REPLAY_MAX_SOURCES];
+	// timestamps are divided by speed, 0 sends as fast as possible
+	double speed;
+	// ignores timestamps and sends at a constant rate if > 0
+	double cycles_per_pkt;
+	double cycles_per_ns;
+	// number of passes over the files, 0 loops forever
+	uint64_t loops;
+	// shared timeline set by replay_set_time_base(), e.g., for ranges of a file replayed by multiple tasks
+	uint8_t has_time_base;
+	uint64_t base_ts;
+	uint64_t base_tsc;
+	uint64_t period;
+	// pacing state, deadline = tsc_base + (ts - first_ts + loop_offset) * cycles_per_ns / speed
+	uint8_t started;
+	uint64_t tsc_base;
+	uint64_t first_ts;
+	// all times relative to first_ts are in nanoseconds
+	uint64_t prev_rel;
+	uint64_t last_gap;
+	uint64_t loop_offset;
+	uint64_t pass_packets;
+	uint64_t scheduled;
+	uint64_t paused_tsc;
+	// packets that are due but not yet passed to the NIC
+	uint32_t tx_len;
+	struct rte_mbuf* tx_bufs[REPLAY_BATCH_SIZE];
+	uint64_t tx_deadlines[REPLAY_BATCH_SIZE];
+	struct replay_stats stats;
+};
+
+struct replay* replay_create(uint16_t port, uint16_t queue, struct rte_mempool* pool, uint32_t mbuf_size, int32_t socket);
+void replay_free(struct replay* replay);
+int replay_add_source(struct replay* replay, const uint8_t* data, uint64_t size, uint64_t start, uint32_t format, const struct pcapngReaderState* state);
+void replay_set_speed(struct replay* replay, double speed);
+void replay_set_rate(struct replay* replay, double pps);
+void replay_set_loops(struct replay* replay, uint64_t loops);
+void replay_set_time_base(struct replay* replay, uint64_t first_ts, uint64_t start_tsc, uint64_t period);
+uint64_t replay_run(struct replay* replay, uint64_t max_pkts);
+struct replay_stats* replay_get_stats(struct replay* replay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
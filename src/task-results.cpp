@@ -1,38 +1,136 @@
 #include <cstdint>
+#include <cstdlib>
 #include <string>
 #include <cstring>
 #include <unordered_map>
+#include <vector>
 #include <tuple>
 #include <mutex>
 #include <iostream>
 #include <atomic>
 
-static std::unordered_map<uint64_t, std::string> results;
+#include <unistd.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// initial size of the result buffer of a slot, grows if a task returns a larger result
+#define TASK_RESULT_INITIAL_SIZE 1024
+
+// completion slot of a task, the master blocks on the futex until the task stored its result
+// slots and their buffers are recycled, so finishing a task does not allocate in the common case
+// a slot is referenced by the task and by its task object, it is recycled once both released it,
+// so tasks that are never waited on do not leak their slot
+struct task_result {
+	std::atomic<uint32_t> done; // futex word
+	uint32_t len;
+	size_t capacity;
+	char* buf;
+	std::atomic<uint32_t> refs;
+};
+
+// only accessed when a task is created, finishes, or is waited on; not while waiting
+static std::unordered_map<uint64_t, task_result*> results;
+static std::vector<task_result*> free_results;
 static std::mutex results_mutex;
 static std::atomic<uint64_t> task_id_ctr(1);
 
+static task_result* find_result(uint64_t task_id) {
+	std::lock_guard<std::mutex> lock(results_mutex);
+	auto result = results.find(task_id);
+	return result != results.end() ? result->second : nullptr;
+}
+
+static void unref_result(uint64_t task_id, task_result* slot) {
+	if (slot->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(results_mutex);
+	results.erase(task_id);
+	free_results.push_back(slot);
+}
+
 extern "C" {
 
 uint64_t task_generate_id() {
-	return task_id_ctr.fetch_add(1);
+	uint64_t task_id = task_id_ctr.fetch_add(1);
+	std::lock_guard<std::mutex> lock(results_mutex);
+	task_result* result;
+	if (free_results.empty()) {
+		result = new task_result();
+		result->capacity = TASK_RESULT_INITIAL_SIZE;
+		result->buf = (char*) malloc(result->capacity);
+	} else {
+		result = free_results.back();
+		free_results.pop_back();
+	}
+	result->done = 0;
+	result->len = 0;
+	result->refs = 2;
+	results.emplace(task_id, result);
+	return task_id;
 }
 
 void task_store_result(uint64_t task_id, char* result) {
-	std::lock_guard<std::mutex> lock(results_mutex);
-	results.emplace(task_id, result);
+	task_result* slot = find_result(task_id);
+	if (!slot) {
+		return;
+	}
+	size_t len = strlen(result);
+	if (len + 1 > slot->capacity) {
+		free(slot->buf);
+		slot->capacity = len + 1;
+		slot->buf = (char*) malloc(slot->capacity);
+	}
+	memcpy(slot->buf, result, len + 1);
+	slot->len = len;
+	slot->done.store(1, std::memory_order_release);
+	syscall(SYS_futex, &slot->done, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+	unref_result(task_id, slot);
+}
+
+// blocks until the task stored its result or the timeout expires
+// returns the completion slot which must be passed to task_release_result() or nullptr on timeout
+task_result* task_wait_result(uint64_t task_id, uint32_t timeout_ms) {
+	task_result* slot = find_result(task_id);
+	if (!slot) {
+		return nullptr;
+	}
+	if (slot->done.load(std::memory_order_acquire)) {
+		return slot;
+	}
+	struct timespec timeout;
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+	// spurious wake ups and timeouts are handled by the caller retrying
+	syscall(SYS_futex, &slot->done, FUTEX_WAIT_PRIVATE, 0, &timeout, nullptr, 0);
+	return slot->done.load(std::memory_order_acquire) ? slot : nullptr;
 }
 
+// releases the reference of the task object, called after waiting or when the task object is collected
+// the slot returns to the pool once the task stored its result, its buffer is invalid afterwards
+void task_release_result(uint64_t task_id) {
+	task_result* slot = find_result(task_id);
+	if (slot) {
+		unref_result(task_id, slot);
+	}
+}
+
+// releases the reference of a task that terminated without storing a result
+void task_abandon_result(uint64_t task_id) {
+	task_release_result(task_id);
+}
+
+// legacy interface, the result is copied and must be freed by the caller
 char* task_get_result(uint64_t task_id) {
-	std::lock_guard<std::mutex> lock(results_mutex);
-	auto result = results.find(task_id);
-	if (result != results.end()) {
-		auto string = result->second;
-		char* buf = (char*) malloc(string.length() + 1);
-		std::strcpy(buf, string.c_str());
-		results.erase(task_id);
-		return buf;
-	}
-	return nullptr;
+	task_result* slot = find_result(task_id);
+	if (!slot || !slot->done.load(std::memory_order_acquire)) {
+		return nullptr;
+	}
+	char* buf = (char*) malloc(slot->len + 1);
+	std::memcpy(buf, slot->buf, slot->len + 1);
+	task_release_result(task_id);
+	return buf;
 }
 
 }
@@ -4,12 +4,18 @@
 #include <memory>
 #include <string>
 #include <sstream>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+#include <sys/stat.h>
 
 extern "C" {
 #include <lauxlib.h>
 #include <lualib.h>
 }
 
+#include <rte_config.h>
 #include <rte_launch.h>
 
 #include "config.h"
@@ -33,10 +39,84 @@ namespace libmoon {
 		return ss.str();
 	}
 
+	// all tasks load the same modules, compiling them only once saves a lot of time when starting many tasks
+	struct cached_chunk {
+		struct timespec mtime;
+		off_t size;
+		std::string bytecode;
+	};
+
+	static std::unordered_map<std::string, cached_chunk> bytecode_cache;
+	static std::mutex bytecode_cache_mutex;
+
+	static int bytecode_writer(lua_State* L, const void* data, size_t size, void* buf) {
+		reinterpret_cast<std::string*>(buf)->append(reinterpret_cast<const char*>(data), size);
+		return 0;
+	}
+
+	// replaces the default Lua file searcher in package.loaders, the cache key is the path and the file's mtime and size
+	static int cached_searcher(lua_State* L) {
+		const char* name = luaL_checkstring(L, 1);
+		lua_getglobal(L, "package");
+		lua_getfield(L, -1, "searchpath");
+		lua_pushstring(L, name);
+		lua_getfield(L, -4, "path");
+		lua_call(L, 2, 2);
+		if (lua_isnil(L, -2)) {
+			// not found, the error message is already on the stack
+			return 1;
+		}
+		std::string path = lua_tostring(L, -2);
+		struct stat st;
+		bool cacheable = ::stat(path.c_str(), &st) == 0;
+		if (cacheable) {
+			std::lock_guard<std::mutex> lock(bytecode_cache_mutex);
+			auto entry = bytecode_cache.find(path);
+			if (entry != bytecode_cache.end()
+			&& entry->second.mtime.tv_sec == st.st_mtim.tv_sec
+			&& entry->second.mtime.tv_nsec == st.st_mtim.tv_nsec
+			&& entry->second.size == st.st_size) {
+				const std::string& bytecode = entry->second.bytecode;
+				if (luaL_loadbuffer(L, bytecode.data(), bytecode.size(), ("@" + path).c_str()) == 0) {
+					return 1;
+				}
+				// should not happen, fall back to the source
+				lua_pop(L, 1);
+			}
+		}
+		if (luaL_loadfile(L, path.c_str())) {
+			return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, path.c_str(), lua_tostring(L, -1));
+		}
+		if (!cacheable) {
+			return 1;
+		}
+		cached_chunk chunk;
+		chunk.mtime = st.st_mtim;
+		chunk.size = st.st_size;
+		// lua_dump keeps debug information, so stack traces still point to the source
+		if (lua_dump(L, bytecode_writer, &chunk.bytecode) == 0) {
+			std::lock_guard<std::mutex> lock(bytecode_cache_mutex);
+			bytecode_cache[path] = std::move(chunk);
+		}
+		return 1;
+	}
+
+	static void install_bytecode_cache(lua_State* L) {
+		lua_getglobal(L, "package");
+		lua_getfield(L, -1, "loaders");
+		// the default Lua searcher is the second entry, after the preload searcher
+		lua_pushcfunction(L, cached_searcher);
+		lua_rawseti(L, -2, 2);
+		lua_pop(L, 2);
+	}
+
 	lua_State* launch_lua() {
 		lua_State* L = luaL_newstate();
 		luaL_openlibs(L);
 		luaL_dostring(L, (std::string("package.path = ") + build_lua_path() + " .. package.path" ).c_str());
+#if LIBMOON_BYTECODE_CACHE
+		install_bytecode_cache(L);
+#endif
 		if (luaL_dostring(L, "require '" LIBMOON_LUA_MAIN_MODULE "'")) {
 			std::cerr << "Could not run main script: " << lua_tostring(L, -1) << std::endl;
 			std::abort();
@@ -62,6 +142,39 @@ namespace libmoon {
 		return 0;
 	}
 
+	// persistent worker running on a shared core, keeps its Lua state between tasks
+	struct worker {
+		std::mutex mutex;
+		std::condition_variable cond;
+		std::string job;
+		bool has_job = false;
+		bool busy = false;
+		bool stop = false;
+	};
+
+	// never freed: workers may still be blocked on their condition variable when the process exits
+	static worker* workers = new worker[RTE_MAX_LCORE];
+
+	int lua_worker_main(void* arg) {
+		lua_State* L = launch_lua();
+		if (!L) {
+			return -1;
+		}
+		lua_getglobal(L, "main");
+		lua_pushstring(L, "worker");
+		if (lua_pcall(L, 1, 0, 0)) {
+			std::cerr << "Lua error: " << lua_tostring(L, -1) << std::endl;
+			// wake up anyone waiting for this worker, the master detects the crash via the lcore state
+			int core = (int)(intptr_t) arg;
+			std::lock_guard<std::mutex> lock(workers[core].mutex);
+			workers[core].busy = false;
+			workers[core].cond.notify_all();
+			return -1;
+		}
+		lua_close(L);
+		return 0;
+	}
+
 }
 
 extern "C" {
@@ -71,5 +184,69 @@ extern "C" {
 		strcpy(arg_copy, arg);
 		rte_eal_remote_launch(&libmoon::lua_core_main, arg_copy, core);
 	}
-}
 
+	void launch_lua_worker(int core) {
+		auto& w = libmoon::workers[core];
+		{
+			std::lock_guard<std::mutex> lock(w.mutex);
+			w.has_job = false;
+			w.busy = false;
+			w.stop = false;
+		}
+		rte_eal_remote_launch(&libmoon::lua_worker_main, (void*)(intptr_t) core, core);
+	}
+
+	// hand a new task to an idle worker, returns 0 if the worker is still busy
+	uint8_t worker_submit(int core, const char* arg) {
+		auto& w = libmoon::workers[core];
+		std::lock_guard<std::mutex> lock(w.mutex);
+		if (w.busy) {
+			return 0;
+		}
+		w.job = arg;
+		w.has_job = true;
+		w.busy = true;
+		w.cond.notify_all();
+		return 1;
+	}
+
+	void worker_stop(int core) {
+		auto& w = libmoon::workers[core];
+		std::lock_guard<std::mutex> lock(w.mutex);
+		w.stop = true;
+		w.cond.notify_all();
+	}
+
+	uint8_t worker_is_busy(int core) {
+		auto& w = libmoon::workers[core];
+		std::lock_guard<std::mutex> lock(w.mutex);
+		return w.busy ? 1 : 0;
+	}
+
+	// called by the master, blocks until the worker finished its current task and reset its state
+	void worker_wait_idle(int core) {
+		auto& w = libmoon::workers[core];
+		std::unique_lock<std::mutex> lock(w.mutex);
+		w.cond.wait(lock, [&] { return !w.busy; });
+	}
+
+	// called by the worker, blocks until a new task arrives
+	// the returned string is valid until worker_job_done() is called, returns nullptr if the worker should exit
+	const char* worker_next_job(int core) {
+		auto& w = libmoon::workers[core];
+		std::unique_lock<std::mutex> lock(w.mutex);
+		w.cond.wait(lock, [&] { return w.has_job || w.stop; });
+		if (w.has_job) {
+			w.has_job = false;
+			return w.job.c_str();
+		}
+		return nullptr;
+	}
+
+	void worker_job_done(int core) {
+		auto& w = libmoon::workers[core];
+		std::lock_guard<std::mutex> lock(w.mutex);
+		w.busy = false;
+		w.cond.notify_all();
+	}
+}
@@ -0,0 +1,119 @@
+#include <string.h>
+#include <immintrin.h>
+#include <rte_config.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#include "templates.h"
+#include "rdtsc.h"
+
+// packet templates: the packet content is copied from a small set of precomputed templates
+// instead of relying on the contents of the mempool from its initialization.
+// the templates are hot in the cache and the copy touches the destination cache lines
+// exactly once instead of causing a read miss on stale mbuf contents
+
+struct pkt_templates* pkt_templates_create(int32_t socket) {
+	struct pkt_templates* tpls = rte_zmalloc_socket("pkt_templates", sizeof(struct pkt_templates), RTE_CACHE_LINE_SIZE, socket);
+	if (tpls) {
+		tpls->rng = read_rdtsc() | 1;
+	}
+	return tpls;
+}
+
+void pkt_templates_free(struct pkt_templates* tpls) {
+	for (uint32_t i = 0; i < tpls->count; i++) {
+		rte_free(tpls->data[i]);
+	}
+	rte_free(tpls);
+}
+
+// returns the index of the template or -1 on error
+int pkt_templates_add(struct pkt_templates* tpls, const void* data, uint16_t len, uint32_t weight) {
+	if (tpls->count >= PKT_TEMPLATES_MAX || !len) {
+		return -1;
+	}
+	uint32_t copy_len = RTE_ALIGN_CEIL(len, PKT_TEMPLATE_ALIGN);
+	uint8_t* tpl = rte_zmalloc("pkt_template", copy_len, RTE_CACHE_LINE_SIZE);
+	if (!tpl) {
+		return -1;
+	}
+	memcpy(tpl, data, len);
+	uint32_t idx = tpls->count;
+	tpls->data[idx] = tpl;
+	tpls->lens[idx] = len;
+	tpls->weights[idx] = (idx ? tpls->weights[idx - 1] : 0) + weight;
+	if (copy_len > tpls->max_copy_len) {
+		tpls->max_copy_len = copy_len;
+	}
+	tpls->count++;
+	return idx;
+}
+
+void pkt_templates_set_mode(struct pkt_templates* tpls, uint32_t mode) {
+	tpls->mode = mode;
+}
+
+static inline uint32_t next_template(struct pkt_templates* tpls) {
+	uint64_t total = tpls->weights[tpls->count - 1];
+	if (tpls->mode == PKT_TEMPLATE_WEIGHTED && total) {
+		// xorshift64*
+		uint64_t x = tpls->rng;
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		tpls->rng = x;
+		uint64_t r = (uint64_t) (((unsigned __int128) (x * 0x2545f4914f6cdd1dULL) * total) >> 64);
+		uint32_t i = 0;
+		while (tpls->weights[i] <= r) {
+			i++;
+		}
+		return i;
+	}
+	uint32_t i = tpls->next;
+	tpls->next = i + 1 == tpls->count ? 0 : i + 1;
+	return i;
+}
+
+// the source is aligned and both buffers are large enough for the rounded up length
+static inline void copy_template(uint8_t* dst, const uint8_t* src, uint32_t len) {
+#ifdef __AVX2__
+	for (uint32_t i = 0; i < len; i += 32) {
+		__m256i v = _mm256_load_si256((const __m256i*) (src + i));
+		_mm256_storeu_si256((__m256i*) (dst + i), v);
+	}
+#else
+	for (uint32_t i = 0; i < len; i += 16) {
+		__m128i v = _mm_load_si128((const __m128i*) (src + i));
+		_mm_storeu_si128((__m128i*) (dst + i), v);
+	}
+#endif
+}
+
+// allocates n mbufs and fills them with the templates, all or nothing
+// indices is optional and receives the template index used for each packet
+// returns the number of mbufs allocated, i.e., 0 or n
+uint32_t pkt_templates_alloc(struct pkt_templates* tpls, struct rte_mempool* mp, struct rte_mbuf** bufs, uint32_t n, uint8_t* indices) {
+	if (!tpls->count) {
+		return 0;
+	}
+	if (rte_pktmbuf_data_room_size(mp) < RTE_PKTMBUF_HEADROOM + tpls->max_copy_len) {
+		return 0;
+	}
+	if (rte_mempool_get_bulk(mp, (void**) bufs, n) != 0) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		struct rte_mbuf* buf = bufs[i];
+		uint32_t tpl = next_template(tpls);
+		rte_mbuf_refcnt_set(buf, 1);
+		rte_pktmbuf_reset(buf);
+		buf->pkt_len = tpls->lens[tpl];
+		buf->data_len = tpls->lens[tpl];
+		copy_template(rte_pktmbuf_mtod(buf, uint8_t*), tpls->data[tpl], RTE_ALIGN_CEIL(tpls->lens[tpl], PKT_TEMPLATE_ALIGN));
+		if (indices) {
+			indices[i] = tpl;
+		}
+	}
+	return n;
+}
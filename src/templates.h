@@ -0,0 +1,46 @@
+#ifndef MG_TEMPLATES_H
+#define MG_TEMPLATES_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PKT_TEMPLATES_MAX 64
+// templates are copied in chunks of this size, the copy may write up to this many bytes - 1 past the packet
+#define PKT_TEMPLATE_ALIGN 32
+
+enum pkt_template_mode {
+	PKT_TEMPLATE_ROUND_ROBIN = 0,
+	PKT_TEMPLATE_WEIGHTED = 1,
+};
+
+// set of packet templates that are copied into freshly allocated mbufs, not thread-safe
+struct pkt_templates {
+	uint32_t count;
+	uint32_t mode;
+	uint32_t next;
+	// length rounded up to PKT_TEMPLATE_ALIGN of the longest template
+	uint32_t max_copy_len;
+	uint64_t rng;
+	// cumulative weights
+	uint64_t weights[PKT_TEMPLATES_MAX];
+	uint16_t lens[PKT_TEMPLATES_MAX];
+	uint8_t* data[PKT_TEMPLATES_MAX];
+};
+
+struct pkt_templates* pkt_templates_create(int32_t socket);
+void pkt_templates_free(struct pkt_templates* tpls);
+int pkt_templates_add(struct pkt_templates* tpls, const void* data, uint16_t len, uint32_t weight);
+void pkt_templates_set_mode(struct pkt_templates* tpls, uint32_t mode);
+uint32_t pkt_templates_alloc(struct pkt_templates* tpls, struct rte_mempool* mp, struct rte_mbuf** bufs, uint32_t n, uint8_t* indices);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,138 @@
+#include <string.h>
+#include <rte_config.h>
+#include <rte_ethdev.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_cycles.h>
+
+#include "txbuffer.h"
+#include "lifecycle.h"
+
+// non-blocking tx: packets are staged and sent in bursts, a queue that does not keep up
+// shows up in the counters instead of stalling the task forever
+
+struct tx_buffer* tx_buffer_create(uint16_t port, uint16_t queue, uint32_t capacity, uint32_t flush_threshold, uint32_t timeout_us, uint32_t policy, uint32_t max_retries, int32_t socket) {
+	if (!capacity || policy > TX_BUFFER_BLOCK) {
+		return NULL;
+	}
+	struct tx_buffer* buf = rte_zmalloc_socket("tx_buffer", sizeof(struct tx_buffer) + capacity * sizeof(struct rte_mbuf*), RTE_CACHE_LINE_SIZE, socket);
+	if (!buf) {
+		return NULL;
+	}
+	buf->port = port;
+	buf->queue = queue;
+	buf->policy = policy;
+	buf->capacity = capacity;
+	buf->flush_threshold = flush_threshold && flush_threshold <= capacity ? flush_threshold : capacity;
+	buf->max_retries = max_retries ? max_retries : 1;
+	buf->timeout_cycles = (uint64_t) timeout_us * rte_get_tsc_hz() / 1000000;
+	return buf;
+}
+
+// staged packets are freed, call tx_buffer_drain() first to send them
+void tx_buffer_free(struct tx_buffer* buf) {
+	for (uint32_t i = 0; i < buf->count; i++) {
+		rte_pktmbuf_free(buf->pkts[i]);
+	}
+	rte_free(buf);
+}
+
+static void drop_oldest(struct tx_buffer* buf, uint32_t n) {
+	for (uint32_t i = 0; i < n; i++) {
+		rte_pktmbuf_free(buf->pkts[i]);
+	}
+	buf->count -= n;
+	memmove(buf->pkts, buf->pkts + n, buf->count * sizeof(struct rte_mbuf*));
+	buf->stats.dropped += n;
+}
+
+// sends as many staged packets as the queue accepts in max_retries bursts
+uint32_t tx_buffer_flush(struct tx_buffer* buf) {
+	uint32_t sent = 0;
+	buf->stats.flushes++;
+	for (uint32_t try = 0; try < buf->max_retries && sent < buf->count; try++) {
+		sent += rte_eth_tx_burst(buf->port, buf->queue, buf->pkts + sent, buf->count - sent);
+		if (sent < buf->count) {
+			buf->stats.retries++;
+		}
+	}
+	buf->count -= sent;
+	if (buf->count) {
+		memmove(buf->pkts, buf->pkts + sent, buf->count * sizeof(struct rte_mbuf*));
+	}
+	// remaining packets are considered new to avoid flushing on every call while the queue is full
+	buf->oldest_tsc = rte_rdtsc();
+	buf->stats.sent += sent;
+	return sent;
+}
+
+// flushes the buffer if the oldest packet exceeded the timeout, call this periodically if no new packets are enqueued
+uint32_t tx_buffer_poll(struct tx_buffer* buf) {
+	if (buf->count && rte_rdtsc() - buf->oldest_tsc >= buf->timeout_cycles) {
+		buf->stats.timeouts++;
+		return tx_buffer_flush(buf);
+	}
+	return 0;
+}
+
+// makes room for n packets according to the policy, returns the number of packets that fit
+static uint32_t make_room(struct tx_buffer* buf, uint32_t n) {
+	uint32_t free = buf->capacity - buf->count;
+	if (free >= n) {
+		return n;
+	}
+	tx_buffer_flush(buf);
+	free = buf->capacity - buf->count;
+	if (free >= n) {
+		return n;
+	}
+	switch (buf->policy) {
+		case TX_BUFFER_DROP_OLDEST:
+			drop_oldest(buf, n - free);
+			return n;
+		case TX_BUFFER_BLOCK:
+			while (buf->capacity - buf->count < n && libmoon_is_running()) {
+				tx_buffer_flush(buf);
+			}
+			return RTE_MIN(n, buf->capacity - buf->count);
+		default:
+			return free;
+	}
+}
+
+// takes ownership of all packets, packets that are dropped due to the policy are freed
+// returns the number of packets that were staged or sent
+uint32_t tx_buffer_enqueue(struct tx_buffer* buf, struct rte_mbuf** pkts, uint32_t num_pkts) {
+	uint32_t accepted = 0;
+	while (accepted < num_pkts) {
+		// bursts larger than the buffer are staged in chunks
+		uint32_t n = RTE_MIN(num_pkts - accepted, buf->capacity);
+		uint32_t fit = make_room(buf, n);
+		if (!buf->count) {
+			buf->oldest_tsc = rte_rdtsc();
+		}
+		memcpy(buf->pkts + buf->count, pkts + accepted, fit * sizeof(struct rte_mbuf*));
+		buf->count += fit;
+		accepted += fit;
+		if (fit < n) {
+			break;
+		}
+		if (buf->count >= buf->flush_threshold) {
+			tx_buffer_flush(buf);
+		}
+	}
+	// drop-newest (or block when stopped)
+	for (uint32_t i = accepted; i < num_pkts; i++) {
+		rte_pktmbuf_free(pkts[i]);
+	}
+	buf->stats.dropped += num_pkts - accepted;
+	tx_buffer_poll(buf);
+	return accepted;
+}
+
+// sends all staged packets, blocks until the queue accepted them or libmoon is stopped
+void tx_buffer_drain(struct tx_buffer* buf) {
+	while (buf->count && libmoon_is_running()) {
+		tx_buffer_flush(buf);
+	}
+}
@@ -0,0 +1,61 @@
+#ifndef MG_TXBUFFER_H
+#define MG_TXBUFFER_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// what to do if the staging buffer is full because the NIC does not accept packets fast enough
+enum tx_buffer_policy {
+	// free the packets that do not fit
+	TX_BUFFER_DROP_NEWEST = 0,
+	// free the oldest staged packets to make room
+	TX_BUFFER_DROP_OLDEST = 1,
+	// retry until there is room (or libmoon is stopped), i.e., the old dpdk_send_all_packets behavior
+	TX_BUFFER_BLOCK = 2,
+};
+
+// counters are only written by the owning task, other tasks may read them without synchronization
+struct tx_buffer_stats {
+	uint64_t sent;
+	// calls to rte_eth_tx_burst that did not accept all packets
+	uint64_t retries;
+	uint64_t dropped;
+	uint64_t flushes;
+	// flushes triggered by the timeout
+	uint64_t timeouts;
+};
+
+// staging buffer for a single tx queue, not thread-safe
+struct tx_buffer {
+	uint16_t port;
+	uint16_t queue;
+	uint32_t policy;
+	uint32_t capacity;
+	uint32_t flush_threshold;
+	// number of tx bursts tried per flush
+	uint32_t max_retries;
+	uint32_t count;
+	uint64_t timeout_cycles;
+	// tsc at which the oldest staged packet was enqueued
+	uint64_t oldest_tsc;
+	struct tx_buffer_stats stats;
+	struct rte_mbuf* pkts[];
+};
+
+struct tx_buffer* tx_buffer_create(uint16_t port, uint16_t queue, uint32_t capacity, uint32_t flush_threshold, uint32_t timeout_us, uint32_t policy, uint32_t max_retries, int32_t socket);
+void tx_buffer_free(struct tx_buffer* buf);
+uint32_t tx_buffer_enqueue(struct tx_buffer* buf, struct rte_mbuf** pkts, uint32_t num_pkts);
+uint32_t tx_buffer_flush(struct tx_buffer* buf);
+uint32_t tx_buffer_poll(struct tx_buffer* buf);
+void tx_buffer_drain(struct tx_buffer* buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
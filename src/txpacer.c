@@ -0,0 +1,137 @@
+#include <rte_config.h>
+#include <rte_ethdev.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_cycles.h>
+#include <rte_pause.h>
+
+#include "txpacer.h"
+#include "lifecycle.h"
+#include "rdtsc.h"
+
+// software pacing: every packet gets a departure time on the TSC based on the size of its predecessors,
+// packets that are due are passed to the NIC in a single burst to keep the per-packet overhead low.
+// this works on all NICs and vdevs, but the precision is limited by the NIC's tx queue which may add
+// its own batching (especially virtio/vmxnet3 with deferred doorbells)
+
+// default upper bound for the lag before the schedule is reset
+#define TX_PACER_MAX_LAG_US 1000
+
+struct tx_pacer* tx_pacer_create(uint16_t port, uint16_t queue, int32_t socket) {
+	struct tx_pacer* pacer = rte_zmalloc_socket("tx_pacer", sizeof(struct tx_pacer), RTE_CACHE_LINE_SIZE, socket);
+	if (!pacer) {
+		return NULL;
+	}
+	pacer->port = port;
+	pacer->queue = queue;
+	pacer->max_batch = 32;
+	pacer->max_lag = rte_get_tsc_hz() / 1000000 * TX_PACER_MAX_LAG_US;
+	return pacer;
+}
+
+void tx_pacer_free(struct tx_pacer* pacer) {
+	rte_free(pacer);
+}
+
+// rate on the wire including the overhead that is added to every packet
+void tx_pacer_set_rate_bps(struct tx_pacer* pacer, double bps, uint32_t overhead) {
+	pacer->cycles_per_pkt = 0;
+	pacer->cycles_per_byte = bps > 0 ? rte_get_tsc_hz() * 8.0 / bps : 0;
+	pacer->overhead = overhead;
+	pacer->next_tsc = 0;
+}
+
+void tx_pacer_set_rate_pps(struct tx_pacer* pacer, double pps) {
+	pacer->cycles_per_pkt = pps > 0 ? rte_get_tsc_hz() / pps : 0;
+	pacer->cycles_per_byte = 0;
+	pacer->overhead = 0;
+	pacer->next_tsc = 0;
+}
+
+void tx_pacer_set_max_batch(struct tx_pacer* pacer, uint32_t max_batch) {
+	pacer->max_batch = max_batch ? max_batch : 1;
+}
+
+static inline double pkt_cycles(struct tx_pacer* pacer, struct rte_mbuf* pkt) {
+	return pacer->cycles_per_pkt + (pkt->pkt_len + pacer->overhead) * pacer->cycles_per_byte;
+}
+
+// blocks until all packets are sent according to the schedule (or libmoon is stopped)
+// returns the number of packets sent, unsent packets are freed
+uint32_t tx_pacer_send(struct tx_pacer* pacer, struct rte_mbuf** pkts, uint32_t num_pkts) {
+	uint32_t sent = 0;
+	uint64_t now = read_rdtsc();
+	if (pacer->next_tsc == 0 || now > pacer->next_tsc + pacer->max_lag) {
+		if (pacer->next_tsc != 0) {
+			pacer->stats.resets++;
+		}
+		pacer->next_tsc = now;
+	}
+	if (!pacer->stats.first_tsc) {
+		pacer->stats.first_tsc = now;
+	}
+	while (sent < num_pkts) {
+		// the wait can take a long time at low rates, so it must not delay the shutdown
+		while ((now = read_rdtsc()) < pacer->next_tsc && libmoon_is_running()) {
+			rte_pause();
+		}
+		if (now < pacer->next_tsc) {
+			break;
+		}
+		// the first packet is due, add all packets that are due by now to the batch
+		uint64_t error = now - (uint64_t) pacer->next_tsc;
+		if (error > pacer->stats.error_max) {
+			pacer->stats.error_max = error;
+		}
+		uint32_t batch = 0;
+		do {
+			pacer->stats.error_sum += now - (uint64_t) pacer->next_tsc;
+			pacer->next_tsc += pkt_cycles(pacer, pkts[sent + batch]);
+			batch++;
+		} while (sent + batch < num_pkts && batch < pacer->max_batch && pacer->next_tsc <= now);
+		uint32_t batch_sent = 0;
+		while (batch_sent < batch) {
+			batch_sent += rte_eth_tx_burst(pacer->port, pacer->queue, pkts + sent + batch_sent, batch - batch_sent);
+			if (batch_sent < batch && !libmoon_is_running()) {
+				break;
+			}
+		}
+		for (uint32_t i = 0; i < batch_sent; i++) {
+			pacer->stats.bytes += pkts[sent + i]->pkt_len;
+		}
+		pacer->stats.packets += batch_sent;
+		sent += batch_sent;
+		if (batch_sent < batch) {
+			break;
+		}
+	}
+	pacer->stats.last_tsc = now;
+	for (uint32_t i = sent; i < num_pkts; i++) {
+		rte_pktmbuf_free(pkts[i]);
+	}
+	return sent;
+}
+
+double tx_pacer_get_rate_pps(struct tx_pacer* pacer) {
+	uint64_t cycles = pacer->stats.last_tsc - pacer->stats.first_tsc;
+	return cycles ? (double) pacer->stats.packets * rte_get_tsc_hz() / cycles : 0;
+}
+
+// achieved rate on the wire, including the overhead configured in tx_pacer_set_rate_bps() or 24 bytes in pps mode
+double tx_pacer_get_rate_bps(struct tx_pacer* pacer) {
+	uint64_t cycles = pacer->stats.last_tsc - pacer->stats.first_tsc;
+	uint32_t overhead = pacer->cycles_per_byte ? pacer->overhead : TX_PACER_WIRE_OVERHEAD;
+	uint64_t bytes = pacer->stats.bytes + pacer->stats.packets * overhead;
+	return cycles ? (double) bytes * 8 * rte_get_tsc_hz() / cycles : 0;
+}
+
+double tx_pacer_get_mean_error_ns(struct tx_pacer* pacer) {
+	if (!pacer->stats.packets) {
+		return 0;
+	}
+	return (double) pacer->stats.error_sum / pacer->stats.packets * 1000000000 / rte_get_tsc_hz();
+}
+
+double tx_pacer_get_max_error_ns(struct tx_pacer* pacer) {
+	return (double) pacer->stats.error_max * 1000000000 / rte_get_tsc_hz();
+}
@@ -0,0 +1,58 @@
+#ifndef MG_TXPACER_H
+#define MG_TXPACER_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// preamble (7), SFD (1), IFG (12), and CRC (4, not included in pkt_len)
+#define TX_PACER_WIRE_OVERHEAD 24
+
+struct tx_pacer_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t first_tsc;
+	uint64_t last_tsc;
+	// difference between the scheduled and the actual departure time in cycles
+	uint64_t error_sum;
+	uint64_t error_max;
+	// number of times the pacer fell too far behind and reset its schedule
+	uint64_t resets;
+};
+
+// software rate limiter for a single tx queue, not thread-safe
+struct tx_pacer {
+	uint16_t port;
+	uint16_t queue;
+	uint32_t max_batch;
+	// cycles per packet + cycles per byte on the wire, one of them is 0 depending on the rate unit
+	double cycles_per_pkt;
+	double cycles_per_byte;
+	uint32_t overhead;
+	// we give up on catching up if we are behind the schedule by more than this
+	uint64_t max_lag;
+	// departure time of the next packet
+	double next_tsc;
+	struct tx_pacer_stats stats;
+};
+
+struct tx_pacer* tx_pacer_create(uint16_t port, uint16_t queue, int32_t socket);
+void tx_pacer_free(struct tx_pacer* pacer);
+void tx_pacer_set_rate_bps(struct tx_pacer* pacer, double bps, uint32_t overhead);
+void tx_pacer_set_rate_pps(struct tx_pacer* pacer, double pps);
+void tx_pacer_set_max_batch(struct tx_pacer* pacer, uint32_t max_batch);
+uint32_t tx_pacer_send(struct tx_pacer* pacer, struct rte_mbuf** pkts, uint32_t num_pkts);
+double tx_pacer_get_rate_pps(struct tx_pacer* pacer);
+double tx_pacer_get_rate_bps(struct tx_pacer* pacer);
+double tx_pacer_get_mean_error_ns(struct tx_pacer* pacer);
+double tx_pacer_get_max_error_ns(struct tx_pacer* pacer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,132 @@
+--- Checks the mempool cache (memory.enableCache()): owner counting, recycling, and racing retain/release.
+--- Run with: libmoon test/mempool-cache.lua --dpdk-config=test/net-ring-dpdk-conf.lua
+local lm     = require "libmoon"
+local memory = require "memory"
+local dpdkc  = require "dpdkc"
+local ffi    = require "ffi"
+local log    = require "log"
+
+local BUF_SIZE = 2048
+local ITERATIONS = 10^6
+local NUM_RACERS = 2
+
+-- every check uses its own pool size so that it only ever gets its own pool back from the cache
+local function createPool(n)
+	local pool = dpdkc.init_mem(n, select(2, lm.getCore()), BUF_SIZE)
+	assert(pool ~= nil, "could not create mempool")
+	return pool
+end
+
+local function getCached(n)
+	local pool = dpdkc.mempool_cache_get(n, select(2, lm.getCore()), BUF_SIZE)
+	return pool ~= nil and pool or nil
+end
+
+-- pools are passed as numbers to the racing tasks, pools passed as arguments are retained automatically
+local function poolToNumber(pool)
+	return tonumber(ffi.cast("uintptr_t", pool))
+end
+
+local function numberToPool(addr)
+	return ffi.cast("struct mempool*", addr)
+end
+
+-- two owners: the pool is only cached once both released it
+local function checkSharedPool()
+	local n = 1001
+	local pool = createPool(n)
+	dpdkc.mempool_cache_retain(pool)
+	dpdkc.mempool_cache_release(pool)
+	assert(not getCached(n), "pool was cached while an owner still holds it")
+	dpdkc.mempool_cache_release(pool)
+	assert(getCached(n) == pool, "pool was not cached after the last owner released it")
+	assert(not getCached(n), "cached pool was handed out twice")
+	dpdkc.mempool_cache_release(pool)
+end
+
+-- a pool released with mbufs in flight is only recycled once they were returned
+local function checkUndrainedPool()
+	local n = 1002
+	local pool = createPool(n)
+	local buf = pool:alloc(60)
+	assert(buf ~= nil)
+	dpdkc.mempool_cache_release(pool)
+	assert(not getCached(n), "pool was recycled with an mbuf in flight")
+	dpdkc.rte_pktmbuf_free_export(buf)
+	assert(getCached(n) == pool, "drained pool was not recycled")
+	dpdkc.mempool_cache_release(pool)
+end
+
+-- a cached slot is reused: by retain() reviving it and by mempool_cache_get() which clears the buffers
+local function checkCachedReuse()
+	local n = 1003
+	local pool = createPool(n)
+	local buf = pool:alloc(60)
+	ffi.fill(buf:getData(), 60, 0xff)
+	dpdkc.rte_pktmbuf_free_export(buf)
+	dpdkc.mempool_cache_release(pool)
+	dpdkc.mempool_cache_retain(pool)
+	assert(not getCached(n), "retain() did not take the pool back out of the cache")
+	dpdkc.mempool_cache_release(pool)
+	assert(getCached(n) == pool, "pool was not cached again")
+	local bufs = {}
+	for i = 1, n do
+		bufs[i] = pool:alloc(60)
+		assert(bufs[i] ~= nil, "recycled pool is missing mbufs")
+		local data = ffi.cast("uint8_t*", bufs[i]:getData())
+		for j = 0, 59 do
+			assert(data[j] == 0, "recycled mbuf was not cleared")
+		end
+	end
+	for _, b in ipairs(bufs) do
+		dpdkc.rte_pktmbuf_free_export(b)
+	end
+	dpdkc.mempool_cache_release(pool)
+end
+
+function racer(addr, iterations)
+	local pool = numberToPool(addr)
+	for i = 1, iterations do
+		dpdkc.mempool_cache_retain(pool)
+		dpdkc.mempool_cache_release(pool)
+	end
+end
+
+local function startRacers(pool)
+	local tasks = {}
+	for i = 1, NUM_RACERS do
+		tasks[i] = lm.startTask("racer", poolToNumber(pool), ITERATIONS)
+	end
+	return tasks
+end
+
+-- racing owners while holding a reference: the pool must never become available
+-- racing owners without a reference: the pool must end up in the cache exactly once
+local function checkRacingOwners()
+	local n = 1004
+	local pool = createPool(n)
+	local tasks = startRacers(pool)
+	while tasks[1]:isRunning() do
+		assert(not getCached(n), "pool was handed out while owned")
+	end
+	for _, task in ipairs(tasks) do
+		task:wait()
+	end
+	dpdkc.mempool_cache_release(pool)
+	tasks = startRacers(pool)
+	for _, task in ipairs(tasks) do
+		task:wait()
+	end
+	assert(getCached(n) == pool, "racing retain/release lost the pool")
+	assert(not getCached(n), "racing retain/release cached the pool twice")
+	dpdkc.mempool_cache_release(pool)
+end
+
+function master()
+	memory.enableCache()
+	checkSharedPool()
+	checkUndrainedPool()
+	checkCachedReuse()
+	checkRacingOwners()
+	log:info("mempool cache ok")
+end
@@ -0,0 +1,70 @@
+--- Checks bufArray allocations from an exhausted mempool: no waiting by default, timeouts, partial allocations,
+--- and the failure counters (mempool:getAllocStats()).
+--- Run with: libmoon test/mempool-exhaustion.lua --dpdk-config=test/net-ring-dpdk-conf.lua
+local lm     = require "libmoon"
+local memory = require "memory"
+local log    = require "log"
+
+local POOL_SIZE = 2047
+local BATCH = 1024
+local TIMEOUT = 2000 -- microseconds
+
+local function checkStats(mempool, failures, partial, timeouts)
+	local stats = mempool:getAllocStats()
+	assert(stats.failures == failures and stats.partial == partial and stats.timeouts == timeouts,
+		("unexpected counters: failures %d, partial %d, timeouts %d"):format(stats.failures, stats.partial, stats.timeouts))
+end
+
+-- returns the result of f and the time it took in microseconds
+local function timed(f, ...)
+	local start = lm.getTime()
+	local result = f(...)
+	return result, (lm.getTime() - start) * 10^6
+end
+
+function testTask()
+	local mempool = memory.createMemPool{ n = POOL_SIZE }
+	local bufs = mempool:bufArray(BATCH)
+	local held = mempool:bufArray(BATCH)
+	checkStats(mempool, 0, 0, 0)
+	assert(held:alloc(60), "allocation from a fresh pool failed")
+
+	-- exhausted pool: alloc() returns immediately and leaves an empty array
+	assert(not bufs:alloc(60), "allocated more buffers than the pool has")
+	assert(bufs.size == 0, "failed allocation left buffers in the array")
+	checkStats(mempool, 1, 0, 1)
+
+	-- waiting alloc() gives up after the timeout
+	local ok, elapsed = timed(bufs.alloc, bufs, 60, TIMEOUT)
+	assert(not ok and bufs.size == 0)
+	assert(elapsed >= TIMEOUT and elapsed < TIMEOUT + 10^6, ("timeout took %d us"):format(elapsed))
+	checkStats(mempool, 2, 0, 2)
+
+	-- allocPartial() takes what is left in smaller bursts
+	local n = bufs:allocPartial(60)
+	assert(n == POOL_SIZE - BATCH and bufs.size == n, ("partial allocation returned %d buffers"):format(n))
+	checkStats(mempool, 3, 1, 2)
+
+	-- nothing left: allocPartial() waits for the timeout and returns 0
+	local other = mempool:bufArray(BATCH)
+	n, elapsed = timed(other.allocPartial, other, 60, 64, TIMEOUT)
+	assert(n == 0 and other.size == 0)
+	assert(elapsed >= TIMEOUT, ("partial timeout took %d us"):format(elapsed))
+	checkStats(mempool, 4, 1, 3)
+
+	-- without a timeout allocPartial() only counts the failure
+	assert(other:allocPartial(60) == 0)
+	checkStats(mempool, 5, 1, 3)
+
+	-- the array is filled again once buffers are returned, successful allocations are not counted
+	held:freeAll()
+	bufs:freeAll()
+	assert(other:allocN(60, BATCH) and other.size == BATCH, "allocation failed after the pool was refilled")
+	checkStats(mempool, 5, 1, 3)
+	other:freeAll()
+	log:info("mempool exhaustion ok")
+end
+
+function master()
+	lm.startTask("testTask"):wait()
+end
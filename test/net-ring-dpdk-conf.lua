@@ -0,0 +1,8 @@
+-- DPDK config for tests that do not need a NIC: creates a net_ring device, packets sent on a queue
+-- can be received from the same queue
+DPDKConfig {
+	cli = {
+		"--vdev=net_ring0",
+		"--no-pci",
+	}
+}
@@ -0,0 +1,79 @@
+--- Stress test for the NUMA allocator (memory.allocNuma), objects are allocated by several tasks
+--- until the hugepages are exhausted and freed by other tasks.
+--- Run with: libmoon test/numa-arena.lua --dpdk-config=test/small-memory-dpdk-conf.lua
+local lm     = require "libmoon"
+local memory = require "memory"
+local ffi    = require "ffi"
+local log    = require "log"
+
+local NUM_TASKS = 4
+local NUM_OBJS = 5000
+local ROUNDS = 20
+
+local function objSize(i)
+	-- mostly size classes, every 50th object is a large allocation
+	return i % 50 == 0 and 20000 + i or (i * 37) % 9000 + 1
+end
+
+local function allocObj(i, socket)
+	local size = objSize(i)
+	local obj = memory.allocNuma("uint8_t*", size, socket)
+	assert(ffi.C.arena_get_socket(obj) == socket, "object was allocated on the wrong socket")
+	ffi.fill(obj, size, i % 256)
+	return obj
+end
+
+local function checkObj(obj, i)
+	local size = objSize(i)
+	assert(obj[0] == i % 256 and obj[size - 1] == i % 256, "object " .. i .. " was overwritten")
+end
+
+-- objects with an even index are freed by this task, the others are returned to the master task
+function stressTask(id)
+	local socket = select(2, lm.getCore())
+	local objs = {}
+	for round = 1, ROUNDS do
+		for i = 1, NUM_OBJS do
+			objs[i] = allocObj(i + id, socket)
+		end
+		for i = 1, NUM_OBJS do
+			checkObj(objs[i], i + id)
+			if round < ROUNDS or i % 2 == 0 then
+				memory.freeNuma(objs[i])
+			end
+		end
+	end
+	local remote = {}
+	for i = 1, NUM_OBJS, 2 do
+		remote[#remote + 1] = tonumber(ffi.cast("uintptr_t", objs[i]))
+	end
+	return remote
+end
+
+function master()
+	assert(not pcall(memory.allocNuma, "uint8_t*", 64, 8), "allocNuma accepted an invalid socket")
+	local tasks = {}
+	for id = 1, NUM_TASKS do
+		tasks[id] = lm.startTask("stressTask", id)
+	end
+	for id, task in ipairs(tasks) do
+		local remote = task:wait()
+		for j, addr in ipairs(remote) do
+			local obj = ffi.cast("uint8_t*", addr)
+			checkObj(obj, (j - 1) * 2 + 1 + id)
+			memory.freeNuma(obj)
+		end
+	end
+	local fallbackBytes = 0
+	for socket = 0, 7 do
+		local stats = memory.getNumaStats(socket)
+		if stats.slabs > 0 then
+			log:info("socket %d: huge pages %d MiB, system memory %d MiB, %d slabs, %d large allocations live",
+				socket, stats.hugeBytes / 2^20, stats.fallbackBytes / 2^20, stats.slabs, stats.largeAllocs)
+		end
+		assert(stats.largeAllocs == 0, "large allocations leaked")
+		fallbackBytes = fallbackBytes + stats.fallbackBytes
+	end
+	assert(fallbackBytes > 0, "the hugepages were not exhausted, the fallback was not tested")
+	log:info("NUMA allocator ok")
+end
@@ -0,0 +1,95 @@
+--- Writes pcap files with the O_DIRECT/io_uring writer and reads them back.
+--- Run with: libmoon test/pcap-direct-tmpfs.lua [directory]
+--- The directory defaults to /dev/shm (tmpfs), pass the mount point of a loop device to test a block device.
+local lm     = require "libmoon"
+local memory = require "memory"
+local pcap   = require "pcap"
+local ffi    = require "ffi"
+local log    = require "log"
+local S      = require "syscall"
+
+local NUM_PKTS = 20000
+-- small buffers so that many writes are in flight and records cross buffer boundaries
+local BUF_SIZE = 64 * 1024
+local NUM_BUFS = 4
+
+local function pktSize(i)
+	return 60 + i % 1400
+end
+
+-- quarter seconds are exact as doubles and in nanoseconds
+local function pktTime(i)
+	return i + i % 4 / 4
+end
+
+local function writeFile(filename, pcapng)
+	local writer = pcap:newDirectWriter(filename, pcapng, 0, BUF_SIZE, NUM_BUFS)
+	if pcapng then
+		writer:addInterface("test")
+	end
+	local data = ffi.new("uint8_t[?]", 1500)
+	local seq = ffi.cast("uint32_t*", data)
+	for i = 0, NUM_PKTS - 1 do
+		seq[0] = i
+		assert(writer:write(pktTime(i), data, pktSize(i)), "write failed")
+	end
+	local stats = writer:getStats()
+	log:info("%s: %d writes, O_DIRECT %s, io_uring %s, max queue depth %d, %d stalls",
+		filename, stats.writes, stats.direct, stats.uring, stats.maxQueueDepth, stats.stalls)
+	local size = writer:close()
+	assert(size, "closing the writer failed")
+	assert(S.stat(filename).size == size, "file size does not match the size returned by close()")
+	return size
+end
+
+-- reads the file back and compares sizes, contents, and timestamps of all packets
+local function readBack(filename)
+	local mempool = memory.createMemPool()
+	local bufs = mempool:bufArray()
+	local reader = pcap:newReader(filename)
+	local i = 0
+	while true do
+		local n = reader:read(bufs)
+		if n == 0 then
+			break
+		end
+		for j = 1, n do
+			local buf = bufs[j]
+			assert(buf:getSize() == pktSize(i), "packet " .. i .. " has the wrong size")
+			assert(ffi.cast("uint32_t*", buf:getData())[0] == i, "packet " .. i .. " has the wrong contents")
+			assert(reader:getTimestampNs(buf) == ffi.cast("uint64_t", pktTime(i) * 10^9), "packet " .. i .. " has the wrong timestamp")
+			i = i + 1
+		end
+		bufs:free(n)
+	end
+	reader:close()
+	assert(i == NUM_PKTS, "read " .. i .. " packets")
+end
+
+local function checkPcap(filename)
+	local expected = 24
+	for i = 0, NUM_PKTS - 1 do
+		expected = expected + 16 + pktSize(i)
+	end
+	assert(writeFile(filename, false) == expected, "unexpected file size")
+	readBack(filename)
+end
+
+local function checkPcapng(filename)
+	writeFile(filename, true)
+	readBack(filename)
+end
+
+function master(dir)
+	dir = dir or "/dev/shm"
+	lm.startTask("testTask", dir):wait()
+end
+
+function testTask(dir)
+	local base = dir .. "/libmoon-pcap-direct-test-" .. S.getpid()
+	checkPcap(base .. ".pcap")
+	checkPcapng(base .. ".pcapng")
+	S.unlink(base .. ".pcap")
+	S.unlink(base .. ".pcapng")
+	log:info("direct writer ok")
+end
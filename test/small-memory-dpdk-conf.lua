@@ -0,0 +1,7 @@
+-- DPDK config for tests that exhaust the hugepages: no NICs and only 64 MiB of hugepage memory
+DPDKConfig {
+	cli = {
+		"--no-pci",
+		"-m", "64",
+	}
+}
@@ -28,9 +28,26 @@ function shouldNotLeak(table)
 	return table
 end
 
+-- persistent workers reuse their Lua state, so the task must not observe anything left over by the previous one
+function shouldNotLeakWorker(table)
+	local mem = collectgarbage("count")
+	assert(LEAKED_GLOBAL == nil, "global variable survived the worker reset")
+	LEAKED_GLOBAL = makeLargeTable()
+	return shouldNotLeak(table), mem
+end
+
 function master()
 	for i = 1, 500 do
 		checkResult(lm.startTask("shouldNotLeak", makeLargeTable()):wait())
 	end
+	lm.enableSharedTaskWorkers()
+	local initialMem
+	for i = 1, 500 do
+		local result, mem = lm.startSharedTask("shouldNotLeakWorker", makeLargeTable()):wait()
+		checkResult(result)
+		initialMem = initialMem or mem
+		assert(mem < initialMem * 2, ("worker state grew from %d KiB to %d KiB"):format(initialMem, mem))
+	end
+	lm.stopSharedTaskWorkers()
 end
 
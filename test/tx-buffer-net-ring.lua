@@ -0,0 +1,96 @@
+--- Checks the tx buffer counters (txQueue:sendBuffered()) against a net_ring device.
+--- Run with: libmoon test/tx-buffer-net-ring.lua --dpdk-config=test/net-ring-dpdk-conf.lua
+local lm     = require "libmoon"
+local device = require "device"
+local memory = require "memory"
+local log    = require "log"
+
+local TOTAL = 4096
+local BATCH = 32
+
+local function findRingDevice()
+	for _, dev in ipairs(device.getDevices()) do
+		if dev.name:match("ring") then
+			return dev.id
+		end
+	end
+	log:fatal("no net_ring device found, run with --dpdk-config=test/net-ring-dpdk-conf.lua")
+end
+
+-- receives until the ring is empty, returns the number of packets
+local function drainRx(queue, bufs)
+	local total = 0
+	while true do
+		local rx = queue:tryRecv(bufs, 0)
+		if rx == 0 then
+			return total
+		end
+		total = total + rx
+		bufs:freeAll()
+	end
+end
+
+local function checkAccounting(txQueue, rxQueue, policy)
+	local mempool = memory.createMemPool()
+	local bufs = mempool:bufArray(BATCH)
+	local rxBufs = mempool:bufArray(BATCH)
+	txQueue:enableBuffering{ size = 256, flushSize = BATCH, policy = policy }
+	local accepted = 0
+	-- nobody receives, so the ring and then the buffer fill up
+	for i = 1, TOTAL / BATCH do
+		assert(bufs:alloc(60), "mempool exhausted")
+		accepted = accepted + txQueue:sendBuffered(bufs)
+	end
+	local stats = txQueue:getBufferStats()
+	log:info("%-10s sent %d, dropped %d, staged %d, retries %d, flushes %d",
+		policy, stats.sent, stats.dropped, stats.staged, stats.retries, stats.flushes)
+	assert(stats.sent + stats.dropped + stats.staged == TOTAL, "packets lost in the accounting")
+	assert(stats.dropped > 0 and stats.retries > 0, "the ring should have been full")
+	if policy == "dropNewest" then
+		assert(accepted == TOTAL - stats.dropped, "accepted packets do not match the drop counter")
+	end
+	assert(drainRx(rxQueue, rxBufs) == stats.sent, "received packets do not match the sent counter")
+	local staged = stats.staged
+	txQueue:flush(true)
+	stats = txQueue:getBufferStats()
+	assert(stats.staged == 0 and stats.sent + stats.dropped == TOTAL, "drain did not send all staged packets")
+	assert(drainRx(rxQueue, rxBufs) == staged, "received packets do not match the drained packets")
+
+	-- a partial batch is only sent once the timeout expires
+	txQueue:enableBuffering{ flushSize = BATCH, timeout = 1000, policy = policy }
+	bufs:allocN(60, BATCH / 2)
+	assert(txQueue:sendBuffered(bufs, BATCH / 2) == BATCH / 2)
+	txQueue:flush()
+	assert(drainRx(rxQueue, rxBufs) == 0, "partial batch was sent before the timeout")
+	lm.sleepMillis(2)
+	txQueue:flush()
+	stats = txQueue:getBufferStats()
+	assert(stats.timeouts == 1 and stats.sent == BATCH / 2, "timeout did not flush the partial batch")
+	assert(drainRx(rxQueue, rxBufs) == BATCH / 2)
+end
+
+function master()
+	local dev = device.config{ port = findRingDevice() }
+	lm.startTask("testTask", dev:getTxQueue(0), dev:getRxQueue(0)):wait()
+	-- packets staged by a task that never flushes are sent when the task terminates
+	local staged = lm.startTask("stageTask", dev:getTxQueue(0)):wait()
+	local rxBufs = memory.createMemPool():bufArray(BATCH)
+	assert(drainRx(dev:getRxQueue(0), rxBufs) == staged, "staged packets were not flushed on task exit")
+	log:info("tx buffer flushed on task exit ok")
+end
+
+function testTask(txQueue, rxQueue)
+	checkAccounting(txQueue, rxQueue, "dropNewest")
+	checkAccounting(txQueue, rxQueue, "dropOldest")
+	log:info("tx buffer accounting ok")
+end
+
+function stageTask(txQueue)
+	local bufs = memory.createMemPool():bufArray(BATCH)
+	txQueue:enableBuffering{ size = 256, flushSize = 256, timeout = 10^6 }
+	assert(bufs:alloc(60))
+	assert(txQueue:sendBuffered(bufs) == BATCH)
+	local stats = txQueue:getBufferStats()
+	assert(stats.staged == BATCH and stats.sent == 0)
+	return stats.staged
+end